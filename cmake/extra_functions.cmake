@@ -21,6 +21,7 @@ function(SANCHECK place)
 	aux_source_directory(sancheck/${place}/ SAN_CHECK_SRC)
 	add_executable(sancheck_${place} ${SAN_CHECK_SRC})
 	FINALIZE(sancheck_${place})
+	target_include_directories(sancheck_${place} PRIVATE ${CMAKE_SOURCE_DIR}/sancheck/common)
 	target_link_libraries(sancheck_${place} PRIVATE ${ARGN})
 endfunction()
 
@@ -41,6 +42,19 @@ endfunction()
 function(PYADD place)
 	set(EASY_LOCAL_SRC)
 	aux_source_directory(lib/${place}/ EASY_LOCAL_SRC)
+	list(TRANSFORM EASY_LOCAL_SRC REPLACE "//" "/")
+	# Skip sources already built into a linked static library, which must
+	# list them relative to the source tree (e.g. pycutec2_core)
+	foreach(dep ${ARGN})
+		if (TARGET ${dep})
+			get_target_property(dep_type ${dep} TYPE)
+			get_target_property(dep_imported ${dep} IMPORTED)
+			if (dep_type STREQUAL "STATIC_LIBRARY" AND NOT dep_imported)
+				get_target_property(dep_src ${dep} SOURCES)
+				list(REMOVE_ITEM EASY_LOCAL_SRC ${dep_src})
+			endif()
+		endif()
+	endforeach()
 	pybind11_add_module(${place} ${EASY_LOCAL_SRC})
 	target_include_directories(${place} BEFORE PRIVATE ${PYTHON_INCLUDE_DIR} ${EXTERNAL_PROJECTS_INSTALL_PREFIX}/include)
 	target_link_directories(${place} BEFORE PRIVATE ${EXTERNAL_PROJECTS_INSTALL_PREFIX}/lib ${EXTERNAL_PROJECTS_INSTALL_PREFIX}/lib64)
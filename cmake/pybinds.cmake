@@ -13,4 +13,7 @@ PYADD(pyvistexture osr ${VISUAL_PACK})
 add_dependencies(pyvistexture osr)
 endif()
 
-PYADD(pycutec2)
+# The geometry engine of pycutec2, also used by sancheck_segindex
+add_library(pycutec2_core STATIC lib/pycutec2/pycutec2.cc)
+set_property(TARGET pycutec2_core PROPERTY POSITION_INDEPENDENT_CODE ON)
+PYADD(pycutec2 pycutec2_core)
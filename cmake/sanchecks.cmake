@@ -11,8 +11,24 @@ SANCHECK(fclcontacts)
 use_ccd(sancheck_fclcontacts)
 use_fcl(sancheck_fclcontacts)
 
+SANCHECK(tritri tritri)
+
+SANCHECK(roadmap)
+
+SANCHECK(segindex pycutec2_core)
+
+SANCHECK(vpknn osr)
+SANCHECK(unitworld osr)
+
+if (TARGET goct)
+	SANCHECK(goctree goct)
+endif (TARGET goct)
+
 if (USE_GPU)
 	SANCHECK(osr)
 	target_link_libraries(sancheck_osr osr)
 	# target_compile_definitions(sancheck_osr PRIVATE GPU_ENABLED=1)
+
+	SANCHECK(cpurender osr)
+	SANCHECK(baryatlas osr)
 endif (USE_GPU)
@@ -16,6 +16,7 @@
 #include <iostream>
 #include <stdexcept>
 #include <boost/heap/priority_queue.hpp>
+#include <omp.h>
 
 /*
  * DFS: prioritize larger cubes connected to the initial cube
@@ -98,7 +99,7 @@ public:
 
 	static bool coverage(const Coord& state,
 			    const Coord& clearance,
-			    Node *node)
+			    const Node *node)
 	{
 		Coord mins, maxs;
 		node->getBV(mins, maxs);
@@ -130,7 +131,26 @@ public:
 	 */
 	void buildOcTree(CC& cc)
 	{
-		init_builder(cc);
+		buildOcTree(std::vector<CC*>(1, &cc), 1);
+	}
+
+	/*
+	 * Parallel tree building
+	 *
+	 *      ccs[i] is the clearance calculator of the i-th worker thread,
+	 *      since ClearanceCalculator is not thread-safe.
+	 *
+	 *      Up to batch cubes (ccs.size() by default) are popped from the
+	 *      cube list and split at once, and the clearance of all their
+	 *      children is evaluated by the workers. Connecting the children and
+	 *      updating the cube list are still serial, in the same order as the
+	 *      serial version.
+	 */
+	void buildOcTree(const std::vector<CC*>& ccs, int batch = 0)
+	{
+		init_builder(ccs);
+		if (batch <= 0)
+			batch = int(ccs.size());
 		VIS::initialize();
 		VIS::rearmTimer();
 		bool check_path = false;
@@ -155,35 +175,40 @@ public:
 				}
 			}
 
-			auto to_split = pop_from_cube_list();
-			auto children = split_cube(to_split);
-			bool direct_node = (path_nodes.find(to_split) != path_nodes.end());
-			for (auto cube : children) {
+			std::vector<Node*> frontier;
+			frontier.emplace_back(pop_from_cube_list());
+			while (int(frontier.size()) < batch && !isCubeListEmpty())
+				frontier.emplace_back(pop_from_cube_list());
+			auto children_list = split_cubes(frontier);
+			for (size_t i = 0; i < frontier.size(); i++) {
+				bool direct_node = (path_nodes.find(frontier[i]) != path_nodes.end());
+				for (auto cube : children_list[i]) {
 #if !PRIORITIZE_SHORTEST_PATH
-				if (cube->getState() == Node::kCubeUncertain) {
-					add_to_cube_list(cube);
-				}
+					if (cube->getState() == Node::kCubeUncertain) {
+						add_to_cube_list(cube);
+					}
 #endif
-				connect_neighbors(cube);
+					connect_neighbors(cube);
 
-				if (direct_node && cube->atState(Node::kCubeFull))
-					add_neighbors_to_list(cube, true);
+					if (direct_node && cube->atState(Node::kCubeFull))
+						add_neighbors_to_list(cube, true);
 
-				if (!cube->atState(Node::kCubeFree)) {
-					// Full cube may have full neighbors.
-					continue;
-				}
+					if (!cube->atState(Node::kCubeFree)) {
+						// Full cube may have full neighbors.
+						continue;
+					}
 #if ENABLE_DFS
-				// From now we assume cube.state == free.
-				if (cube->getSet() == init_cube_->getSet()) {
-					auto firstorder = add_neighbors_to_list(cube);
-					(void)firstorder;
-					// Add second order neighbors.
-					for (auto neighbor : firstorder)
-						add_neighbors_to_list(neighbor);
-					VIS::trackFurestCube(cube, init_cube_);
-				}
+					// From now we assume cube.state == free.
+					if (cube->getSet() == init_cube_->getSet()) {
+						auto firstorder = add_neighbors_to_list(cube);
+						(void)firstorder;
+						// Add second order neighbors.
+						for (auto neighbor : firstorder)
+							add_neighbors_to_list(neighbor);
+						VIS::trackFurestCube(cube, init_cube_);
+					}
 #endif
+				}
 			}
 			if (goal_cube_ && goal_cube_->getSet() == init_cube_->getSet())
 				break;
@@ -370,7 +395,14 @@ public:
 
 	void init_builder(CC& cc)
 	{
-		cc_ = &cc;
+		init_builder(std::vector<CC*>(1, &cc));
+	}
+
+	void init_builder(const std::vector<CC*>& ccs)
+	{
+		if (ccs.empty())
+			throw std::runtime_error("GOctreePathBuilder needs at least one ClearanceCalculator");
+		ccs_ = ccs;
 		current_queue_ = 0;
 		cubes_.clear();
 		root_.reset(Node::makeRoot(mins_, maxs_));
@@ -480,26 +512,46 @@ protected:
 		return ret;
 	}
 
-	void check_clearance(Node* node)
+	struct Clearance {
+		bool stop;
+		bool isfree;
+		double certain_ratio;
+	};
+
+	/*
+	 * Only reads the node, hence can run concurrently with different cc.
+	 */
+	Clearance calculate_clearance(CC* cc, const Node* node) const
 	{
 		auto state = node->getMedian();
-		
-		bool isfree;
-		auto certain = cc_->getCertainCube(state, isfree);
+
+		Clearance ret;
+		auto certain = cc->getCertainCube(state, ret.isfree);
 
 #if 0
-		bool stop = coverage(state, res_, node) ||
-			    coverage(state, certain, node);
+		ret.stop = coverage(state, res_, node) ||
+			   coverage(state, certain, node);
 #else
-		bool stop = coverage(state, certain, node);
+		ret.stop = coverage(state, certain, node);
 #endif
+		ret.certain_ratio = certain(0) / res_(0);
+		return ret;
+	}
+
+	void check_clearance(Node* node)
+	{
+		apply_clearance(node, calculate_clearance(ccs_.front(), node));
+	}
+
+	void apply_clearance(Node* node, const Clearance& clearance)
+	{
 		node->volume = node->getVolume();
 #if PRIORITIZE_CLEARER_CUBE
-		node->certain_ratio = certain(0) / res_(0);
+		node->certain_ratio = clearance.certain_ratio;
 #endif
 		fixed_volume_ += node->getVolume();
-		if (stop) {
-			if (isfree) {
+		if (clearance.stop) {
+			if (clearance.isfree) {
 				node->setState(Node::kCubeFree);
 				if (goal_cube_ == nullptr && node->isContaining(gstate_)) {
 					goal_cube_ = node;
@@ -523,23 +575,47 @@ protected:
 	 */
 	std::vector<Node*> split_cube(Node* node)
 	{
-		bool repeated = node->atState(Node::kCubeMixed);
-		node->setState(Node::kCubeMixed);
-
-		if (!repeated)
-			VIS::visSplit(node);
+		return split_cubes(std::vector<Node*>(1, node)).front();
+	}
 
-		std::vector<Node*> ret;
-		for (unsigned long index = 0; index < (1 << ND); index++) {
-			typename Node::CubeIndex ci(index);
-			ret.emplace_back(node->getCube(ci));
-			check_clearance(ret.back());
+	/*
+	 * Split multiple cubes at once, the clearance of all children are
+	 * calculated by the worker threads.
+	 */
+	std::vector<std::vector<Node*>> split_cubes(const std::vector<Node*>& nodes)
+	{
+		std::vector<std::vector<Node*>> ret;
+		std::vector<Node*> children;
+		for (auto node : nodes) {
+			bool repeated = node->atState(Node::kCubeMixed);
+			node->setState(Node::kCubeMixed);
+
+			if (!repeated)
+				VIS::visSplit(node);
+
+			ret.emplace_back();
+			for (unsigned long index = 0; index < (1 << ND); index++) {
+				typename Node::CubeIndex ci(index);
+				ret.back().emplace_back(node->getCube(ci));
+				children.emplace_back(ret.back().back());
+			}
 		}
-		VIS::withdrawAggAdj(node);
-		node->cancelAggressiveAdjacency();
+
+		std::vector<Clearance> clearances(children.size());
+		int nworkers = int(std::min(ccs_.size(), children.size()));
+#pragma omp parallel for num_threads(nworkers) schedule(dynamic, 1) if (nworkers > 1)
+		for (size_t i = 0; i < children.size(); i++)
+			clearances[i] = calculate_clearance(ccs_[omp_get_thread_num()], children[i]);
+		for (size_t i = 0; i < children.size(); i++)
+			apply_clearance(children[i], clearances[i]);
+
+		for (auto node : nodes) {
+			VIS::withdrawAggAdj(node);
+			node->cancelAggressiveAdjacency();
 #if PRIORITIZE_SHORTEST_PATH
-		max_depth_ = std::max(node->getDepth() + 1, max_depth_);
+			max_depth_ = std::max(node->getDepth() + 1, max_depth_);
 #endif
+		}
 		return ret;
 	}
 
@@ -647,7 +723,7 @@ protected:
 
 	Coord mins_, maxs_, res_;
 	Coord istate_, gstate_;
-	CC *cc_;
+	std::vector<CC*> ccs_;
 	std::unique_ptr<Node> root_;
 	int current_queue_;
 	std::vector<PerDepthQ> cubes_;
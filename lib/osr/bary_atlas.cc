@@ -0,0 +1,182 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "bary_atlas.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <omp.h>
+
+namespace osr {
+
+namespace {
+
+using Vec2 = Eigen::Vector2f;
+
+inline float
+edge(const Vec2& a, const Vec2& b, const Vec2& c)
+{
+	return (b(0) - a(0)) * (c(1) - a(1)) - (b(1) - a(1)) * (c(0) - a(0));
+}
+
+/*
+ * Texels on the shared edge of two triangles must be covered once, otherwise
+ * the weight is added twice. Triangles are counter-clockwise (Y up) here, and
+ * texels on top or left edges are included.
+ */
+inline bool
+is_top_left(const Vec2& a, const Vec2& b)
+{
+	return b(1) < a(1) || (b(1) == a(1) && b(0) < a(0));
+}
+
+}
+
+BaryAtlas::BaryAtlas(const UVMatrix& uv)
+	:uv_(uv)
+{
+}
+
+void
+BaryAtlas::add(const FMatrix& F, const VMatrix& V, float weight)
+{
+	if (V.rows() != F.rows() * 3)
+		throw std::runtime_error(std::string(__func__) + ": V should have 3 rows per face, but got " +
+		                         std::to_string(V.rows()) + " rows for " +
+		                         std::to_string(F.rows()) + " faces");
+	if (F.size() > 0 && (F.minCoeff() < 0 || F.maxCoeff() >= uv_.rows()))
+		throw std::runtime_error(std::string(__func__) + ": F refers to vertices out of the " +
+		                         std::to_string(uv_.rows()) + " UV coordinates");
+	Batch batch;
+	batch.F = F;
+	batch.bary = V.cast<float>();
+	batch.weight = weight;
+	batches_.emplace_back(std::move(batch));
+}
+
+void
+BaryAtlas::clear()
+{
+	batches_.clear();
+	splatted_ = 0;
+	thread_atlases_.clear();
+}
+
+void
+BaryAtlas::splat(const Batch& batch, int f, RMMatrixXf& atlas) const
+{
+	int W = atlas.cols();
+	int H = atlas.rows();
+	Vec2 face_uv[3];
+	for (int i = 0; i < 3; i++)
+		face_uv[i] = uv_.row(batch.F(f, i)).transpose();
+	Vec2 p[3];
+	Eigen::Vector3f bary[3];
+	for (int k = 0; k < 3; k++) {
+		bary[k] = batch.bary.row(3 * f + k).transpose();
+		Vec2 uv = bary[k](0) * face_uv[0] + bary[k](1) * face_uv[1] + bary[k](2) * face_uv[2];
+		p[k] << uv(0) * W, uv(1) * H;
+	}
+	float area = edge(p[0], p[1], p[2]);
+	if (area == 0.0f)
+		return;
+	if (area < 0.0f) {
+		std::swap(p[1], p[2]);
+		std::swap(bary[1], bary[2]);
+		area = -area;
+	}
+	bool top_left[3] = { is_top_left(p[1], p[2]),
+	                     is_top_left(p[2], p[0]),
+	                     is_top_left(p[0], p[1]) };
+	float xmin = std::min({p[0](0), p[1](0), p[2](0)});
+	float xmax = std::max({p[0](0), p[1](0), p[2](0)});
+	float ymin = std::min({p[0](1), p[1](1), p[2](1)});
+	float ymax = std::max({p[0](1), p[1](1), p[2](1)});
+	int xlo = std::max(0, int(std::ceil(xmin - 0.5f)));
+	int xhi = std::min(W - 1, int(std::floor(xmax - 0.5f)));
+	int ylo = std::max(0, int(std::ceil(ymin - 0.5f)));
+	int yhi = std::min(H - 1, int(std::floor(ymax - 0.5f)));
+	for (int y = ylo; y <= yhi; y++) {
+		for (int x = xlo; x <= xhi; x++) {
+			Vec2 c(x + 0.5f, y + 0.5f);
+			float w[3] = { edge(p[1], p[2], c),
+			               edge(p[2], p[0], c),
+			               edge(p[0], p[1], c) };
+			bool inside = true;
+			for (int k = 0; k < 3; k++)
+				inside = inside && (w[k] > 0.0f || (w[k] == 0.0f && top_left[k]));
+			if (!inside)
+				continue;
+			// Same as the discard condition of shader/bary.frag
+			Eigen::Vector3f b = (w[0] * bary[0] + w[1] * bary[1] + w[2] * bary[2]) / area;
+			if (b.minCoeff() < 0.0f || b.maxCoeff() > 1.0f)
+				continue;
+			atlas(y, x) += batch.weight;
+		}
+	}
+}
+
+BaryAtlas::RMMatrixXf
+BaryAtlas::render(const Eigen::Vector2i& res)
+{
+	if (res(0) <= 0 || res(1) <= 0)
+		throw std::runtime_error(std::string(__func__) + ": invalid resolution " +
+		                         std::to_string(res(0)) + " x " + std::to_string(res(1)));
+	int nthreads = omp_get_max_threads();
+	if (res != res_ || int(thread_atlases_.size()) != nthreads) {
+		// Start over, all samples are pending
+		res_ = res;
+		splatted_ = 0;
+		thread_atlases_.assign(nthreads, RMMatrixXf::Zero(res(1), res(0)));
+	}
+
+	// Faces of pending batches, batch b covers [offsets[b], offsets[b+1])
+	std::vector<size_t> offsets(1, 0);
+	for (size_t b = splatted_; b < batches_.size(); b++)
+		offsets.emplace_back(offsets.back() + batches_[b].F.rows());
+	int64_t total = int64_t(offsets.back());
+#pragma omp parallel
+	{
+		RMMatrixXf& atlas = thread_atlases_[omp_get_thread_num()];
+#pragma omp for schedule(dynamic, 256)
+		for (int64_t i = 0; i < total; i++) {
+			size_t b = std::upper_bound(offsets.begin(), offsets.end(), size_t(i)) - offsets.begin() - 1;
+			splat(batches_[splatted_ + b], int(i - offsets[b]), atlas);
+		}
+	}
+	splatted_ = batches_.size();
+
+	RMMatrixXf sum = RMMatrixXf::Zero(res(1), res(0));
+#pragma omp parallel for
+	for (int y = 0; y < res(1); y++)
+		for (const auto& atlas : thread_atlases_)
+			sum.row(y) += atlas.row(y);
+	// Same shape as glReadPixels into RMMatrixXf(res(0), res(1))
+	return Eigen::Map<RMMatrixXf>(sum.data(), res(0), res(1));
+}
+
+void
+BaryAtlas::writeSVG(const std::string& fn, const Eigen::Vector2i& res) const
+{
+	std::ofstream fout(fn);
+	fout << "<svg width=\"" << res(0) << "\" height=\"" << res(1) << "\">\n";
+	for (const auto& batch : batches_) {
+		for (int f = 0; f < batch.F.rows(); f++) {
+			fout << R"xxx(<polygon points=")xxx";
+			for (int k = 0; k < 3; k++) {
+				Vec2 uv = Vec2::Zero();
+				for (int i = 0; i < 3; i++)
+					uv += batch.bary(3 * f + k, i) * uv_.row(batch.F(f, i)).transpose();
+				fout << uv(0) * res(0) << ',' << uv(1) * res(1) << " ";
+			}
+			fout << R"xxx(" style="fill:lime;stroke:purple;stroke-width:1" />)xxx"
+			     << std::endl;
+		}
+	}
+	fout << R"xxx(</svg>)xxx";
+}
+
+}
@@ -0,0 +1,80 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef OSR_BARY_ATLAS_H
+#define OSR_BARY_ATLAS_H
+
+#include "osr_state.h"
+#include <string>
+#include <vector>
+#include <Eigen/Core>
+
+namespace osr {
+
+/*
+ * osr::BaryAtlas
+ *
+ *      CPU version of Renderer::renderBarycentric.
+ *
+ *      A sample is a triangle in one face of the target mesh, given by the
+ *      barycentric coordinates of its corners. The corners are mapped to the
+ *      texture atlas through the UV coordinates of the face, and the weight
+ *      of the sample is added to every texel whose center it covers, like
+ *      the additive blending of the GL version.
+ *
+ *      Samples are kept in case the atlas is requested at another
+ *      resolution, but each render() only splats the samples added since
+ *      the last call. Every OpenMP thread splats to its own atlas, and the
+ *      atlases are summed on demand.
+ */
+class BaryAtlas {
+public:
+	typedef Eigen::Matrix<float, -1, -1, Eigen::RowMajor> RMMatrixXf;
+	using UVMatrix = Eigen::Matrix<float, -1, 2, Eigen::RowMajor>;
+	using FMatrix = Eigen::Matrix<int, -1, 3>;
+	using VMatrix = Eigen::Matrix<StateScalar, -1, 3>;
+
+	/*
+	 * uv: UV coordinates of each vertex of the target mesh
+	 */
+	BaryAtlas(const UVMatrix& uv);
+
+	/*
+	 * Same arguments as Renderer::addBarycentric: row f of F is a face
+	 * of the target mesh, and rows 3f, 3f+1 and 3f+2 of V are the
+	 * barycentric coordinates of the sample in this face.
+	 */
+	void add(const FMatrix& F, const VMatrix& V, float weight = 1.0);
+	void clear();
+
+	/*
+	 * Returns the atlas in the layout of Renderer::renderBarycentric, i.e.
+	 * a res(0) x res(1) matrix whose buffer stores texel (x, y) at
+	 * y * res(0) + x, with y = 0 at V = 0.
+	 */
+	RMMatrixXf render(const Eigen::Vector2i& res);
+
+	void writeSVG(const std::string& fn, const Eigen::Vector2i& res) const;
+private:
+	using BaryMatrix = Eigen::Matrix<float, -1, 3, Eigen::RowMajor>;
+
+	struct Batch {
+		FMatrix F;
+		BaryMatrix bary;
+		float weight;
+	};
+
+	UVMatrix uv_;
+	std::vector<Batch> batches_;
+	size_t splatted_ = 0; // Batches already in thread_atlases_
+	Eigen::Vector2i res_ = Eigen::Vector2i::Zero();
+	std::vector<RMMatrixXf> thread_atlases_; // height x width
+
+	void splat(const Batch& batch, int f, RMMatrixXf& atlas) const;
+};
+
+}
+
+#endif
@@ -5,7 +5,16 @@
  */
 #include "cdmodel.h"
 #include "scene.h"
+#include "flat_bvh.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <iostream>
+#include <mutex>
+#include <stdexcept>
 #include <fcl/fcl.h>
 #include <igl/per_face_normals.h>
 #include <glm/gtx/io.hpp>
@@ -19,8 +28,32 @@ struct CDModel::CDModelData {
 	/*
 	 * Note: this object in practice stores the geometry in the unit form.
 	 *       Hence eig_cache_vertices is also in unit form.
+	 *
+	 * Models loaded from images build this on demand, use fcl() to
+	 * access it.
 	 */
 	Model model;
+	bool fcl_built = false;
+	std::once_flag fcl_once;
+
+	Model& fcl()
+	{
+		std::call_once(fcl_once, [this]() {
+			if (fcl_built)
+				return;
+			std::vector<Vector3> vertices(V.rows());
+			std::vector<fcl::Triangle> triangles(F.rows());
+			for (int i = 0; i < V.rows(); i++)
+				vertices[i] = V.row(i).transpose();
+			for (int i = 0; i < F.rows(); i++)
+				triangles[i].set(F(i, 0), F(i, 1), F(i, 2));
+			model.beginModel();
+			model.addSubModel(vertices, triangles);
+			model.endModel();
+			fcl_built = true;
+		});
+		return model;
+	}
 
 	std::unique_ptr<fcl::Box<Scalar>> bbox;
 	/*
@@ -30,10 +63,47 @@ struct CDModel::CDModelData {
 	 * position.
 	 */
 	Transform uncentrializer;
+	Eigen::Vector3d aabb_center, aabb_size;
+
+	void set_bbox(const Eigen::Vector3d& center, const Eigen::Vector3d& size)
+	{
+		aabb_center = center;
+		aabb_size = size;
+		uncentrializer.setIdentity();
+		uncentrializer.translate(center);
+		bbox = std::make_unique<fcl::Box<Scalar>>(size(0), size(1), size(2));
+	}
 
+	/*
+	 * Owned storage, empty for models loaded from images.
+	 */
 	VMatrix eig_cache_vertices;
 	FMatrix eig_cache_findices; // Face INDICES -> findices
 	VMatrix eig_cache_fnormals;
+	/*
+	 * Views of either the owned storage or the mapped image
+	 */
+	Eigen::Map<const VMatrix> V{nullptr, 0, 3};
+	Eigen::Map<const FMatrix> F{nullptr, 0, 3};
+	Eigen::Map<const VMatrix> N{nullptr, 0, 3};
+
+	void* mapped = nullptr;
+	size_t mapped_size = 0;
+
+	~CDModelData()
+	{
+		flat.reset();
+		if (mapped)
+			munmap(mapped, mapped_size);
+	}
+
+	void map_views(const Scalar* v, int nv, const int* f, const Scalar* n, int nf)
+	{
+		// Eigen::Map can only be re-pointed with placement new
+		new (&V) Eigen::Map<const VMatrix>(v, nv, 3);
+		new (&F) Eigen::Map<const FMatrix>(f, nf, 3);
+		new (&N) Eigen::Map<const VMatrix>(n, nf, 3);
+	}
 
 	void cache_eig_forms()
 	{
@@ -52,13 +122,24 @@ struct CDModel::CDModelData {
 		igl::per_face_normals(eig_cache_vertices,
 		                      eig_cache_findices,
 		                      eig_cache_fnormals);
+		max_radius = NV > 0 ? eig_cache_vertices.rowwise().norm().maxCoeff() : 0.0;
+		map_views(eig_cache_vertices.data(), NV,
+		          eig_cache_findices.data(),
+		          eig_cache_fnormals.data(), NF);
 	}
 
+	double max_radius = 0.0;
+
+	uint32_t backend = BACKEND_FCL;
+	std::unique_ptr<FlatBVH> flat;
+
 	Eigen::Matrix<Scalar, 3, 3> MI_world, MI_center;
+	Eigen::Matrix<Scalar, 3, 1> com;
 	double volume;
 
 	void cache_MI(const Vector3& center)
 	{
+		com = model.computeCOM();
 		MI_world = model.computeMomentofInertia();
 		const auto& C = MI_world;
 		auto com = center;
@@ -88,16 +169,13 @@ CDModel::CDModel(const Scene& scene)
 	model_->model.beginModel();
 	scene.addToCDModel(*this);
 	model_->model.endModel();
+	model_->fcl_built = true;
 	model_->model.computeLocalAABB();
-	using BBOX = fcl::Box<CDModelData::Scalar>;
 	const auto& aabb = model_->model.aabb_local;
-	auto& uncern = model_->uncentrializer;
-	uncern.setIdentity();
-	uncern.translate(aabb.center());
 	std::cerr << "AABB center: " << aabb.center().transpose() << std::endl;
 	std::cerr << "AABB size: " << aabb.width() << ' ' << aabb.height() << ' ' << aabb.depth() << std::endl;
-	model_->bbox = std::make_unique<BBOX>(aabb.width(),
-			aabb.height(), aabb.depth());
+	model_->set_bbox(aabb.center(),
+	                 Eigen::Vector3d(aabb.width(), aabb.height(), aabb.depth()));
 	// SAN CHECK
 	model_->bbox->computeLocalAABB();
 	const auto& scaabb = model_->bbox->aabb_local;
@@ -113,10 +191,50 @@ CDModel::CDModel(const Scene& scene)
 	model_->cache_MI(ecenter);
 }
 
+CDModel::CDModel()
+	:model_(new CDModelData)
+{
+}
+
 CDModel::~CDModel()
 {
 }
 
+const uint32_t CDModel::BACKEND_FCL;
+const uint32_t CDModel::BACKEND_FLAT_BVH;
+
+void
+CDModel::setBackend(uint32_t backend)
+{
+	if (backend != BACKEND_FCL && backend != BACKEND_FLAT_BVH)
+		throw std::runtime_error("CDModel::setBackend: unknown backend " + std::to_string(backend));
+	if (backend == BACKEND_FLAT_BVH && !model_->flat) {
+		model_->flat = std::make_unique<FlatBVH>(model_->V, model_->F);
+		std::cerr << "FlatBVH built with " << model_->flat->numNodes() << " nodes" << std::endl;
+	}
+	model_->backend = backend;
+}
+
+uint32_t
+CDModel::getBackend() const
+{
+	return model_->backend;
+}
+
+namespace {
+
+// Upper bound of face pairs reported by collideForDetails
+constexpr size_t kMaxContactDetails = 1UL << 24;
+
+inline bool
+use_flat(const CDModel& env, const CDModel& rob)
+{
+	return env.getBackend() == CDModel::BACKEND_FLAT_BVH &&
+	       rob.getBackend() == CDModel::BACKEND_FLAT_BVH;
+}
+
+}
+
 void CDModel::addVF(const glm::mat4& m,
 		const std::vector<Vertex>& verts,
 		const std::vector<uint32_t>& indices)
@@ -164,12 +282,14 @@ bool CDModel::collide(const CDModel& env,
                       const CDModel& rob,
                       const Transform& robTf)
 {
+	if (use_flat(env, rob))
+		return FlatBVH::collide(*env.model_->flat, envTf, *rob.model_->flat, robTf);
 	fcl::CollisionRequest<CDModelData::Scalar> req;
 	fcl::CollisionResult<CDModelData::Scalar> res;
 	size_t ret;
 
-	ret = fcl::collide(&env.model_->model, envTf,
-	                   &rob.model_->model, robTf,
+	ret = fcl::collide(&env.model_->fcl(), envTf,
+	                   &rob.model_->fcl(), robTf,
 	                   req, res);
 #if 0
 	std::cerr << "Collide with \n" << t1.matrix() << "\nand\n" << t2.matrix() << "\nreturns: " << ret << std::endl;
@@ -177,11 +297,31 @@ bool CDModel::collide(const CDModel& env,
 	return ret > 0;
 }
 
+uint64_t
+CDModel::collideMany(const CDModel& env,
+                     const Transform& envTf,
+                     const CDModel& rob,
+                     const Transform* robTfs,
+                     int K)
+{
+	if (K > 64)
+		throw std::runtime_error("CDModel::collideMany: at most 64 poses, got " + std::to_string(K));
+	if (use_flat(env, rob))
+		return FlatBVH::collideMany(*env.model_->flat, envTf, *rob.model_->flat, robTfs, K);
+	uint64_t ret = 0;
+	for (int k = 0; k < K; k++)
+		if (collide(env, envTf, rob, robTfs[k]))
+			ret |= uint64_t(1) << k;
+	return ret;
+}
+
 bool CDModel::collideBB(const CDModel& env,
                         const Transform& envTf,
                         const CDModel& rob,
                         const Transform& robTf)
 {
+	if (use_flat(env, rob))
+		return FlatBVH::collideBB(*env.model_->flat, envTf, *rob.model_->flat, robTf);
 	fcl::CollisionRequest<CDModelData::Scalar> req;
 	fcl::CollisionResult<CDModelData::Scalar> res;
 #if 1
@@ -197,6 +337,28 @@ bool CDModel::collideBB(const CDModel& env,
 }
 
 
+double
+CDModel::distance(const CDModel& env,
+                  const Transform& envTf,
+                  const CDModel& rob,
+                  const Transform& robTf,
+                  double threshold)
+{
+	fcl::DistanceRequest<CDModelData::Scalar> req;
+	fcl::DistanceResult<CDModelData::Scalar> res;
+	/*
+	 * FCL's BVH traversal prunes the BV pairs that cannot be closer than
+	 * the current min_distance, so seeding it with the threshold turns
+	 * the query into the early-out "distance < threshold".
+	 */
+	res.min_distance = threshold;
+	double ret = fcl::distance(&env.model_->fcl(), envTf,
+	                           &rob.model_->fcl(), robTf,
+	                           req, res);
+	return std::min(ret, threshold);
+}
+
+
 bool
 CDModel::collideForDetails(const CDModel& env,
                            const Transform& envTf,
@@ -204,17 +366,18 @@ CDModel::collideForDetails(const CDModel& env,
                            const Transform& robTf,
                            Eigen::Matrix<int, -1, 2>& facePairs)
 {
-	fcl::CollisionRequest<CDModelData::Scalar> req(1UL << 24, true);
+	// The limit only caps the result, FCL does not reserve storage for it.
+	fcl::CollisionRequest<CDModelData::Scalar> req(kMaxContactDetails, true);
 	fcl::CollisionResult<CDModelData::Scalar> res;
 	size_t ret;
-	ret = fcl::collide(&env.model_->model, envTf,
-	                   &rob.model_->model, robTf,
+	ret = fcl::collide(&env.model_->fcl(), envTf,
+	                   &rob.model_->fcl(), robTf,
 	                   req, res);
-	std::vector<fcl::Contact<Scalar>> cts;
-	res.getContacts(cts);
-	facePairs.resize(cts.size(), 2);
-	for (size_t i = 0; i < cts.size(); i++) {
-		const auto& ct = cts[i];
+	// Read the contacts in place rather than copying them out
+	const size_t n_contacts = res.numContacts();
+	facePairs.resize(n_contacts, 2);
+	for (size_t i = 0; i < n_contacts; i++) {
+		const auto& ct = res.getContact(i);
 #if 0
 		std::cerr << "CT " << i << " (" << ct.b1 << ", " << ct.b2 << ")"
 		          << " Geo 1 OType: " << ct.o1->getObjectType()
@@ -229,22 +392,22 @@ CDModel::collideForDetails(const CDModel& env,
 }
 
 
-const Eigen::Ref<Eigen::Matrix<CDModel::Scalar, -1, 3>>
+Eigen::Ref<const CDModel::VMatrix>
 CDModel::vertices() const
 {
-	return model_->eig_cache_vertices;
+	return model_->V;
 }
 
-const Eigen::Ref<Eigen::Matrix<int, -1, 3>>
+Eigen::Ref<const CDModel::FMatrix>
 CDModel::faces() const
 {
-	return model_->eig_cache_findices;
+	return model_->F;
 }
 
 CDModel::VMatrix
 CDModel::faceNormals() const
 {
-	return model_->eig_cache_fnormals;
+	return model_->N;
 }
 
 CDModel::VMatrix
@@ -261,7 +424,7 @@ CDModel::faceNormals(const Eigen::Matrix<int, -1, 1>& fi) const
 		ret.row(i) = (V.row(vi(1)) - V.row(vi(0))).cross(V.row(vi(2)) - V.row(vi(0))).normalized();
 	}
 #else
-	const auto& N = model_->eig_cache_fnormals;
+	const auto& N = model_->N;
 	for (size_t i = 0; i < NF; i++)
 		ret.row(i) = N.row(fi(i));
 #endif
@@ -284,7 +447,7 @@ CDModel::inertiaTensorForCenter() const
 Eigen::Matrix<CDModel::Scalar, 3, 1>
 CDModel::centerOfMass() const
 {
-	return model_->model.computeCOM();
+	return model_->com;
 }
 
 double
@@ -293,4 +456,193 @@ CDModel::volume() const
 	return model_->volume;
 }
 
+double
+CDModel::maxRadius() const
+{
+	return model_->max_radius;
+}
+
+namespace {
+
+const char kImageMagic[8] = { 'O', 'S', 'R', 'C', 'D', 'M', '0', '1' };
+
+/*
+ * Layout of CDModel images, all sections are aligned to 64 bytes.
+ *      ImageHeader
+ *      double  vertices[3][n_vertices]         (column major)
+ *      int32_t faces[3][n_faces]               (column major)
+ *      double  fnormals[3][n_faces]            (column major)
+ *      FlatBVH::Node nodes[n_nodes]
+ *      FlatBVH::TriPacket packets[n_packets]
+ */
+struct ImageHeader {
+	char magic[8];
+	uint64_t source_key;
+	uint64_t n_vertices;
+	uint64_t n_faces;
+	uint64_t n_nodes;
+	uint64_t n_packets;
+	uint64_t vertices_off;
+	uint64_t faces_off;
+	uint64_t fnormals_off;
+	uint64_t nodes_off;
+	uint64_t packets_off;
+	uint64_t total_size;
+	double aabb_center[3];
+	double aabb_size[3];
+	double com[3];
+	double MI_world[9];
+	double MI_center[9];
+	double volume;
+	double max_radius;
+	float bvh_scale;
+	uint32_t reserved;
+};
+
+size_t align64(size_t off)
+{
+	return (off + 63) & ~size_t(63);
+}
+
+void layout_image(ImageHeader& h)
+{
+	h.vertices_off = align64(sizeof(ImageHeader));
+	h.faces_off = align64(h.vertices_off + h.n_vertices * 3 * sizeof(double));
+	h.fnormals_off = align64(h.faces_off + h.n_faces * 3 * sizeof(int32_t));
+	h.nodes_off = align64(h.fnormals_off + h.n_faces * 3 * sizeof(double));
+	h.packets_off = align64(h.nodes_off + h.n_nodes * sizeof(FlatBVH::Node));
+	h.total_size = h.packets_off + h.n_packets * sizeof(FlatBVH::TriPacket);
+}
+
+}
+
+void
+CDModel::saveImage(const std::string& fn, uint64_t source_key) const
+{
+	const auto& d = *model_;
+	std::unique_ptr<FlatBVH> tmp_flat;
+	const FlatBVH* flat = d.flat.get();
+	if (!flat) {
+		tmp_flat = std::make_unique<FlatBVH>(d.V, d.F);
+		flat = tmp_flat.get();
+	}
+	ImageHeader h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, kImageMagic, sizeof(kImageMagic));
+	h.source_key = source_key;
+	h.n_vertices = d.V.rows();
+	h.n_faces = d.F.rows();
+	h.n_nodes = flat->numNodes();
+	h.n_packets = flat->numPackets();
+	layout_image(h);
+	for (int i = 0; i < 3; i++) {
+		h.aabb_center[i] = d.aabb_center(i);
+		h.aabb_size[i] = d.aabb_size(i);
+		h.com[i] = d.com(i);
+	}
+	memcpy(h.MI_world, d.MI_world.data(), sizeof(h.MI_world));
+	memcpy(h.MI_center, d.MI_center.data(), sizeof(h.MI_center));
+	h.volume = d.volume;
+	h.max_radius = d.max_radius;
+	h.bvh_scale = flat->scale();
+
+	std::vector<char> buf(h.total_size, 0);
+	memcpy(buf.data(), &h, sizeof(h));
+	memcpy(buf.data() + h.vertices_off, d.V.data(), h.n_vertices * 3 * sizeof(double));
+	memcpy(buf.data() + h.faces_off, d.F.data(), h.n_faces * 3 * sizeof(int32_t));
+	memcpy(buf.data() + h.fnormals_off, d.N.data(), h.n_faces * 3 * sizeof(double));
+	memcpy(buf.data() + h.nodes_off, flat->nodes(), h.n_nodes * sizeof(FlatBVH::Node));
+	memcpy(buf.data() + h.packets_off, flat->packets(), h.n_packets * sizeof(FlatBVH::TriPacket));
+
+	std::string tmp_fn = fn + ".tmp." + std::to_string(getpid());
+	int fd = ::open(tmp_fn.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		throw std::runtime_error("Cannot create " + tmp_fn + ": " + strerror(errno));
+	size_t written = 0;
+	while (written < buf.size()) {
+		ssize_t ret = ::write(fd, buf.data() + written, buf.size() - written);
+		if (ret < 0) {
+			int err = errno;
+			::close(fd);
+			::unlink(tmp_fn.c_str());
+			throw std::runtime_error("Cannot write " + tmp_fn + ": " + strerror(err));
+		}
+		written += ret;
+	}
+	::close(fd);
+	if (::rename(tmp_fn.c_str(), fn.c_str()) < 0) {
+		int err = errno;
+		::unlink(tmp_fn.c_str());
+		throw std::runtime_error("Cannot rename " + tmp_fn + " to " + fn + ": " + strerror(err));
+	}
+	std::cerr << "CDModel image saved to " << fn << ", " << h.total_size << " bytes" << std::endl;
+}
+
+std::shared_ptr<CDModel>
+CDModel::loadImage(const std::string& fn, uint64_t source_key)
+{
+	int fd = ::open(fn.c_str(), O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return nullptr;
+		throw std::runtime_error("Cannot open " + fn + ": " + strerror(errno));
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(ImageHeader)) {
+		::close(fd);
+		std::cerr << fn << " is not a CDModel image, ignored" << std::endl;
+		return nullptr;
+	}
+	void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED)
+		throw std::runtime_error("Cannot mmap " + fn + ": " + strerror(errno));
+	const char* base = static_cast<const char*>(addr);
+	ImageHeader h;
+	memcpy(&h, base, sizeof(h));
+	ImageHeader expected = h;
+	layout_image(expected);
+	if (memcmp(h.magic, kImageMagic, sizeof(kImageMagic)) != 0 ||
+	    h.total_size != size_t(st.st_size) ||
+	    expected.total_size != h.total_size ||
+	    expected.packets_off != h.packets_off) {
+		munmap(addr, st.st_size);
+		std::cerr << fn << " is not a CDModel image, ignored" << std::endl;
+		return nullptr;
+	}
+	if (h.source_key != source_key) {
+		munmap(addr, st.st_size);
+		std::cerr << "CDModel image " << fn << " is stale, ignored" << std::endl;
+		return nullptr;
+	}
+
+	std::shared_ptr<CDModel> ret(new CDModel);
+	auto& d = *ret->model_;
+	d.mapped = addr;
+	d.mapped_size = st.st_size;
+	d.map_views(reinterpret_cast<const Scalar*>(base + h.vertices_off), h.n_vertices,
+	            reinterpret_cast<const int*>(base + h.faces_off),
+	            reinterpret_cast<const Scalar*>(base + h.fnormals_off), h.n_faces);
+	d.set_bbox(Eigen::Vector3d(h.aabb_center[0], h.aabb_center[1], h.aabb_center[2]),
+	           Eigen::Vector3d(h.aabb_size[0], h.aabb_size[1], h.aabb_size[2]));
+	d.com << h.com[0], h.com[1], h.com[2];
+	memcpy(d.MI_world.data(), h.MI_world, sizeof(h.MI_world));
+	memcpy(d.MI_center.data(), h.MI_center, sizeof(h.MI_center));
+	d.volume = h.volume;
+	d.max_radius = h.max_radius;
+	try {
+		d.flat = std::make_unique<FlatBVH>(d.V, d.F,
+		                                   reinterpret_cast<const FlatBVH::Node*>(base + h.nodes_off),
+		                                   h.n_nodes,
+		                                   reinterpret_cast<const FlatBVH::TriPacket*>(base + h.packets_off),
+		                                   h.n_packets,
+		                                   h.bvh_scale);
+	} catch (std::runtime_error& e) {
+		std::cerr << fn << " has an invalid FlatBVH (" << e.what() << "), ignored" << std::endl;
+		return nullptr;
+	}
+	d.backend = BACKEND_FLAT_BVH;
+	return ret;
+}
+
 }
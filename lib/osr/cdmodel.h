@@ -8,7 +8,9 @@
 
 #include "geometry.h"
 #include "osr_state.h"
+#include <limits>
 #include <memory>
+#include <string>
 #include <vector>
 #include <Eigen/Core>
 
@@ -21,12 +23,30 @@ class Scene;
 class CDModel {
 	struct CDModelData;
 	std::unique_ptr<CDModelData> model_;
+
+	CDModel();
 public:
 	using Scalar = StateScalar;
 
+	/*
+	 * Backends of collide and collideBB.
+	 *      BACKEND_FCL: FCL's OBBRSS BVH, in double precision.
+	 *      BACKEND_FLAT_BVH: FlatBVH (see flat_bvh.h), float32 with
+	 *                        double precision fallback. Only used
+	 *                        when both models select it.
+	 */
+	static const uint32_t BACKEND_FCL = 0;
+	static const uint32_t BACKEND_FLAT_BVH = 1;
+
 	CDModel(const Scene& scene);
 	~CDModel();
 
+	/*
+	 * Not thread-safe, the FlatBVH is built on demand.
+	 */
+	void setBackend(uint32_t);
+	uint32_t getBackend() const;
+
 	void addVF(const glm::mat4&,
 	           const std::vector<Vertex>&,
 	           const std::vector<uint32_t>& );
@@ -34,6 +54,17 @@ public:
 			    const Transform& envTf,
 			    const CDModel& rob,
 			    const Transform& robTf);
+	/*
+	 * Collide rob at K (<= 64) poses against env.
+	 * Returns: bit k is set if rob at robTfs[k] collides with env.
+	 *
+	 * With BACKEND_FLAT_BVH the BVH pair is traversed once for all poses.
+	 */
+	static uint64_t collideMany(const CDModel& env,
+	                            const Transform& envTf,
+	                            const CDModel& rob,
+	                            const Transform* robTfs,
+	                            int K);
 	/*
 	 * Collide env vs rob w.r.t. their Bounding Boxes
 	 */
@@ -42,6 +73,20 @@ public:
 			      const CDModel& rob,
 			      const Transform& robTf);
 
+	/*
+	 * Minimal distance between env and rob.
+	 * Non-positive values indicate env and rob are colliding.
+	 *
+	 * BV pairs farther than threshold are pruned, and the return value is
+	 * min(distance, threshold). Hence a return value of threshold only
+	 * means distance >= threshold.
+	 */
+	static double distance(const CDModel& env,
+			       const Transform& envTf,
+			       const CDModel& rob,
+			       const Transform& robTf,
+			       double threshold = std::numeric_limits<double>::infinity());
+
 	static bool collideForDetails(
 	                    const CDModel& env,
 			    const Transform& envTf,
@@ -52,10 +97,15 @@ public:
 	using VMatrix = Eigen::Matrix<Scalar, -1, 3>;
 	using FMatrix = Eigen::Matrix<int, -1, 3>;
 
-	const Eigen::Ref<VMatrix>
+	/*
+	 * Views of the geometry, which may live in a mapped image (see
+	 * loadImage), hence read-only references rather than the mutable
+	 * const Eigen::Ref<VMatrix>/Eigen::Ref<FMatrix> of older versions.
+	 */
+	Eigen::Ref<const VMatrix>
 	vertices() const;
 
-	const Eigen::Ref<FMatrix>
+	Eigen::Ref<const FMatrix>
 	faces() const;
 
 	VMatrix
@@ -75,6 +125,40 @@ public:
 
 	double
 	volume() const;
+
+	/*
+	 * Maximal distance from the origin of the local coordinate system to
+	 * the vertices. Bounds the motion of any point when rotating the model.
+	 */
+	double
+	maxRadius() const;
+
+	/*
+	 * Serialize the model into a position independent image: vertices,
+	 * faces, face normals, FlatBVH, bounding box and inertia.
+	 *
+	 * source_key identifies the source geometry, loadImage rejects images
+	 * with different keys. The image is written to a temporary file and
+	 * renamed, so concurrent writers and readers never see partial images.
+	 */
+	void saveImage(const std::string& fn, uint64_t source_key) const;
+
+	/*
+	 * mmap an image read-only, the memory is shared among processes.
+	 * The returned model uses BACKEND_FLAT_BVH, and builds the FCL BVH
+	 * on demand if other backends or queries are used.
+	 *
+	 * Note: the image does not contain FCL's OBBRSS BVH, so only
+	 * collide() under BACKEND_FLAT_BVH avoids the per-process BVH
+	 * construction. Every process still builds the FCL BVH on its
+	 * first collide() under BACKEND_FCL, or its first distance() or
+	 * collideForDetails() under any backend.
+	 *
+	 * Returns nullptr if the image does not exist or does not match
+	 * source_key.
+	 */
+	static std::shared_ptr<CDModel>
+	loadImage(const std::string& fn, uint64_t source_key);
 };
 
 }
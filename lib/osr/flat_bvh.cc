@@ -0,0 +1,488 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "flat_bvh.h"
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+namespace osr {
+
+constexpr int FlatBVH::kLanes;
+constexpr int FlatBVH::kMaxDepth;
+
+/*
+ * Transformation from the local frame of rob to the local frame of env, in
+ * float32 for node/packet tests and in double for the exact tests.
+ */
+struct FlatBVH::RelTransform {
+	float R[3][3];
+	float AbsR[3][3];
+	float t[3];
+	float margin;
+	Transform tf;
+
+	RelTransform(const FlatBVH& env,
+	             const Transform& envTf,
+	             const FlatBVH& rob,
+	             const Transform& robTf)
+	{
+		tf = envTf.inverse(Eigen::Isometry) * robTf;
+		const auto& M = tf.matrix();
+		for (int i = 0; i < 3; i++) {
+			for (int j = 0; j < 3; j++) {
+				R[i][j] = float(M(i, j));
+				// Epsilon term against the parallel edges,
+				// see RTCD 4.4.1
+				AbsR[i][j] = std::abs(R[i][j]) + 1e-6f;
+			}
+			t[i] = float(M(i, 3));
+		}
+		// Covers the rounding errors of float32
+		margin = 1e-5f * (env.scale_ + rob.scale_);
+	}
+};
+
+namespace {
+
+/*
+ * Separating axis test between a (in env frame) and b (in rob frame)
+ */
+inline bool
+disjoint(const FlatBVH::Node& a,
+         const FlatBVH::Node& b,
+         const FlatBVH::RelTransform& tf)
+{
+	const auto& R = tf.R;
+	const auto& AR = tf.AbsR;
+	const float* ea = a.e;
+	const float* eb = b.e;
+	const float m = tf.margin;
+	float T[3];
+	for (int i = 0; i < 3; i++)
+		T[i] = R[i][0] * b.c[0] + R[i][1] * b.c[1] + R[i][2] * b.c[2] + tf.t[i] - a.c[i];
+	for (int i = 0; i < 3; i++) {
+		float rb = eb[0] * AR[i][0] + eb[1] * AR[i][1] + eb[2] * AR[i][2];
+		if (std::abs(T[i]) > ea[i] + rb + m)
+			return true;
+	}
+	for (int j = 0; j < 3; j++) {
+		float ra = ea[0] * AR[0][j] + ea[1] * AR[1][j] + ea[2] * AR[2][j];
+		float t = T[0] * R[0][j] + T[1] * R[1][j] + T[2] * R[2][j];
+		if (std::abs(t) > ra + eb[j] + m)
+			return true;
+	}
+	for (int i = 0; i < 3; i++) {
+		int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+		for (int j = 0; j < 3; j++) {
+			int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+			float ra = ea[i1] * AR[i2][j] + ea[i2] * AR[i1][j];
+			float rb = eb[j1] * AR[i][j2] + eb[j2] * AR[i][j1];
+			float t = T[i2] * R[i1][j] - T[i1] * R[i2][j];
+			if (std::abs(t) > ra + rb + m)
+				return true;
+		}
+	}
+	return false;
+}
+
+inline float
+halfPerimeter(const FlatBVH::Node& n)
+{
+	return n.e[0] + n.e[1] + n.e[2];
+}
+
+}
+
+FlatBVH::FlatBVH(const Eigen::Ref<const VMatrix>& V,
+                 const Eigen::Ref<const FMatrix>& F)
+	:V_(V.data(), V.rows(), 3), F_(F.data(), F.rows(), 3)
+{
+	int NF = F.rows();
+	if (NF == 0)
+		return;
+	VMatrix centroids(NF, 3);
+	for (int i = 0; i < NF; i++)
+		centroids.row(i) = (V.row(F(i, 0)) + V.row(F(i, 1)) + V.row(F(i, 2))) / 3.0;
+	std::vector<int> order(NF);
+	std::iota(order.begin(), order.end(), 0);
+	node_storage_.reserve(2 * (NF / kLanes + 1));
+	packet_storage_.reserve(NF / kLanes + 1);
+	buildRecursive(order, centroids, 0, NF);
+	nodes_ = node_storage_.data();
+	n_nodes_ = node_storage_.size();
+	packets_ = packet_storage_.data();
+	n_packets_ = packet_storage_.size();
+	const Node& root = nodes_[0];
+	for (int i = 0; i < 3; i++)
+		scale_ = std::max(scale_, std::abs(root.c[i]) + root.e[i]);
+}
+
+FlatBVH::FlatBVH(const Eigen::Ref<const VMatrix>& V,
+                 const Eigen::Ref<const FMatrix>& F,
+                 const Node* nodes,
+                 size_t n_nodes,
+                 const TriPacket* packets,
+                 size_t n_packets,
+                 float scale)
+	:V_(V.data(), V.rows(), 3), F_(F.data(), F.rows(), 3),
+	 nodes_(nodes), n_nodes_(n_nodes),
+	 packets_(packets), n_packets_(n_packets),
+	 scale_(scale)
+{
+	checkTree();
+}
+
+/*
+ * Children always follow their parent, so one pass in storage order finds
+ * the depth of every node.
+ */
+void
+FlatBVH::checkTree() const
+{
+	if (n_nodes_ > size_t(std::numeric_limits<int32_t>::max()))
+		throw std::runtime_error("FlatBVH: too many nodes " + std::to_string(n_nodes_));
+	auto corrupted = [](size_t i) {
+		return std::runtime_error("FlatBVH: node " + std::to_string(i) + " is corrupted");
+	};
+	std::vector<int> depth(n_nodes_, 0);
+	for (size_t i = 0; i < n_nodes_; i++) {
+		const Node& node = nodes_[i];
+		if (node.count > 0) {
+			if (node.count > kLanes || node.first < 0 || size_t(node.first) >= n_packets_)
+				throw corrupted(i);
+			const TriPacket& packet = packets_[node.first];
+			for (int l = 0; l < kLanes; l++)
+				if (packet.id[l] < -1 || packet.id[l] >= F_.rows())
+					throw corrupted(i);
+			continue;
+		}
+		if (node.count < 0 || size_t(node.first) <= i + 1 || size_t(node.first) >= n_nodes_)
+			throw corrupted(i);
+		if (depth[i] >= kMaxDepth)
+			throw std::runtime_error("FlatBVH: tree deeper than " + std::to_string(kMaxDepth));
+		depth[i + 1] = std::max(depth[i + 1], depth[i] + 1);
+		depth[node.first] = std::max(depth[node.first], depth[i] + 1);
+	}
+}
+
+int
+FlatBVH::buildRecursive(std::vector<int>& order,
+                        const VMatrix& centroids,
+                        int begin,
+                        int end)
+{
+	int index = int(node_storage_.size());
+	node_storage_.emplace_back();
+	Eigen::RowVector3d lo, hi;
+	lo.setConstant(std::numeric_limits<double>::max());
+	hi.setConstant(std::numeric_limits<double>::lowest());
+	for (int i = begin; i < end; i++) {
+		for (int k = 0; k < 3; k++) {
+			lo = lo.cwiseMin(V_.row(F_(order[i], k)));
+			hi = hi.cwiseMax(V_.row(F_(order[i], k)));
+		}
+	}
+	{
+		Node& node = node_storage_[index];
+		for (int i = 0; i < 3; i++) {
+			node.c[i] = float(0.5 * (lo(i) + hi(i)));
+			// Round outwards so the box always encloses the triangles
+			double e = 0.5 * (hi(i) - lo(i)) + std::abs(node.c[i] - 0.5 * (lo(i) + hi(i)));
+			node.e[i] = std::nextafter(float(e), std::numeric_limits<float>::max());
+		}
+	}
+	if (end - begin <= kLanes) {
+		node_storage_[index].first = int32_t(packet_storage_.size());
+		node_storage_[index].count = end - begin;
+		packet_storage_.emplace_back();
+		fillPacket(packet_storage_.back(), order, begin, end);
+		return index;
+	}
+	Eigen::RowVector3d clo, chi;
+	clo.setConstant(std::numeric_limits<double>::max());
+	chi.setConstant(std::numeric_limits<double>::lowest());
+	for (int i = begin; i < end; i++) {
+		clo = clo.cwiseMin(centroids.row(order[i]));
+		chi = chi.cwiseMax(centroids.row(order[i]));
+	}
+	int axis;
+	(chi - clo).maxCoeff(&axis);
+	int mid = begin + (end - begin) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+	                 [&centroids, axis](int a, int b) {
+	                        return centroids(a, axis) < centroids(b, axis);
+	                 });
+	buildRecursive(order, centroids, begin, mid);
+	int right = buildRecursive(order, centroids, mid, end);
+	node_storage_[index].first = right;
+	node_storage_[index].count = 0;
+	return index;
+}
+
+void
+FlatBVH::fillPacket(TriPacket& packet,
+                    const std::vector<int>& order,
+                    int begin,
+                    int end) const
+{
+	for (int l = 0; l < kLanes; l++) {
+		int i = begin + l;
+		if (i >= end) {
+			// Padding lanes are separated by their planes
+			for (int v = 0; v < 3; v++)
+				for (int k = 0; k < 3; k++)
+					packet.v[v][k][l] = 0.0f;
+			for (int k = 0; k < 3; k++)
+				packet.n[k][l] = 0.0f;
+			packet.d[l] = 1.0f;
+			packet.id[l] = -1;
+			continue;
+		}
+		int f = order[i];
+		Eigen::Vector3d v[3];
+		for (int k = 0; k < 3; k++)
+			v[k] = V_.row(F_(f, k)).transpose();
+		Eigen::Vector3d n = (v[1] - v[0]).cross(v[2] - v[0]);
+		double len = n.norm();
+		// Degenerated triangles are never separated in float32, and
+		// left to the exact test
+		if (len > 0.0)
+			n /= len;
+		else
+			n.setZero();
+		for (int vi = 0; vi < 3; vi++)
+			for (int k = 0; k < 3; k++)
+				packet.v[vi][k][l] = float(v[vi](k));
+		for (int k = 0; k < 3; k++)
+			packet.n[k][l] = float(n(k));
+		packet.d[l] = float(-n.dot(v[0]));
+		packet.id[l] = f;
+	}
+}
+
+/*
+ * Separating axis test of two triangles in double precision.
+ *
+ * Axes: two normals, nine cross products of the edges, and six in-plane
+ * edge normals that cover the coplanar case. Touching triangles are
+ * considered as colliding.
+ *
+ * Note: tritri::TriTriIntersect is not used here because its absolute
+ *       epsilon on the unnormalized plane distances reports false
+ *       positives for small triangles.
+ */
+bool
+FlatBVH::exactTriTri(const FlatBVH& env,
+                     int fa,
+                     const FlatBVH& rob,
+                     int fb,
+                     const Transform& tf)
+{
+	Eigen::Vector3d v[3], u[3];
+	for (int k = 0; k < 3; k++) {
+		v[k] = env.V_.row(env.F_(fa, k)).transpose();
+		u[k] = tf * rob.V_.row(rob.F_(fb, k)).transpose();
+	}
+	auto separated = [&v, &u](const Eigen::Vector3d& axis) -> bool {
+		double v0 = axis.dot(v[0]), v1 = axis.dot(v[1]), v2 = axis.dot(v[2]);
+		double u0 = axis.dot(u[0]), u1 = axis.dot(u[1]), u2 = axis.dot(u[2]);
+		return std::max({v0, v1, v2}) < std::min({u0, u1, u2}) ||
+		       std::max({u0, u1, u2}) < std::min({v0, v1, v2});
+	};
+	Eigen::Vector3d ev[3], eu[3];
+	for (int k = 0; k < 3; k++) {
+		ev[k] = v[(k + 1) % 3] - v[k];
+		eu[k] = u[(k + 1) % 3] - u[k];
+	}
+	Eigen::Vector3d nv = ev[0].cross(ev[1]);
+	Eigen::Vector3d nu = eu[0].cross(eu[1]);
+	if (separated(nv) || separated(nu))
+		return false;
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			if (separated(ev[i].cross(eu[j])))
+				return false;
+	for (int k = 0; k < 3; k++)
+		if (separated(nv.cross(ev[k])) || separated(nu.cross(eu[k])))
+			return false;
+	return true;
+}
+
+bool
+FlatBVH::leafCollide(const FlatBVH& env,
+                     const Node& a,
+                     const FlatBVH& rob,
+                     const Node& b,
+                     const RelTransform& tf)
+{
+	const TriPacket& pa = env.packets_[a.first];
+	const TriPacket& pb = rob.packets_[b.first];
+	const auto& R = tf.R;
+	const float tol = tf.margin;
+	for (int k = 0; k < b.count; k++) {
+		// Triangle k of rob in env frame
+		float u[3][3];
+		for (int vi = 0; vi < 3; vi++)
+			for (int i = 0; i < 3; i++)
+				u[vi][i] = R[i][0] * pb.v[vi][0][k] +
+				           R[i][1] * pb.v[vi][1][k] +
+				           R[i][2] * pb.v[vi][2][k] + tf.t[i];
+		float un[3];
+		for (int i = 0; i < 3; i++)
+			un[i] = R[i][0] * pb.n[0][k] + R[i][1] * pb.n[1][k] + R[i][2] * pb.n[2][k];
+		float ud = pb.d[k] - (un[0] * tf.t[0] + un[1] * tf.t[1] + un[2] * tf.t[2]);
+
+		int32_t candidate[kLanes];
+#pragma omp simd
+		for (int l = 0; l < kLanes; l++) {
+			float du[3], dv[3];
+			for (int vi = 0; vi < 3; vi++) {
+				du[vi] = pa.n[0][l] * u[vi][0] +
+				         pa.n[1][l] * u[vi][1] +
+				         pa.n[2][l] * u[vi][2] + pa.d[l];
+				dv[vi] = un[0] * pa.v[vi][0][l] +
+				         un[1] * pa.v[vi][1][l] +
+				         un[2] * pa.v[vi][2][l] + ud;
+			}
+			bool sep_u = (du[0] > tol && du[1] > tol && du[2] > tol) ||
+			             (du[0] < -tol && du[1] < -tol && du[2] < -tol);
+			bool sep_v = (dv[0] > tol && dv[1] > tol && dv[2] > tol) ||
+			             (dv[0] < -tol && dv[1] < -tol && dv[2] < -tol);
+			candidate[l] = !(sep_u || sep_v);
+		}
+		for (int l = 0; l < kLanes; l++) {
+			if (!candidate[l] || pa.id[l] < 0)
+				continue;
+			if (exactTriTri(env, pa.id[l], rob, pb.id[k], tf.tf))
+				return true;
+		}
+	}
+	return false;
+}
+
+bool
+FlatBVH::collide(const FlatBVH& env,
+                 const Transform& envTf,
+                 const FlatBVH& rob,
+                 const Transform& robTf)
+{
+	if (env.n_nodes_ == 0 || rob.n_nodes_ == 0)
+		return false;
+	RelTransform tf(env, envTf, rob, robTf);
+	/*
+	 * Each step replaces one pair with two pairs one level deeper, so the
+	 * stack never holds more than depth(env) + depth(rob) + 1 pairs.
+	 */
+	struct {
+		int32_t ia, ib;
+	} stack[2 * kMaxDepth + 1];
+	int top = 0;
+	stack[top++] = { 0, 0 };
+	while (top > 0) {
+		top--;
+		const int32_t ia = stack[top].ia;
+		const int32_t ib = stack[top].ib;
+		const Node& a = env.nodes_[ia];
+		const Node& b = rob.nodes_[ib];
+		if (disjoint(a, b, tf))
+			continue;
+		bool leaf_a = a.count > 0;
+		bool leaf_b = b.count > 0;
+		if (leaf_a && leaf_b) {
+			if (leafCollide(env, a, rob, b, tf))
+				return true;
+			continue;
+		}
+		// Descend into the larger one
+		if (leaf_b || (!leaf_a && halfPerimeter(a) >= halfPerimeter(b))) {
+			stack[top++] = { a.first, ib };
+			stack[top++] = { ia + 1, ib };
+		} else {
+			stack[top++] = { ia, b.first };
+			stack[top++] = { ia, ib + 1 };
+		}
+	}
+	return false;
+}
+
+uint64_t
+FlatBVH::collideMany(const FlatBVH& env,
+                     const Transform& envTf,
+                     const FlatBVH& rob,
+                     const Transform* robTfs,
+                     int K)
+{
+	if (K > 64)
+		throw std::runtime_error("FlatBVH::collideMany: at most 64 poses, got " + std::to_string(K));
+	if (env.n_nodes_ == 0 || rob.n_nodes_ == 0 || K <= 0)
+		return 0;
+	std::vector<RelTransform, Eigen::aligned_allocator<RelTransform>> tfs;
+	tfs.reserve(K);
+	for (int k = 0; k < K; k++)
+		tfs.emplace_back(env, envTf, rob, robTfs[k]);
+	const uint64_t all = K == 64 ? ~uint64_t(0) : (uint64_t(1) << K) - 1;
+	uint64_t colliding = 0;
+	// Bounded the same way as collide()
+	struct {
+		int32_t ia, ib;
+		uint64_t lanes;
+	} stack[2 * kMaxDepth + 1];
+	int top = 0;
+	stack[top++] = { 0, 0, all };
+	while (top > 0 && colliding != all) {
+		top--;
+		const int32_t ia = stack[top].ia;
+		const int32_t ib = stack[top].ib;
+		uint64_t lanes = stack[top].lanes;
+		const Node& a = env.nodes_[ia];
+		const Node& b = rob.nodes_[ib];
+		// Poses already known to collide need no further traversal
+		lanes &= ~colliding;
+		for (uint64_t rest = lanes; rest; rest &= rest - 1) {
+			int k = __builtin_ctzll(rest);
+			if (disjoint(a, b, tfs[k]))
+				lanes &= ~(uint64_t(1) << k);
+		}
+		if (!lanes)
+			continue;
+		bool leaf_a = a.count > 0;
+		bool leaf_b = b.count > 0;
+		if (leaf_a && leaf_b) {
+			for (uint64_t rest = lanes; rest; rest &= rest - 1) {
+				int k = __builtin_ctzll(rest);
+				if (leafCollide(env, a, rob, b, tfs[k]))
+					colliding |= uint64_t(1) << k;
+			}
+			continue;
+		}
+		if (leaf_b || (!leaf_a && halfPerimeter(a) >= halfPerimeter(b))) {
+			stack[top++] = { a.first, ib, lanes };
+			stack[top++] = { ia + 1, ib, lanes };
+		} else {
+			stack[top++] = { ia, b.first, lanes };
+			stack[top++] = { ia, ib + 1, lanes };
+		}
+	}
+	return colliding;
+}
+
+bool
+FlatBVH::collideBB(const FlatBVH& env,
+                   const Transform& envTf,
+                   const FlatBVH& rob,
+                   const Transform& robTf)
+{
+	if (env.n_nodes_ == 0 || rob.n_nodes_ == 0)
+		return false;
+	RelTransform tf(env, envTf, rob, robTf);
+	return !disjoint(env.nodes_[0], rob.nodes_[0], tf);
+}
+
+}
@@ -0,0 +1,142 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef OSR_FLAT_BVH_H
+#define OSR_FLAT_BVH_H
+
+#include "osr_state.h"
+#include <stdint.h>
+#include <vector>
+#include <Eigen/Core>
+
+namespace osr {
+
+/*
+ * Compact BVH for boolean collision queries.
+ *
+ * Nodes are stored in a flat array in depth-first order, the left child of
+ * an internal node immediately follows its parent. Bounding volumes are
+ * float32 AABBs in the local frame of the model, which become OBBs after
+ * transformation, and are tested with the 15-axis separating axis test.
+ *
+ * Each leaf holds one TriPacket of up to kLanes triangles in SoA layout,
+ * so the separating plane tests against one triangle of the other model
+ * are vectorized over the lanes. Triangle pairs that cannot be separated
+ * in float32 are confirmed with a double precision separating axis test.
+ *
+ * FlatBVH does not own the double precision geometry, V and F must outlive
+ * it. Nodes and packets are plain old data, and can also be mapped from a
+ * CDModel image (see CDModel::saveImage) without copying.
+ */
+class FlatBVH {
+public:
+	using VMatrix = Eigen::Matrix<StateScalar, -1, 3>;
+	using FMatrix = Eigen::Matrix<int, -1, 3>;
+
+	static constexpr int kLanes = 8;
+	/*
+	 * Bound of the tree depth, median splits of int indexed faces never
+	 * exceed it. Traversals use fixed-size stacks of 2 * kMaxDepth + 1
+	 * node pairs.
+	 */
+	static constexpr int kMaxDepth = 32;
+
+	struct Node {
+		float c[3];     // center
+		float e[3];     // half extent
+		int32_t first;  // leaf: packet index; internal: right child
+		int32_t count;  // leaf: number of triangles; internal: 0
+	};
+
+	struct TriPacket {
+		float v[3][3][kLanes]; // [vertex][axis][lane]
+		float n[3][kLanes];    // unit normal of the triangle plane
+		float d[kLanes];       // n . x + d = 0 on the plane
+		int32_t id[kLanes];    // face index, -1 for padding lanes
+	};
+
+	struct RelTransform;
+
+	/*
+	 * Build the BVH of (V, F)
+	 */
+	FlatBVH(const Eigen::Ref<const VMatrix>& V,
+	        const Eigen::Ref<const FMatrix>& F);
+	/*
+	 * View of prebuilt nodes and packets, which must outlive the object.
+	 * Throws if the nodes do not form a valid tree within kMaxDepth.
+	 */
+	FlatBVH(const Eigen::Ref<const VMatrix>& V,
+	        const Eigen::Ref<const FMatrix>& F,
+	        const Node* nodes,
+	        size_t n_nodes,
+	        const TriPacket* packets,
+	        size_t n_packets,
+	        float scale);
+
+	static bool collide(const FlatBVH& env,
+	                    const Transform& envTf,
+	                    const FlatBVH& rob,
+	                    const Transform& robTf);
+
+	/*
+	 * Collide rob at K (<= 64) poses against env in one traversal. Node
+	 * pairs are pruned per pose, and a node pair is only visited once
+	 * for all poses that cannot be separated at it.
+	 *
+	 * Returns: bit k is set if rob at robTfs[k] collides with env.
+	 */
+	static uint64_t collideMany(const FlatBVH& env,
+	                            const Transform& envTf,
+	                            const FlatBVH& rob,
+	                            const Transform* robTfs,
+	                            int K);
+
+	static bool collideBB(const FlatBVH& env,
+	                      const Transform& envTf,
+	                      const FlatBVH& rob,
+	                      const Transform& robTf);
+
+	size_t numNodes() const { return n_nodes_; }
+	size_t numPackets() const { return n_packets_; }
+	const Node* nodes() const { return nodes_; }
+	const TriPacket* packets() const { return packets_; }
+	float scale() const { return scale_; }
+private:
+	Eigen::Map<const VMatrix> V_;
+	Eigen::Map<const FMatrix> F_;
+	std::vector<Node> node_storage_;
+	std::vector<TriPacket> packet_storage_;
+	const Node* nodes_ = nullptr;
+	size_t n_nodes_ = 0;
+	const TriPacket* packets_ = nullptr;
+	size_t n_packets_ = 0;
+	float scale_ = 0.0f;
+
+	int buildRecursive(std::vector<int>& order,
+	                   const VMatrix& centroids,
+	                   int begin,
+	                   int end);
+	void fillPacket(TriPacket& packet,
+	                const std::vector<int>& order,
+	                int begin,
+	                int end) const;
+	void checkTree() const;
+
+	static bool leafCollide(const FlatBVH& env,
+	                        const Node& a,
+	                        const FlatBVH& rob,
+	                        const Node& b,
+	                        const RelTransform& tf);
+	static bool exactTriTri(const FlatBVH& env,
+	                        int fa,
+	                        const FlatBVH& rob,
+	                        int fb,
+	                        const Transform& tf);
+};
+
+}
+
+#endif
@@ -6,10 +6,18 @@
 #include "gtgenerator.h"
 #include "osr_state.h"
 #include "unit_world.h"
+#include "se3_knn.h"
 #include <vecio/matio.h>
+#include <vecio/roadmap.h>
 #include <ompl/datastructures/NearestNeighborsGNAT.h>
 #include <fstream>
+#include <algorithm>
 #include <atomic>
+#include <mutex>
+#include <sstream>
+#include <numeric>
+#include <queue>
+#include <omp.h>
 
 namespace osr {
 
@@ -27,11 +35,15 @@ std::istream& operator >> (std::istream& fin, Edge& e)
 	return fin >> e.first >> e.second;
 }
 
+/*
+ * Progress::increase is thread-safe, and reports are printed as whole lines.
+ */
 class Progress {
 private:
 	size_t total_;
 	std::atomic<size_t> counter_;
 	const char* task_;
+	std::mutex print_mutex_;
 public:
 	Progress(const char* task = "Progress", size_t total = 0)
 		:task_(task), total_(total), counter_(0)
@@ -50,15 +62,57 @@ public:
 			show = true;
 		}
 		if (show) {
-			std::cerr << "[" << task_ << "] " << counter;
+			std::ostringstream line;
+			line << "[" << task_ << "] " << counter;
 			if (total_ > 0) {
-				std::cerr << " / " << total_;
+				line << " / " << total_;
 			}
-			std::cerr << std::endl;
+			std::lock_guard<std::mutex> guard(print_mutex_);
+			std::cerr << line.str() << std::endl;
 		}
 	}
 };
 
+namespace {
+
+/*
+ * Run func(order[i]) for all i in parallel with work stealing.
+ *
+ * order is split into one queue per thread in a round-robin manner, so each
+ * queue keeps the order of the input. Threads drain their own queues first,
+ * and then steal from the others. Each queue is consumed from the front by
+ * an atomic counter, hence owners and thieves never take the same item.
+ */
+template<typename Func>
+void parallelForStealing(const std::vector<int>& order, Func func)
+{
+	int nthreads = omp_get_max_threads();
+	size_t N = order.size();
+	std::vector<std::atomic<size_t>> heads(nthreads);
+	for (auto& h : heads)
+		h.store(0);
+	// Queue t holds order[t], order[t + nthreads], ...
+	auto queue_size = [N, nthreads](int t) -> size_t {
+		return (N + nthreads - 1 - t) / nthreads;
+	};
+#pragma omp parallel num_threads(nthreads)
+	{
+		int tid = omp_get_thread_num();
+		for (int k = 0; k < nthreads; k++) {
+			int victim = (tid + k) % nthreads;
+			size_t size = queue_size(victim);
+			while (true) {
+				size_t i = heads[victim].fetch_add(1);
+				if (i >= size)
+					break;
+				func(order[i * nthreads + victim]);
+			}
+		}
+	}
+}
+
+}
+
 struct GTGenerator::KNN {
 	std::vector<std::unique_ptr<Vertex>> V_;
 	std::vector<Edge> E_;
@@ -81,10 +135,20 @@ struct GTGenerator::KNN {
 		nn_.reset();
 	}
 
+	/*
+	 * Compressed sparse row form of the adjacency, used by the Dijkstra
+	 * in initGT/updateGT. Rebuilt on demand after adding vertices or
+	 * edges.
+	 */
+	std::vector<int> csr_offsets_;
+	std::vector<int> csr_adjs_;
+	bool csr_dirty_ = true;
+
 	void add(NNVertex nv)
 	{
 		nv->index = int(V_.size());
 		V_.emplace_back(nv);
+		csr_dirty_ = true;
 	}
 
 	void add(const Edge& e)
@@ -94,6 +158,27 @@ struct GTGenerator::KNN {
 		auto to = e.second;
 		V_[from]->adjs.emplace_back(to);
 		V_[to]->adjs.emplace_back(from);
+		csr_dirty_ = true;
+	}
+
+	void buildCSR()
+	{
+		if (!csr_dirty_)
+			return;
+		int NV = int(V_.size());
+		csr_offsets_.assign(NV + 1, 0);
+		for (const auto& e : E_) {
+			csr_offsets_[e.first + 1]++;
+			csr_offsets_[e.second + 1]++;
+		}
+		std::partial_sum(csr_offsets_.begin(), csr_offsets_.end(), csr_offsets_.begin());
+		csr_adjs_.resize(csr_offsets_[NV]);
+		std::vector<int> tails(csr_offsets_.begin(), csr_offsets_.end() - 1);
+		for (const auto& e : E_) {
+			csr_adjs_[tails[e.first]++] = e.second;
+			csr_adjs_[tails[e.second]++] = e.first;
+		}
+		csr_dirty_ = false;
 	}
 
 	void build()
@@ -141,7 +226,10 @@ GTGenerator::~GTGenerator()
 
 void GTGenerator::loadRoadMapFile(const std::string& fn)
 {
-	loadRoadMap(std::ifstream(fn));
+	if (vecio::RoadMapFile::isRoadMapFile(fn))
+		loadBinaryRoadMap(fn);
+	else
+		loadRoadMap(std::ifstream(fn));
 }
 
 void GTGenerator::saveVerifiedRoadMapFile(const std::string& fn)
@@ -149,6 +237,42 @@ void GTGenerator::saveVerifiedRoadMapFile(const std::string& fn)
 	knn_->dumpTo(std::ofstream(fn));
 }
 
+void GTGenerator::loadBinaryRoadMap(const std::string& fn)
+{
+	vecio::RoadMapFile rm(fn);
+	if (rm.dim() != kStateDimension)
+		throw std::runtime_error(fn + ": roadmap dimension " + std::to_string(rm.dim())
+		                         + " does not match the state dimension");
+	size_t base = knn_->V_.size();
+	auto V = rm.vertices();
+	for (size_t i = 0; i < rm.numVertices(); i++) {
+		auto *nv = new Vertex;
+		nv->state = V.row(i).transpose();
+		knn_->add(nv);
+	}
+	rm.forEachEdge([this, base](int from, int to) {
+		knn_->add(Edge(base + from, base + to));
+	});
+	std::vector<Edge> pending;
+	pending.reserve(rm.numPending());
+	for (size_t i = 0; i < rm.numPending(); i++) {
+		auto e = rm.pending(i);
+		pending.emplace_back(base + e.first, base + e.second);
+	}
+	addPendingEdges(pending);
+}
+
+void GTGenerator::saveVerifiedRoadMapBinaryFile(const std::string& fn)
+{
+	size_t NV = knn_->V_.size();
+	std::vector<double> V(NV * kStateDimension);
+	for (size_t i = 0; i < NV; i++)
+		for (int j = 0; j < kStateDimension; j++)
+			V[i * kStateDimension + j] = knn_->V_[i]->state(j);
+	vecio::RoadMapFile::write(fn, V.data(), NV, kStateDimension,
+	                          knn_->E_, std::vector<Edge>());
+}
+
 void GTGenerator::loadRoadMap(std::istream&& fin)
 {
 	size_t loc = 0;
@@ -184,20 +308,39 @@ void GTGenerator::loadRoadMap(std::istream&& fin)
 		}
 #endif
 	}
+	addPendingEdges(pending);
+}
+
+void GTGenerator::addPendingEdges(const std::vector<Edge>& pending)
+{
 	Eigen::VectorXi pending_passed;
 	pending_passed.setZero(pending.size());
 	Progress evprog("Edge Verification", pending.size());
 
-	{
-		// #pragma omp parallel for
-		for (int i = 0; i < pending_passed.size(); i++) {
-			const auto& e = pending[i];
-			if (verifyEdge(e)) {
-				pending_passed(i) = 1;
-			}
-			evprog.increase();
-		}
+	/*
+	 * The cost of verification grows with the length of edges, which
+	 * varies a lot. Verify the longest edges first to avoid stragglers
+	 * at the end.
+	 */
+	std::vector<float> lengths(pending.size());
+#pragma omp parallel for schedule(static)
+	for (size_t i = 0; i < pending.size(); i++) {
+		const auto& e = pending[i];
+		lengths[i] = distance(uw_.translateToUnitState(knn_->V_[e.first]->state),
+		                      uw_.translateToUnitState(knn_->V_[e.second]->state));
 	}
+	std::vector<int> order(pending.size());
+	std::iota(order.begin(), order.end(), 0);
+	std::sort(order.begin(), order.end(),
+	          [&lengths](int lhs, int rhs) {
+			return lengths[lhs] > lengths[rhs];
+		  });
+
+	parallelForStealing(order, [&](int i) {
+		if (verifyEdge(pending[i]))
+			pending_passed(i) = 1;
+		evprog.increase();
+	});
 
 	for (int i = 0; i < pending_passed.size(); i++) {
 		if (pending_passed(i)) {
@@ -221,72 +364,157 @@ void GTGenerator::initGT()
 {
 	int NV = int(knn_->V_.size());
 	dist_values_ = Eigen::VectorXf::Constant(NV, -1);
-	// std::cerr << dist_values_ << std::endl;
-	Eigen::VectorXi done_marks = Eigen::VectorXi::Constant(NV, 0);
-
 	dist_values_[getGoalStateIndex()] = getGoalStateReward();
-	auto cmp = [this](NNVertex lhs, NNVertex rhs) -> bool
-	{
-		return dist_values_[lhs->index] > dist_values_[rhs->index];
-	};
-	std::priority_queue<NNVertex, std::vector<NNVertex>, decltype(cmp)> Q(cmp);
+	unit_states_.resize(0, Eigen::NoChange);
+	unit_index_.reset();
+	updateUnitStates();
 
-#if 1
-	Progress initprog("FindBoundary", knn_->V_.size());
-	ArrayOfStates unit_states;
-	unit_states.resize(knn_->V_.size(), Eigen::NoChange);
-	{
-// #pragma omp parallel for
-		for (int i = 0; i < unit_states.rows(); i++) {
-			auto nv = knn_->V_[i].get();
-			auto unit_state = uw_.translateToUnitState(nv->state);
-			unit_states.row(i) = unit_state;
-			if (uw_.isDisentangled(unit_state)) {
-				dist_values_(i) = 0.0;
-				nv->next = kGraphNextFlagFinalState;
+	std::vector<int> seeds = findBoundary(0);
+	std::cerr << "Total bounday states: " << seeds.size() << std::endl;
+	propagateGT(seeds);
+}
+
+void GTGenerator::updateGT(const ArrayOfStates& vertices,
+                           const Eigen::Matrix<int, -1, 2>& edges)
+{
+	int old_NV = int(knn_->V_.size());
+	// Validate before touching the graph, so a bad call leaves it intact
+	if (dist_values_.size() != old_NV)
+		throw std::runtime_error("GTGenerator::updateGT: ground truth of "
+		                         + std::to_string(dist_values_.size())
+		                         + " vertices does not cover the "
+		                         + std::to_string(old_NV)
+		                         + " vertices in the graph, call initGT or installGTData first");
+	const int new_NV = old_NV + int(vertices.rows());
+	for (int i = 0; i < edges.rows(); i++) {
+		if (edges(i, 0) < 0 || edges(i, 0) >= new_NV ||
+		    edges(i, 1) < 0 || edges(i, 1) >= new_NV)
+			throw std::runtime_error("GTGenerator::updateGT: invalid edge ("
+			                         + std::to_string(edges(i, 0)) + ", "
+			                         + std::to_string(edges(i, 1)) + ") at row "
+			                         + std::to_string(i) + " with "
+			                         + std::to_string(new_NV) + " vertices");
+	}
+	bool nn_built = knn_->nn_->size() > 0;
+	for (int i = 0; i < vertices.rows(); i++) {
+		auto *nv = new Vertex;
+		nv->state = vertices.row(i);
+		knn_->add(nv);
+		if (nn_built)
+			knn_->nn_->add(nv);
+	}
+	int NV = int(knn_->V_.size());
+	dist_values_.conservativeResize(NV);
+	for (int i = old_NV; i < NV; i++)
+		dist_values_(i) = -1;
+	updateUnitStates();
+
+	std::vector<int> seeds = findBoundary(old_NV);
+	/*
+	 * Edges only shorten the distances, hence the Dijkstra only needs to
+	 * start from the vertices improved by the new edges.
+	 */
+	for (int i = 0; i < edges.rows(); i++) {
+		Edge e(edges(i, 0), edges(i, 1));
+		knn_->add(e);
+		for (int k = 0; k < 2; k++) {
+			int from = k == 0 ? e.first : e.second;
+			int to = k == 0 ? e.second : e.first;
+			if (dist_values_(from) < 0)
+				continue;
+			float cand = dist_values_(from) + edgeWeight(from, to);
+			if (dist_values_(to) < 0 || dist_values_(to) > cand) {
+				dist_values_(to) = cand;
+				knn_->V_[to]->next = from;
+				seeds.emplace_back(to);
 			}
-			initprog.increase();
 		}
 	}
-	for (int i = 0; i < unit_states.rows(); i++)
-		if (dist_values_(i) == 0.0)
-			Q.push(knn_->V_[i].get());
-	std::cerr << "Total bounday states: " << Q.size() << std::endl;
-#else
-	knn_->V_[getGoalStateIndex()]->next = kGraphNextFlagFinalState;
-	Q.push(knn_->V_[getGoalStateIndex()].get());
-#endif
+	propagateGT(seeds);
+}
+
+void GTGenerator::updateUnitStates()
+{
+	int begin = int(unit_states_.rows());
+	int NV = int(knn_->V_.size());
+	if (begin >= NV)
+		return;
+	unit_states_.conservativeResize(NV, Eigen::NoChange);
+#pragma omp parallel for schedule(static)
+	for (int i = begin; i < NV; i++)
+		unit_states_.row(i) = uw_.translateToUnitState(knn_->V_[i]->state);
+}
+
+const SE3KNN& GTGenerator::unitIndex()
+{
+	updateUnitStates();
+	if (!unit_index_ || unit_index_->size() != size_t(unit_states_.rows()))
+		unit_index_.reset(new SE3KNN(unit_states_));
+	return *unit_index_;
+}
+
+std::vector<int> GTGenerator::findBoundary(int begin)
+{
+	int NV = int(knn_->V_.size());
+	Progress initprog("FindBoundary", NV - begin);
+	Eigen::Matrix<uint8_t, -1, 1> is_boundary;
+	is_boundary.setZero(NV);
+	/*
+	 * The cost of isDisentangled varies a lot among the vertices
+	 */
+#pragma omp parallel for schedule(dynamic, 64)
+	for (int i = begin; i < NV; i++) {
+		if (uw_.isDisentangled(unit_states_.row(i)))
+			is_boundary(i) = 1;
+		initprog.increase();
+	}
+	std::vector<int> ret;
+	for (int i = begin; i < NV; i++) {
+		if (!is_boundary(i))
+			continue;
+		dist_values_(i) = 0.0;
+		knn_->V_[i]->next = kGraphNextFlagFinalState;
+		ret.emplace_back(i);
+	}
+	return ret;
+}
+
+float GTGenerator::edgeWeight(int from, int to) const
+{
+	// auto steps = estimateSteps(tip, adj);
+	return distance(unit_states_.row(from), unit_states_.row(to));
+}
+
+void GTGenerator::propagateGT(const std::vector<int>& seeds)
+{
+	knn_->buildCSR();
+	const auto& offsets = knn_->csr_offsets_;
+	const auto& adjs = knn_->csr_adjs_;
+	using Entry = std::pair<float, int>;
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> Q;
+	for (auto seed : seeds)
+		Q.emplace(dist_values_(seed), seed);
 
 	Progress prog("Dijkstra", knn_->V_.size());
 	while (!Q.empty()) {
-		auto tip = Q.top();
+		float tip_value;
+		int tip;
+		std::tie(tip_value, tip) = Q.top();
 		Q.pop();
-		auto index = tip->index;
-		if (done_marks(index))
-			continue;
-		std::cerr << "non-dup tip distance: " << dist_values_(tip->index) << std::endl;
-		done_marks(index) = 1;
+		if (tip_value > dist_values_(tip))
+			continue; // Outdated entry
 		prog.increase();
-		auto tip_value = dist_values_(tip->index);
-		for (auto adj_index : tip->adjs) {
-			auto adj = knn_->V_[adj_index].get();
-			// auto steps = estimateSteps(tip, adj);
-			auto steps = distance(unit_states.row(tip->index),
-					      unit_states.row(adj_index));
-			bool do_update = dist_values_(adj_index) < 0 or
-				         dist_values_(adj_index) > tip_value + steps;
-			if (do_update) {
-				dist_values_(adj_index) = tip_value + steps;
-				adj->next = tip->index;
-				Q.push(adj);
-				std::cerr << tip->index << " -> "
-				          << adj->next << " : "
-					  << dist_values_(adj_index)
-					  << std::endl;
+		for (int k = offsets[tip]; k < offsets[tip + 1]; k++) {
+			int adj = adjs[k];
+			float cand = tip_value + edgeWeight(tip, adj);
+			if (dist_values_(adj) < 0 || dist_values_(adj) > cand) {
+				dist_values_(adj) = cand;
+				knn_->V_[adj]->next = tip;
+				Q.emplace(cand, adj);
 			}
 		}
 	}
-} 
+}
 
 void GTGenerator::installGTData(const ArrayOfStates& vertices,
 	                        const Eigen::Matrix<int, -1, 2>& edges,
@@ -302,6 +530,9 @@ void GTGenerator::installGTData(const ArrayOfStates& vertices,
 		v.next = gt_next[i];
 	}
 	dist_values_ = gt_distance;
+	knn_->csr_dirty_ = true;
+	unit_states_.resize(0, Eigen::NoChange); // Computed on demand by updateGT
+	unit_index_.reset();
 	for (int i = 0; i < edges.rows(); i++) {
 		Edge e(edges(i,0), edges(i,1));
 		knn_->add(e);
@@ -382,15 +613,15 @@ GTGenerator::generateGTPath(const StateVector& init_state,
 	init_vertex.state = init_state;
 	auto s0 = uw_.translateToUnitState(init_state);
 
+	/*
+	 * Neighbors in the unit space, which are already sorted by the
+	 * distance to s0.
+	 */
+	std::vector<std::pair<double, int>> nearest;
+	unitIndex().nearestK(s0, kNearestFromInitState, nearest);
 	std::vector<NNVertex> neighbors;
-	knn_->nn_->nearestK(&init_vertex, kNearestFromInitState, neighbors);
-	std::sort(neighbors.begin(), neighbors.end(),
-		[s0, this](const NNVertex& lhs, const NNVertex& rhs) -> bool {
-			double ldist = distance(uw_.translateToUnitState(lhs->state), s0);
-			double rdist = distance(uw_.translateToUnitState(rhs->state), s0);
-			return ldist < rdist;
-		}
-		 );
+	for (const auto& pair : nearest)
+		neighbors.emplace_back(knn_->V_[pair.second].get());
 
 	std::cerr << "Finding NN from " << init_state.transpose() << std::endl;
 	std::cerr << "  (Checking if Valid) " << uw_.isValid(s0) << std::endl;
@@ -22,6 +22,7 @@ namespace osr {
 
 class UnitWorld;
 class Progress;
+class SE3KNN;
 
 class GTGenerator {
 	struct KNN;
@@ -29,12 +30,27 @@ public:
 	GTGenerator(UnitWorld&);
 	~GTGenerator();
 
+	/*
+	 * Binary roadmaps (see vecio/roadmap.h) are detected automatically.
+	 */
 	void loadRoadMapFile(const std::string&);
 	void loadRoadMap(std::istream&&);
+	void loadBinaryRoadMap(const std::string& fn);
 	void saveVerifiedRoadMapFile(const std::string& fn);
+	void saveVerifiedRoadMapBinaryFile(const std::string& fn);
 	void initKNN(); // Initialize internal KNN structure
 	void initKNNInBatch(); // Initialize internal KNN structure with its std::vector interface
 	void initGT();  // Initialize Ground Truth Distance
+	/*
+	 * Add vertices and edges after initGT or installGTData, and update
+	 * the ground truth distance incrementally.
+	 *
+	 * New vertices are indexed after the existing ones, and edges may
+	 * refer to both. Throws if the ground truth does not cover the
+	 * current graph.
+	 */
+	void updateGT(const ArrayOfStates& vertices,
+	              const Eigen::Matrix<int, -1, 2>& edges);
 
 	void installGTData(const ArrayOfStates& vertices,
 	                   const Eigen::Matrix<int, -1, 2>& edges,
@@ -92,9 +108,29 @@ public:
 	 */
 	double rl_stepping_size;
 private:
+	void addPendingEdges(const std::vector<Edge>& pending);
 	UnitWorld& uw_;
 	std::unique_ptr<KNN> knn_;
 	Eigen::VectorXf dist_values_;
+	ArrayOfStates unit_states_; // Cache of translateToUnitState
+	std::unique_ptr<SE3KNN> unit_index_; // Index over unit_states_
+
+	void updateUnitStates();
+	/*
+	 * Nearest neighbor index over the unit states, rebuilt when vertices
+	 * were added since the last call.
+	 */
+	const SE3KNN& unitIndex();
+	/*
+	 * Find the disentangled vertices among [begin, end), and mark them
+	 * as final states. Returns their indices.
+	 */
+	std::vector<int> findBoundary(int begin);
+	float edgeWeight(int from, int to) const;
+	/*
+	 * Dijkstra from the seeds over the CSR adjacency.
+	 */
+	void propagateGT(const std::vector<int>& seeds);
 
 	bool verifyEdge(const Edge& e) const;
 	int getGoalStateIndex() const;
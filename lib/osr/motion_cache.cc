@@ -0,0 +1,385 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "motion_cache.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+namespace osr {
+
+namespace {
+
+const char kMagic[8] = { 'O', 'S', 'R', 'M', 'C', 'C', '0', '1' };
+constexpr int kMaxProbes = 64;
+constexpr int kMaxReadRetries = 4;
+
+struct DiskHeader {
+	char magic[8];
+	uint64_t n_slots;
+};
+
+uint64_t mix64(uint64_t x)
+{
+	// SplitMix64 finalizer
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+uint64_t combine(uint64_t h, uint64_t v)
+{
+	return mix64(h ^ mix64(v));
+}
+
+/*
+ * Scoped flock(2), which serializes the writers of different processes to
+ * the mmap'ed table. flock does not exclude threads sharing the fd, those
+ * are serialized by MotionCache::disk_mutex_.
+ */
+class FileLock {
+public:
+	FileLock(int fd, int operation)
+		:fd_(fd)
+	{
+		while (::flock(fd_, operation) < 0) {
+			if (errno != EINTR)
+				throw std::runtime_error(std::string("Cannot lock motion cache: ") + strerror(errno));
+		}
+	}
+
+	~FileLock()
+	{
+		::flock(fd_, LOCK_UN);
+	}
+private:
+	int fd_;
+};
+
+/*
+ * Keep the progress (tau, last_free) of value if it has one, otherwise take
+ * it from old. Flags are merged.
+ */
+void merge(MotionCache::Value& value, const MotionCache::Value& old)
+{
+	if (!(value.flags & MotionCache::HAS_PROGRESS) && (old.flags & MotionCache::HAS_PROGRESS)) {
+		value.tau = old.tau;
+		value.last_free = old.last_free;
+	}
+	value.flags |= old.flags;
+}
+
+bool same(const MotionCache::Value& a, const MotionCache::Value& b)
+{
+	if (a.flags != b.flags)
+		return false;
+	if (!(a.flags & MotionCache::HAS_PROGRESS))
+		return true;
+	return a.tau == b.tau && a.last_free == b.last_free;
+}
+
+}
+
+const uint32_t MotionCache::HAS_VALIDITY;
+const uint32_t MotionCache::IS_VALID;
+const uint32_t MotionCache::HAS_PROGRESS;
+
+MotionCache::MotionCache(size_t lru_capacity,
+                         const std::string& fn,
+                         size_t disk_slots,
+                         double quantum)
+	:shard_capacity_((lru_capacity + kLRUShards - 1) / kLRUShards), quantum_(quantum)
+{
+	if (!fn.empty())
+		openDisk(fn, disk_slots);
+}
+
+MotionCache::~MotionCache()
+{
+	if (mapped_) {
+		msync(mapped_, mapped_size_, MS_SYNC);
+		munmap(mapped_, mapped_size_);
+	}
+	if (fd_ >= 0)
+		::close(fd_);
+}
+
+void
+MotionCache::openDisk(const std::string& fn, size_t disk_slots)
+{
+	fd_ = ::open(fn.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd_ < 0)
+		throw std::runtime_error("Cannot open motion cache " + fn + ": " + strerror(errno));
+	size_t n_slots;
+	try {
+		// Another process may be initializing the same file
+		FileLock lock(fd_, LOCK_EX);
+		n_slots = initDisk(fn, disk_slots);
+	} catch (...) {
+		::close(fd_);
+		fd_ = -1;
+		throw;
+	}
+	mapped_size_ = sizeof(DiskHeader) + n_slots * sizeof(Slot);
+	mapped_ = mmap(nullptr, mapped_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if (mapped_ == MAP_FAILED) {
+		mapped_ = nullptr;
+		::close(fd_);
+		fd_ = -1;
+		throw std::runtime_error("Cannot mmap motion cache " + fn + ": " + strerror(errno));
+	}
+	slots_ = reinterpret_cast<Slot*>(static_cast<char*>(mapped_) + sizeof(DiskHeader));
+	slot_mask_ = n_slots - 1;
+	std::cerr << "Motion cache " << fn << " opened with " << n_slots << " slots" << std::endl;
+}
+
+size_t
+MotionCache::initDisk(const std::string& fn, size_t disk_slots)
+{
+	struct stat st;
+	if (fstat(fd_, &st) < 0)
+		throw std::runtime_error("Cannot stat motion cache " + fn + ": " + strerror(errno));
+	size_t n_slots;
+	if (st.st_size > 0) {
+		DiskHeader header;
+		if (::pread(fd_, &header, sizeof(header), 0) != sizeof(header) ||
+		    memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+			throw std::runtime_error(fn + " is not a motion cache file");
+		n_slots = header.n_slots;
+		// slot_mask_ needs a power of two, and the size must not overflow
+		if (n_slots == 0 || (n_slots & (n_slots - 1)) != 0 ||
+		    n_slots > (std::numeric_limits<size_t>::max() - sizeof(DiskHeader)) / sizeof(Slot))
+			throw std::runtime_error("Invalid number of slots " + std::to_string(n_slots) +
+			                         " in motion cache " + fn);
+		if (size_t(st.st_size) != sizeof(DiskHeader) + n_slots * sizeof(Slot))
+			throw std::runtime_error("Size of motion cache " + fn + " does not match its header");
+	} else {
+		n_slots = 1;
+		while (n_slots < disk_slots)
+			n_slots <<= 1;
+		DiskHeader header;
+		memcpy(header.magic, kMagic, sizeof(kMagic));
+		header.n_slots = n_slots;
+		if (ftruncate(fd_, sizeof(DiskHeader) + n_slots * sizeof(Slot)) < 0 ||
+		    ::pwrite(fd_, &header, sizeof(header), 0) != sizeof(header))
+			throw std::runtime_error("Cannot initialize motion cache " + fn + ": " + strerror(errno));
+	}
+	return n_slots;
+}
+
+uint64_t
+MotionCache::hashBytes(const void* data, size_t size, uint64_t seed)
+{
+	const uint8_t* p = static_cast<const uint8_t*>(data);
+	uint64_t h = mix64(seed ^ size);
+	size_t i = 0;
+	for (; i + 8 <= size; i += 8) {
+		uint64_t v;
+		memcpy(&v, p + i, 8);
+		h = combine(h, v);
+	}
+	uint64_t tail = 0;
+	if (i < size)
+		memcpy(&tail, p + i, size - i);
+	return combine(h, tail);
+}
+
+MotionCache::Key
+MotionCache::makeKey(const StateVector& from,
+                     const StateVector& to,
+                     double verify_delta,
+                     uint64_t salt) const
+{
+	Key key;
+	key.hash = mix64(salt);
+	key.tag = mix64(~salt);
+	auto add = [&key](int64_t v) {
+		key.hash = combine(key.hash, uint64_t(v));
+		key.tag = combine(key.tag ^ 0x5bd1e995ULL, uint64_t(v));
+	};
+	for (int i = 0; i < kStateDimension; i++)
+		add(std::llround(from(i) / quantum_));
+	for (int i = 0; i < kStateDimension; i++)
+		add(std::llround(to(i) / quantum_));
+	uint64_t delta_bits;
+	memcpy(&delta_bits, &verify_delta, sizeof(delta_bits));
+	add(int64_t(delta_bits));
+	return key;
+}
+
+/*
+ * Lock-free read of the table. Every slot is a seqlock: writers make seq odd
+ * while changing the slot, and a copy is consistent if seq was even and did
+ * not change during the copy. A slot that keeps changing is taken as a miss.
+ */
+bool
+MotionCache::findOnDisk(const Key& key, Value& value) const
+{
+	for (int i = 0; i < kMaxProbes; i++) {
+		const Slot* slot = &slots_[(key.hash + i) & slot_mask_];
+		Slot copy;
+		bool consistent = false;
+		for (int retry = 0; retry < kMaxReadRetries && !consistent; retry++) {
+			uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+			if (seq & 1)
+				continue;
+			memcpy(&copy, slot, sizeof(copy));
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			consistent = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == seq;
+		}
+		if (!consistent || copy.flags == 0)
+			return false;
+		if (copy.hash == key.hash && copy.tag == key.tag) {
+			value.tau = copy.tau;
+			value.flags = copy.flags;
+			for (int j = 0; j < kStateDimension; j++)
+				value.last_free(j) = copy.last_free[j];
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Needs disk_mutex_ and the flock, hence no slot changes meanwhile.
+ */
+MotionCache::Slot*
+MotionCache::probeForInsert(const Key& key)
+{
+	for (int i = 0; i < kMaxProbes; i++) {
+		Slot* slot = &slots_[(key.hash + i) & slot_mask_];
+		if (slot->flags == 0)
+			return slot;
+		if (slot->hash == key.hash && slot->tag == key.tag)
+			return slot;
+	}
+	return nullptr;
+}
+
+void
+MotionCache::writeSlot(Slot* slot, const Key& key, const Value& value)
+{
+	// seq may be left odd by a writer that crashed
+	uint32_t seq = slot->seq;
+	if (!(seq & 1)) {
+		seq++;
+		__atomic_store_n(&slot->seq, seq, __ATOMIC_RELAXED);
+	}
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	slot->hash = key.hash;
+	slot->tag = key.tag;
+	slot->tau = value.tau;
+	for (int i = 0; i < kStateDimension; i++)
+		slot->last_free[i] = value.last_free(i);
+	slot->flags = value.flags;
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Merge value with the cached entry, which is moved to the front. value is
+ * updated to the merged one.
+ */
+void
+MotionCache::touchLRU(Shard& shard, const Key& key, Value& value)
+{
+	if (shard_capacity_ == 0)
+		return;
+	auto iter = shard.index.find(key);
+	if (iter != shard.index.end()) {
+		merge(value, iter->second->second);
+		shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+		iter->second->second = value;
+		return;
+	}
+	shard.lru.emplace_front(key, value);
+	shard.index[key] = shard.lru.begin();
+	if (shard.lru.size() > shard_capacity_) {
+		shard.index.erase(shard.lru.back().first);
+		shard.lru.pop_back();
+	}
+}
+
+bool
+MotionCache::lookup(const Key& key, Value& value)
+{
+	Shard& shard = shardOf(key);
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto iter = shard.index.find(key);
+		if (iter != shard.index.end()) {
+			value = iter->second->second;
+			shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+			mem_hits_++;
+			return true;
+		}
+	}
+	if (slots_ && findOnDisk(key, value)) {
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			touchLRU(shard, key, value);
+		}
+		disk_hits_++;
+		return true;
+	}
+	misses_++;
+	return false;
+}
+
+void
+MotionCache::insert(const Key& key, const Value& ivalue)
+{
+	Value value = ivalue;
+	Shard& shard = shardOf(key);
+	{
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		touchLRU(shard, key, value);
+	}
+	if (!slots_)
+		return;
+	/*
+	 * Most inserts follow a miss of a motion the other threads or
+	 * processes already stored, skip the locks if the slot would not
+	 * change.
+	 */
+	Value old;
+	if (findOnDisk(key, old)) {
+		Value merged = value;
+		merge(merged, old);
+		if (same(merged, old))
+			return;
+	}
+	std::lock_guard<std::mutex> lock(disk_mutex_);
+	FileLock flock(fd_, LOCK_EX);
+	Slot* slot = probeForInsert(key);
+	if (!slot)
+		return;
+	if (slot->flags != 0) {
+		old.tau = slot->tau;
+		old.flags = slot->flags;
+		for (int i = 0; i < kStateDimension; i++)
+			old.last_free(i) = slot->last_free[i];
+		merge(value, old);
+		if (same(value, old))
+			return;
+	}
+	writeSlot(slot, key, value);
+}
+
+std::tuple<uint64_t, uint64_t, uint64_t>
+MotionCache::getStats() const
+{
+	return std::make_tuple(mem_hits_.load(), disk_hits_.load(), misses_.load());
+}
+
+}
@@ -0,0 +1,130 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef OSR_MOTION_CACHE_H
+#define OSR_MOTION_CACHE_H
+
+#include "osr_state.h"
+#include <stdint.h>
+#include <string>
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <tuple>
+#include <unordered_map>
+
+namespace osr {
+
+/*
+ * Cache of motion check results, keyed by the quantized end points of the
+ * segment, the verification delta, and a salt (geometry hash, motion check
+ * mode, etc.)
+ *
+ * Two tiers:
+ *      1. In-memory LRU with lru_capacity entries;
+ *      2. Optional on-disk open addressing hash table, which is mmap'ed so
+ *         the results survive between runs. The table has a fixed number
+ *         of slots, new entries are dropped when the probing fails.
+ *
+ * All public member functions are thread-safe. The LRU is split into
+ * shards by the key, each with its own mutex, so concurrent motion checks
+ * rarely contend. The on-disk tier is read without locks (every slot is a
+ * seqlock), and only writes to the mapping are serialized, among threads by
+ * a mutex and among processes with flock(2). Hence concurrent runs can
+ * share one file.
+ */
+class MotionCache {
+public:
+	static const uint32_t HAS_VALIDITY = 1 << 0;
+	static const uint32_t IS_VALID = 1 << 1;
+	static const uint32_t HAS_PROGRESS = 1 << 2; // tau and last_free are valid
+
+	struct Key {
+		uint64_t hash;
+		uint64_t tag;
+
+		bool operator==(const Key& other) const
+		{
+			return hash == other.hash && tag == other.tag;
+		}
+	};
+
+	struct Value {
+		double tau = 0.0;
+		uint32_t flags = 0;
+		StateVector last_free;
+	};
+
+	MotionCache(size_t lru_capacity,
+	            const std::string& fn = std::string(),
+	            size_t disk_slots = 0,
+	            double quantum = 1e-9);
+	~MotionCache();
+
+	Key makeKey(const StateVector& from,
+	            const StateVector& to,
+	            double verify_delta,
+	            uint64_t salt) const;
+
+	bool lookup(const Key&, Value&);
+	/*
+	 * Merge the value into the cached entry
+	 */
+	void insert(const Key&, const Value&);
+
+	// Returns: memory hits, disk hits, misses
+	std::tuple<uint64_t, uint64_t, uint64_t> getStats() const;
+
+	static uint64_t hashBytes(const void* data, size_t size, uint64_t seed);
+private:
+	struct KeyHasher {
+		size_t operator()(const Key& k) const { return k.hash; }
+	};
+	struct Slot {
+		uint64_t hash;
+		uint64_t tag;
+		double tau;
+		uint32_t flags;
+		uint32_t seq;  // Odd while the slot is being written
+		double last_free[kStateDimension];
+	};
+	using LRUList = std::list<std::pair<Key, Value>>;
+
+	static const int kLRUShards = 64;
+	struct Shard {
+		std::mutex mutex;
+		LRUList lru;
+		std::unordered_map<Key, LRUList::iterator, KeyHasher> index;
+	};
+
+	Shard shards_[kLRUShards];
+	size_t shard_capacity_;
+
+	double quantum_;
+
+	std::mutex disk_mutex_; // Serializes writers of this process
+	int fd_ = -1;
+	void* mapped_ = nullptr;
+	size_t mapped_size_ = 0;
+	Slot* slots_ = nullptr;
+	uint64_t slot_mask_ = 0;
+
+	std::atomic<uint64_t> mem_hits_{0};
+	std::atomic<uint64_t> disk_hits_{0};
+	std::atomic<uint64_t> misses_{0};
+
+	void openDisk(const std::string& fn, size_t disk_slots);
+	size_t initDisk(const std::string& fn, size_t disk_slots);
+	bool findOnDisk(const Key&, Value&) const;
+	Slot* probeForInsert(const Key&);
+	void writeSlot(Slot*, const Key&, const Value&);
+
+	Shard& shardOf(const Key& key) { return shards_[(key.hash >> 32) % kLRUShards]; }
+	void touchLRU(Shard&, const Key&, Value&);
+};
+
+}
+
+#endif
@@ -0,0 +1,812 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "osr_cpu_render.h"
+#include "bary_atlas.h"
+#include "scene.h"
+#include "mesh.h"
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace osr {
+
+namespace {
+
+using Vec2 = Eigen::Vector2f;
+using Vec3 = Eigen::Vector3f;
+using Vec4 = Eigen::Vector4f;
+using Mat4 = Eigen::Matrix4f;
+
+// Same camera as Renderer::setup_camera
+constexpr float kEyeDist = 2.0f;
+constexpr float kNear = 0.01f;
+constexpr float kFar = 120.0f;
+constexpr float kFovy = 45.0f;
+constexpr float kDegree = float(M_PI / 180.0);
+
+constexpr int kLeafSize = 4;
+constexpr int kTileSize = 8;   // Pixels per side of a tile, the unit of work
+constexpr int kPacketSize = 4; // Rays per side of a packet
+constexpr int kPacketRays = kPacketSize * kPacketSize;
+constexpr int kMaxStack = 64;
+
+Mat4 glm_to_eigen(const glm::mat4& m)
+{
+	Mat4 ret;
+	// GLM uses column major
+	ret << m[0][0], m[1][0], m[2][0], m[3][0],
+	       m[0][1], m[1][1], m[2][1], m[3][1],
+	       m[0][2], m[1][2], m[2][2], m[3][2],
+	       m[0][3], m[1][3], m[2][3], m[3][3];
+	return ret;
+}
+
+Vec3 glm_to_eigen(const glm::vec3& v)
+{
+	return Vec3(v[0], v[1], v[2]);
+}
+
+Mat4 translate_state_to_matrix(const StateVector& state)
+{
+	StateQuat quat(state(3), state(4), state(5), state(6));
+	Mat4 ret = Mat4::Identity();
+	ret.block<3, 3>(0, 0) = quat.toRotationMatrix().cast<float>();
+	ret.block<3, 1>(0, 3) = state.segment<3>(0).cast<float>();
+	return ret;
+}
+
+Eigen::Matrix3f view_rotation(float latitude, float longitude)
+{
+	return (Eigen::AngleAxisf(latitude * kDegree, Vec3::UnitX()) *
+	        Eigen::AngleAxisf(longitude * kDegree, Vec3::UnitY())).toRotationMatrix();
+}
+
+uint8_t to_unorm8(float v)
+{
+	return uint8_t(std::round(std::min(std::max(v, 0.0f), 1.0f) * 255.0f));
+}
+
+}
+
+/*
+ * Triangles of a Scene in its own frame, i.e. before the calibration
+ * transform, in a BVH for ray casting.
+ *
+ * Nodes are stored in depth-first order, the left child of an internal node
+ * immediately follows its parent.
+ */
+class RayCastGeometry {
+public:
+	struct Node {
+		float lo[3];
+		float hi[3];
+		int32_t first;  // leaf: first triangle; internal: right child
+		int32_t count;  // leaf: number of triangles; internal: 0
+		int32_t axis;   // internal: split axis
+	};
+
+	// Edges are precomputed for the Moller-Trumbore test
+	struct Tri {
+		Vec3 v0, e1, e2;
+		int32_t mesh;
+		int32_t face;   // gl_PrimitiveID of this triangle
+	};
+
+	RayCastGeometry(const Scene& scene);
+
+	const Scene* source;
+	bool has_vertex_normal;
+	std::vector<std::shared_ptr<const Mesh>> meshes; // In the order of drawing
+	std::vector<Node> nodes;
+	std::vector<Tri> tris; // In the order of BVH leaves
+private:
+	int build(const std::vector<Tri>& input,
+	          const std::vector<Vec3>& centroids,
+	          std::vector<int>& order,
+	          int begin,
+	          int end);
+};
+
+RayCastGeometry::RayCastGeometry(const Scene& scene)
+	:source(&scene), has_vertex_normal(scene.hasVertexNormal())
+{
+	std::vector<Tri> input;
+	auto visitor = [this, &input](std::shared_ptr<const Mesh> mesh) {
+		int32_t m = int32_t(meshes.size());
+		meshes.emplace_back(mesh);
+		if (mesh->isEmpty())
+			return;
+		const auto& V = mesh->getVertices();
+		const auto& I = mesh->getIndices();
+		for (size_t f = 0; f < I.size() / 3; f++) {
+			Vec3 a = glm_to_eigen(V[I[3 * f + 0]].position);
+			Vec3 b = glm_to_eigen(V[I[3 * f + 1]].position);
+			Vec3 c = glm_to_eigen(V[I[3 * f + 2]].position);
+			Tri tri;
+			tri.v0 = a;
+			tri.e1 = b - a;
+			tri.e2 = c - a;
+			tri.mesh = m;
+			tri.face = int32_t(f);
+			input.emplace_back(tri);
+		}
+	};
+	scene.visitMesh(visitor);
+
+	int N = int(input.size());
+	std::vector<Vec3> centroids(N);
+	std::vector<int> order(N);
+	for (int i = 0; i < N; i++) {
+		centroids[i] = input[i].v0 + (input[i].e1 + input[i].e2) / 3.0f;
+		order[i] = i;
+	}
+	if (N > 0)
+		build(input, centroids, order, 0, N);
+	tris.reserve(N);
+	for (int i = 0; i < N; i++)
+		tris.emplace_back(input[order[i]]);
+}
+
+int
+RayCastGeometry::build(const std::vector<Tri>& input,
+                       const std::vector<Vec3>& centroids,
+                       std::vector<int>& order,
+                       int begin,
+                       int end)
+{
+	int index = int(nodes.size());
+	nodes.emplace_back();
+
+	const float inf = std::numeric_limits<float>::infinity();
+	Vec3 lo = Vec3::Constant(inf);
+	Vec3 hi = Vec3::Constant(-inf);
+	Vec3 clo = Vec3::Constant(inf);
+	Vec3 chi = Vec3::Constant(-inf);
+	for (int i = begin; i < end; i++) {
+		const Tri& tri = input[order[i]];
+		Vec3 b = tri.v0 + tri.e1;
+		Vec3 c = tri.v0 + tri.e2;
+		lo = lo.cwiseMin(tri.v0).cwiseMin(b).cwiseMin(c);
+		hi = hi.cwiseMax(tri.v0).cwiseMax(b).cwiseMax(c);
+		clo = clo.cwiseMin(centroids[order[i]]);
+		chi = chi.cwiseMax(centroids[order[i]]);
+	}
+	Node node;
+	for (int a = 0; a < 3; a++) {
+		node.lo[a] = lo(a);
+		node.hi[a] = hi(a);
+	}
+	node.axis = 0;
+	if (end - begin <= kLeafSize) {
+		node.first = begin;
+		node.count = end - begin;
+		nodes[index] = node;
+		return index;
+	}
+	int axis;
+	(chi - clo).maxCoeff(&axis);
+	int mid = begin + (end - begin) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+	                 [&centroids, axis](int a, int b) {
+	                         return centroids[a](axis) < centroids[b](axis);
+	                 });
+	node.axis = axis;
+	node.count = 0;
+	build(input, centroids, order, begin, mid);
+	node.first = build(input, centroids, order, mid, end);
+	nodes[index] = node;
+	return index;
+}
+
+struct RayCastInstance {
+	const RayCastGeometry* geo;
+	Mat4 model;      // Same as the model matrix of the shaders
+	Mat4 inv_model;
+	bool flat;       // Use the flat surface normal
+	int32_t id;
+};
+
+namespace {
+
+struct RayCamera {
+	Vec3 eye;
+	Vec3 s, u, f; // Side, up and forward of glm::lookAt
+	Mat4 view;
+	float tan_x;
+	float tan_y;
+
+	RayCamera(const Eigen::Matrix3f& rot, int width, int height)
+	{
+		eye = rot * Vec3(0.0f, 0.0f, kEyeDist);
+		Vec3 up = rot * Vec3(0.0f, 1.0f, 0.0f);
+		f = (-eye).normalized();
+		s = f.cross(up).normalized();
+		u = s.cross(f);
+		view = Mat4::Identity();
+		view.block<1, 3>(0, 0) = s.transpose();
+		view.block<1, 3>(1, 0) = u.transpose();
+		view.block<1, 3>(2, 0) = -f.transpose();
+		view(0, 3) = -s.dot(eye);
+		view(1, 3) = -u.dot(eye);
+		view(2, 3) = f.dot(eye);
+		tan_y = std::tan(kFovy * kDegree / 2.0f);
+		tan_x = tan_y * float(width) / float(height);
+	}
+
+	/*
+	 * Direction through the center of pixel (x, y), where y = 0 is the
+	 * bottom row like glReadPixels.
+	 *
+	 * The forward component is 1, hence the ray parameter of a hit is its
+	 * depth in the view space, and [kNear, kFar] is the clipping range.
+	 */
+	Vec3 direction(int x, int y, int width, int height) const
+	{
+		float ndc_x = 2.0f * (x + 0.5f) / width - 1.0f;
+		float ndc_y = 2.0f * (y + 0.5f) / height - 1.0f;
+		return f + (ndc_x * tan_x) * s + (ndc_y * tan_y) * u;
+	}
+};
+
+struct Hit {
+	int32_t inst = -1; // -1 for background
+	int32_t mesh = -1;
+	int32_t face = -1;
+	float b1 = 0.0f;   // Barycentric coordinates of the second and third vertices
+	float b2 = 0.0f;
+};
+
+struct RayPacket {
+	int n;
+	int px[kPacketRays];
+	int py[kPacketRays];
+	// In the world frame
+	Vec3 eye;
+	Vec3 dir[kPacketRays];
+	// Rays in the frame of the instance being traced. The model matrix is
+	// affine, so the ray parameter is preserved.
+	Vec3 o;
+	Vec3 d[kPacketRays];
+	Vec3 inv_d[kPacketRays];
+	// Nearest hits so far
+	float t[kPacketRays];
+	int32_t inst[kPacketRays];
+	int32_t tri[kPacketRays];
+	float b1[kPacketRays];
+	float b2[kPacketRays];
+};
+
+bool
+packet_hits_box(const RayCastGeometry::Node& node, const RayPacket& p)
+{
+	for (int k = 0; k < p.n; k++) {
+		float tnear = kNear;
+		float tfar = p.t[k];
+		for (int a = 0; a < 3; a++) {
+			float t0 = (node.lo[a] - p.o(a)) * p.inv_d[k](a);
+			float t1 = (node.hi[a] - p.o(a)) * p.inv_d[k](a);
+			tnear = std::max(tnear, std::min(t0, t1));
+			tfar = std::min(tfar, std::max(t0, t1));
+		}
+		if (tnear <= tfar)
+			return true;
+	}
+	return false;
+}
+
+void
+intersect_leaf(const RayCastGeometry& geo,
+               const RayCastGeometry::Node& node,
+               int32_t inst,
+               RayPacket& p)
+{
+	for (int i = node.first; i < node.first + node.count; i++) {
+		const auto& tri = geo.tris[i];
+		// Shared by all rays since they start from the eye
+		Vec3 s = p.o - tri.v0;
+		Vec3 q = s.cross(tri.e1);
+		float e2q = tri.e2.dot(q);
+		for (int k = 0; k < p.n; k++) {
+			Vec3 pv = p.d[k].cross(tri.e2);
+			float det = tri.e1.dot(pv);
+			if (det == 0.0f)
+				continue;
+			float inv_det = 1.0f / det;
+			float u = s.dot(pv) * inv_det;
+			if (u < 0.0f || u > 1.0f)
+				continue;
+			float v = p.d[k].dot(q) * inv_det;
+			if (v < 0.0f || u + v > 1.0f)
+				continue;
+			float t = e2q * inv_det;
+			// Strictly less, like GL_LESS
+			if (t < kNear || t >= p.t[k])
+				continue;
+			p.t[k] = t;
+			p.inst[k] = inst;
+			p.tri[k] = i;
+			p.b1[k] = u;
+			p.b2[k] = v;
+		}
+	}
+}
+
+void
+trace(const RayCastInstance& inst, RayPacket& p)
+{
+	const RayCastGeometry& geo = *inst.geo;
+	if (geo.nodes.empty())
+		return;
+	p.o = (inst.inv_model * p.eye.homogeneous()).head<3>();
+	for (int k = 0; k < p.n; k++) {
+		p.d[k] = inst.inv_model.block<3, 3>(0, 0) * p.dir[k];
+		p.inv_d[k] = p.d[k].cwiseInverse();
+	}
+	int stack[kMaxStack];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		int index = stack[--top];
+		const auto& node = geo.nodes[index];
+		if (!packet_hits_box(node, p))
+			continue;
+		if (node.count > 0) {
+			intersect_leaf(geo, node, inst.id, p);
+			continue;
+		}
+		// Visit the nearer child first, judged by the first ray
+		if (p.d[0](node.axis) < 0.0f) {
+			stack[top++] = index + 1;
+			stack[top++] = node.first;
+		} else {
+			stack[top++] = node.first;
+			stack[top++] = index + 1;
+		}
+	}
+}
+
+/*
+ * Visit the nearest hit of each pixel in the tile at (x0, y0).
+ *
+ * uv_hits replaces ray casting if not empty.
+ */
+template<typename Visitor>
+void
+cast_tile(const RayCamera& cam,
+          const std::vector<RayCastInstance>& instances,
+          const std::vector<Hit>& uv_hits,
+          int x0, int y0,
+          int width, int height,
+          Visitor visitor)
+{
+	int x1 = std::min(x0 + kTileSize, width);
+	int y1 = std::min(y0 + kTileSize, height);
+	if (!uv_hits.empty()) {
+		for (int y = y0; y < y1; y++)
+			for (int x = x0; x < x1; x++)
+				visitor(x, y, uv_hits[size_t(y) * width + x]);
+		return;
+	}
+	RayPacket p;
+	p.eye = cam.eye;
+	for (int py = y0; py < y1; py += kPacketSize) {
+		for (int px = x0; px < x1; px += kPacketSize) {
+			p.n = 0;
+			for (int y = py; y < std::min(py + kPacketSize, y1); y++) {
+				for (int x = px; x < std::min(px + kPacketSize, x1); x++) {
+					int k = p.n++;
+					p.px[k] = x;
+					p.py[k] = y;
+					p.dir[k] = cam.direction(x, y, width, height);
+					p.t[k] = kFar;
+					p.inst[k] = -1;
+				}
+			}
+			for (const auto& inst : instances)
+				trace(inst, p);
+			for (int k = 0; k < p.n; k++) {
+				Hit hit;
+				if (p.inst[k] >= 0) {
+					const auto& tri = instances[p.inst[k]].geo->tris[p.tri[k]];
+					hit.inst = p.inst[k];
+					hit.mesh = tri.mesh;
+					hit.face = tri.face;
+					hit.b1 = p.b1[k];
+					hit.b2 = p.b2[k];
+				}
+				visitor(p.px[k], p.py[k], hit);
+			}
+		}
+	}
+}
+
+/*
+ * UV_MAPPINNG_RENDERING draws every triangle at its UV coordinates with the
+ * same depth, hence a pixel belongs to the first drawn triangle that covers
+ * it. Threads take bands of rows and draw all triangles in order.
+ */
+std::vector<Hit>
+rasterize_uv(const std::vector<RayCastInstance>& instances, int width, int height)
+{
+	std::vector<Hit> hits(size_t(width) * height);
+	auto edge = [](const Vec2& a, const Vec2& b, const Vec2& c) -> float {
+		return (b(0) - a(0)) * (c(1) - a(1)) - (b(1) - a(1)) * (c(0) - a(0));
+	};
+	int nbands = (height + kTileSize - 1) / kTileSize;
+#pragma omp parallel for schedule(dynamic, 1)
+	for (int band = 0; band < nbands; band++) {
+		int y0 = band * kTileSize;
+		int y1 = std::min(y0 + kTileSize, height);
+		for (const auto& inst : instances) {
+			const auto& meshes = inst.geo->meshes;
+			for (size_t m = 0; m < meshes.size(); m++) {
+				const auto& mesh = meshes[m];
+				if (mesh->isEmpty() || !mesh->hasUV())
+					continue;
+				const auto& I = mesh->getIndices();
+				const auto& uv = mesh->getUV();
+				for (size_t f = 0; f < I.size() / 3; f++) {
+					Vec2 v[3];
+					for (int i = 0; i < 3; i++)
+						v[i] << uv(I[3 * f + i], 0) * width, uv(I[3 * f + i], 1) * height;
+					float area = edge(v[0], v[1], v[2]);
+					if (area == 0.0f)
+						continue;
+					float ymin = std::min({v[0](1), v[1](1), v[2](1)});
+					float ymax = std::max({v[0](1), v[1](1), v[2](1)});
+					float xmin = std::min({v[0](0), v[1](0), v[2](0)});
+					float xmax = std::max({v[0](0), v[1](0), v[2](0)});
+					int ylo = std::max(y0, int(std::ceil(ymin - 0.5f)));
+					int yhi = std::min(y1 - 1, int(std::floor(ymax - 0.5f)));
+					int xlo = std::max(0, int(std::ceil(xmin - 0.5f)));
+					int xhi = std::min(width - 1, int(std::floor(xmax - 0.5f)));
+					for (int y = ylo; y <= yhi; y++) {
+						for (int x = xlo; x <= xhi; x++) {
+							Hit& hit = hits[size_t(y) * width + x];
+							if (hit.inst >= 0)
+								continue;
+							Vec2 c(x + 0.5f, y + 0.5f);
+							float w0 = edge(v[1], v[2], c) / area;
+							float w1 = edge(v[2], v[0], c) / area;
+							float w2 = edge(v[0], v[1], c) / area;
+							if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+								continue;
+							hit.inst = inst.id;
+							hit.mesh = int32_t(m);
+							hit.face = int32_t(f);
+							hit.b1 = w1;
+							hit.b2 = w2;
+						}
+					}
+				}
+			}
+		}
+	}
+	return hits;
+}
+
+struct Fragment {
+	float depth;
+	Vec3 color;
+	Vec2 uv;
+	Vec3 normal;
+};
+
+/*
+ * Outputs of shader/rgb.frag at the hit, with the varyings of
+ * shader/default.vert and shader/default.geom interpolated by the
+ * barycentric coordinates.
+ */
+Fragment
+shade(const RayCastInstance& inst,
+      const Hit& hit,
+      const RayCamera& cam,
+      bool is_rendering_uv_mapping,
+      bool phong,
+      const Vec3& light_position)
+{
+	const Mesh& mesh = *inst.geo->meshes[hit.mesh];
+	const auto& V = mesh.getVertices();
+	const auto& I = mesh.getIndices();
+	const float b[3] = { 1.0f - hit.b1 - hit.b2, hit.b1, hit.b2 };
+	Vec3 world[3];
+	Vec3 position = Vec3::Zero();
+	Vec3 color = Vec3::Zero();
+	Vec3 normal = Vec3::Zero();
+	float depth = 0.0f;
+	Fragment frag;
+	frag.uv = Vec2::Zero();
+	for (int i = 0; i < 3; i++) {
+		uint32_t vi = I[3 * hit.face + i];
+		if (mesh.hasUV())
+			frag.uv += b[i] * mesh.getUV().row(vi).transpose();
+		if (is_rendering_uv_mapping) {
+			world[i] << mesh.getUV()(vi, 0), mesh.getUV()(vi, 1), 0.0f;
+		} else {
+			world[i] = (inst.model * glm_to_eigen(V[vi].position).homogeneous()).head<3>();
+			depth += b[i] * (world[i] - cam.eye).norm();
+			color += b[i] * glm_to_eigen(V[vi].color);
+			normal += b[i] * (inst.model.block<3, 3>(0, 0) * glm_to_eigen(V[vi].normal));
+		}
+		position += b[i] * world[i];
+	}
+	Vec4 vert_normal;
+	if (inst.flat) {
+		Vec3 u = (world[1] - world[0]).normalized();
+		Vec3 v = (world[2] - world[0]).normalized();
+		vert_normal << u.cross(v).normalized(), 0.0f;
+	} else if (is_rendering_uv_mapping) {
+		vert_normal << 0.0f, 0.0f, -1.0f, 1.0f;
+	} else {
+		vert_normal << normal, 0.0f;
+	}
+	if (is_rendering_uv_mapping) {
+		frag.depth = 1.0f;
+		frag.color = Vec3::Ones();
+	} else {
+		frag.depth = depth;
+		frag.color = color;
+		if (phong) {
+			Vec3 light_dir = light_position - position;
+			float c = light_dir.dot(vert_normal.head<3>().normalized());
+			c = std::min(std::max(c, 0.0f), 1.0f);
+			frag.color = (c * 0.6f + 0.4f) * color;
+		}
+	}
+	frag.normal = (cam.view * vert_normal).head<3>().normalized();
+	return frag;
+}
+
+}
+
+const uint32_t CpuRenderer::NO_SCENE_RENDERING;
+const uint32_t CpuRenderer::NO_ROBOT_RENDERING;
+const uint32_t CpuRenderer::HAS_NTR_RENDERING;
+const uint32_t CpuRenderer::UV_MAPPINNG_RENDERING;
+const uint32_t CpuRenderer::NORMAL_RENDERING;
+const uint32_t CpuRenderer::UV_FEEDBACK;
+
+const uint32_t CpuRenderer::BARY_RENDERING_ROBOT;
+const uint32_t CpuRenderer::BARY_RENDERING_SCENE;
+
+CpuRenderer::CpuRenderer()
+{
+	camera_rot_.setIdentity();
+	final_scaling_ << 1.0, 1.0, 1.0;
+}
+
+CpuRenderer::~CpuRenderer()
+{
+}
+
+void CpuRenderer::setupFrom(const CpuRenderer* other)
+{
+	UnitWorld::copyFrom(other);
+	scene_geo_ = other->scene_geo_;
+	robot_geo_ = other->robot_geo_;
+}
+
+void CpuRenderer::loadModelFromFile(const std::string& fn)
+{
+	UnitWorld::loadModelFromFile(fn);
+	scene_geo_.reset();
+	bary_[BARY_RENDERING_SCENE].reset();
+}
+
+void CpuRenderer::loadRobotFromFile(const std::string& fn)
+{
+	UnitWorld::loadRobotFromFile(fn);
+	robot_geo_.reset();
+	bary_[BARY_RENDERING_ROBOT].reset();
+}
+
+void CpuRenderer::angleCamera(float latitude, float longitude)
+{
+	camera_rot_ = view_rotation(latitude, longitude);
+}
+
+void CpuRenderer::ensureGeometry()
+{
+	if (scene_ && (!scene_geo_ || scene_geo_->source != scene_.get()))
+		scene_geo_ = std::make_shared<RayCastGeometry>(*scene_);
+	if (robot_ && (!robot_geo_ || robot_geo_->source != robot_.get()))
+		robot_geo_ = std::make_shared<RayCastGeometry>(*robot_);
+}
+
+/*
+ * Scene and robot in the order of Renderer::render_rgbd. The depth only
+ * rendering of Renderer does not apply the perturbation.
+ */
+std::vector<RayCastInstance>
+CpuRenderer::setupInstances(uint32_t flags, bool perturbed) const
+{
+	Mat4 final_scaling = Mat4::Identity();
+	final_scaling.block<3, 3>(0, 0) = final_scaling_.cast<float>().asDiagonal();
+	std::vector<RayCastInstance> ret;
+	auto add = [&ret, &final_scaling, this](const RayCastGeometry* geo,
+	                                        const Mat4& m,
+	                                        const Scene& scene) {
+		RayCastInstance inst;
+		inst.geo = geo;
+		inst.model = final_scaling * m * glm_to_eigen(scene.getCalibrationTransform());
+		inst.inv_model = inst.model.inverse();
+		inst.flat = geo->has_vertex_normal ? flat_surface : true;
+		inst.id = int32_t(ret.size());
+		ret.emplace_back(inst);
+	};
+	if (!(flags & NO_SCENE_RENDERING) && scene_) {
+		Mat4 m = perturbed ? translate_state_to_matrix(perturbate_) : Mat4::Identity();
+		add(scene_geo_.get(), m, *scene_);
+	}
+	if (!(flags & NO_ROBOT_RENDERING) && robot_)
+		add(robot_geo_.get(), translate_state_to_matrix(robot_state_), *robot_);
+	return ret;
+}
+
+CpuRenderer::RMMatrixXf
+CpuRenderer::renderDepth(const std::vector<Eigen::Matrix3f>& rots)
+{
+	ensureGeometry();
+	int W = pbufferWidth;
+	int H = pbufferHeight;
+	int NV = int(rots.size());
+	RMMatrixXf mvpixels = RMMatrixXf::Constant(NV, W * H, default_depth);
+	auto instances = setupInstances(0, false);
+	std::vector<Hit> no_uv_hits;
+	int tiles_x = (W + kTileSize - 1) / kTileSize;
+	int ntiles = tiles_x * ((H + kTileSize - 1) / kTileSize);
+#pragma omp parallel for schedule(dynamic, 4)
+	for (int work = 0; work < NV * ntiles; work++) {
+		int view = work / ntiles;
+		int tile = work % ntiles;
+		RayCamera cam(rots[view], W, H);
+		auto visitor = [&](int x, int y, const Hit& hit) {
+			if (hit.inst < 0)
+				return;
+			const auto& inst = instances[hit.inst];
+			Fragment frag = shade(inst, hit, cam, false, false, light_position);
+			mvpixels(view, y * W + x) = frag.depth;
+		};
+		cast_tile(cam, instances, no_uv_hits,
+		          (tile % tiles_x) * kTileSize, (tile / tiles_x) * kTileSize,
+		          W, H, visitor);
+	}
+	return mvpixels;
+}
+
+Eigen::VectorXf CpuRenderer::render_depth_to_buffer()
+{
+	return renderDepth({camera_rot_}).row(0).transpose();
+}
+
+CpuRenderer::RMMatrixXf CpuRenderer::render_mvdepth_to_buffer()
+{
+	std::vector<Eigen::Matrix3f> rots;
+	for (int i = 0; i < views.rows(); i++)
+		rots.emplace_back(view_rotation(views(i, 0), views(i, 1)));
+	return renderDepth(rots);
+}
+
+void CpuRenderer::render_mvrgbd(uint32_t flags)
+{
+	bool enable_uv_feedback = !!(flags & UV_FEEDBACK);
+	bool is_rendering_uv_mapping = !!(flags & UV_MAPPINNG_RENDERING);
+	bool is_rendering_normal = !!(flags & NORMAL_RENDERING);
+	// AVI is disabled when rendering UV
+	bool phong = avi && !is_rendering_uv_mapping;
+
+	ensureGeometry();
+	int W = pbufferWidth;
+	int H = pbufferHeight;
+	int NV = views.rows();
+	// Clear values of Renderer::render_rgbd
+	if (enable_uv_feedback || is_rendering_uv_mapping)
+		mvuv = RMMatrixXf::Constant(NV, W * H * 2, -1.0f);
+	else
+		mvuv.resize(0, 0);
+	if (is_rendering_uv_mapping)
+		mvpid = RMMatrixXi::Constant(NV, W * H, -1);
+	if (is_rendering_normal)
+		mvnormal = RMMatrixXf::Zero(NV, W * H * 3);
+	mvrgb = RMMatrixXb::Zero(NV, W * H * 3);
+	mvdepth = RMMatrixXf::Zero(NV, W * H);
+
+	auto instances = setupInstances(flags, true);
+	// Identical for all views
+	std::vector<Hit> uv_hits;
+	if (is_rendering_uv_mapping)
+		uv_hits = rasterize_uv(instances, W, H);
+
+	int tiles_x = (W + kTileSize - 1) / kTileSize;
+	int ntiles = tiles_x * ((H + kTileSize - 1) / kTileSize);
+#pragma omp parallel for schedule(dynamic, 4)
+	for (int work = 0; work < NV * ntiles; work++) {
+		int view = work / ntiles;
+		int tile = work % ntiles;
+		RayCamera cam(view_rotation(views(view, 0), views(view, 1)), W, H);
+		auto visitor = [&](int x, int y, const Hit& hit) {
+			if (hit.inst < 0)
+				return;
+			const auto& inst = instances[hit.inst];
+			Fragment frag = shade(inst, hit, cam, is_rendering_uv_mapping,
+			                      phong, light_position);
+			int pixel = y * W + x;
+			mvdepth(view, pixel) = frag.depth;
+			for (int c = 0; c < 3; c++)
+				mvrgb(view, pixel * 3 + c) = to_unorm8(frag.color(c));
+			if (enable_uv_feedback || is_rendering_uv_mapping) {
+				mvuv(view, pixel * 2 + 0) = frag.uv(0);
+				mvuv(view, pixel * 2 + 1) = frag.uv(1);
+			}
+			if (is_rendering_uv_mapping)
+				mvpid(view, pixel) = hit.face;
+			if (is_rendering_normal) {
+				for (int c = 0; c < 3; c++)
+					mvnormal(view, pixel * 3 + c) = frag.normal(c);
+			}
+		};
+		cast_tile(cam, instances, uv_hits,
+		          (tile % tiles_x) * kTileSize, (tile / tiles_x) * kTileSize,
+		          W, H, visitor);
+	}
+}
+
+BaryAtlas&
+CpuRenderer::getBaryAtlas(uint32_t target)
+{
+	std::shared_ptr<Scene> target_scene;
+	if (target == BARY_RENDERING_ROBOT)
+		target_scene = robot_;
+	else if (target == BARY_RENDERING_SCENE)
+		target_scene = scene_;
+	else
+		throw std::runtime_error(std::string(__func__) + ": unknow target " + std::to_string(target));
+	if (!target_scene || !target_scene->hasUV())
+		throw std::runtime_error(std::string(__func__) + ": target mesh has no UV coordinates");
+	if (!bary_[target])
+		bary_[target].reset(new BaryAtlas(target_scene->getUniqueMesh()->getUV()));
+	return *bary_[target];
+}
+
+void
+CpuRenderer::addBarycentric(const UnitWorld::FMatrix& F,
+                            const UnitWorld::VMatrix& V,
+                            uint32_t target,
+                            float weight)
+{
+	getBaryAtlas(target).add(F, V, weight);
+}
+
+void
+CpuRenderer::clearBarycentric(uint32_t target)
+{
+	getBaryAtlas(target).clear();
+}
+
+CpuRenderer::RMMatrixXf
+CpuRenderer::renderBarycentric(uint32_t target,
+                               Eigen::Vector2i res,
+                               const std::string& svg_fn)
+{
+	auto& atlas = getBaryAtlas(target);
+	if (!svg_fn.empty())
+		atlas.writeSVG(svg_fn, res);
+	return atlas.render(res);
+}
+
+void CpuRenderer::setFinalScaling(const ScaleVector& scale)
+{
+	final_scaling_ = scale;
+}
+
+ScaleVector CpuRenderer::getFinalScaling() const
+{
+	return final_scaling_;
+}
+
+}
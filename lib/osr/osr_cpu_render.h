@@ -0,0 +1,126 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef OSR_CPU_RENDER_H
+#define OSR_CPU_RENDER_H
+
+#include "osr_state.h"
+#include "unit_world.h"
+#include <string>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+#include <Eigen/Core>
+
+namespace osr {
+
+class RayCastGeometry;
+struct RayCastInstance;
+class BaryAtlas;
+
+/*
+ * osr::CpuRenderer
+ *
+ *      Renders the multi-view buffers of osr::Renderer by ray casting, so no
+ *      OpenGL context is needed.
+ *
+ *      The camera, the model matrices and the per-pixel outputs follow the
+ *      shaders of Renderer. Each loaded model keeps a BVH of its triangles in
+ *      its own frame, hence robot states, perturbation and views only
+ *      transform the rays. Rays of square packets traverse the BVH together,
+ *      and the tiles of all views are distributed to OpenMP threads.
+ *
+ *      Barycentric rendering is done by BaryAtlas. HAS_NTR_RENDERING
+ *      (texture) is not supported, use Renderer for it.
+ */
+class CpuRenderer : public UnitWorld {
+public:
+	// Same flags as Renderer
+	static const uint32_t NO_SCENE_RENDERING = (1 << 0);
+	static const uint32_t NO_ROBOT_RENDERING = (1 << 1);
+	static const uint32_t HAS_NTR_RENDERING = (1 << 2);
+	static const uint32_t UV_MAPPINNG_RENDERING = (1 << 3);
+	static const uint32_t NORMAL_RENDERING = (1 << 4);
+	static const uint32_t UV_FEEDBACK = (1 << 5);
+
+	typedef Eigen::Matrix<float, -1, -1, Eigen::RowMajor> RMMatrixXf;
+	typedef Eigen::Matrix<uint8_t, -1, -1, Eigen::RowMajor> RMMatrixXb;
+	typedef Eigen::Matrix<int32_t, -1, -1, Eigen::RowMajor> RMMatrixXi;
+
+	CpuRenderer();
+	~CpuRenderer();
+
+	void setupFrom(const CpuRenderer*);
+	void loadModelFromFile(const std::string& fn) override;
+	void loadRobotFromFile(const std::string& fn) override;
+	void angleCamera(float latitude, float longitude);
+
+	Eigen::VectorXf render_depth_to_buffer();
+	RMMatrixXf render_mvdepth_to_buffer();
+	void render_mvrgbd(uint32_t flags = 0);
+
+	RMMatrixXb mvrgb;
+	RMMatrixXf mvdepth;
+	RMMatrixXf mvuv;
+	RMMatrixXi mvpid;
+	RMMatrixXf mvnormal;
+
+	int pbufferWidth = 224;
+	int pbufferHeight = 224;
+	float default_depth = 5.0f;
+	bool avi = false; // AdVanced Illumination
+	bool flat_surface = false; // Calculate normal
+	Eigen::Vector3f light_position = {0.0f, 5.0f, 0.0f};
+
+	/*
+	 * Views to render, same protocol as Renderer::views
+	 *      Row K: View K
+	 *        Column 0: latitude;
+	 *        Column 1: longitude
+	 */
+	Eigen::MatrixXf views;
+
+	static const uint32_t BARY_RENDERING_ROBOT = 0;
+	static const uint32_t BARY_RENDERING_SCENE = 1;
+
+	/*
+	 * Same as Renderer::addBarycentric and the following functions.
+	 * renderBarycentric only splats the samples added since its last call.
+	 */
+	void addBarycentric(const UnitWorld::FMatrix& F,
+	                    const UnitWorld::VMatrix& V,
+	                    uint32_t target,
+	                    float weight = 1.0);
+
+	void clearBarycentric(uint32_t target);
+
+	RMMatrixXf
+	renderBarycentric(uint32_t target,
+	                  Eigen::Vector2i res,
+	                  const std::string& svg_fn = std::string());
+
+	void setFinalScaling(const ScaleVector& scale);
+	ScaleVector getFinalScaling() const;
+private:
+	std::shared_ptr<const RayCastGeometry> scene_geo_;
+	std::shared_ptr<const RayCastGeometry> robot_geo_;
+
+	/*
+	 * Rotation of Renderer::camera_rot_. Its translation never moves the
+	 * eye, which is transformed as a vector.
+	 */
+	Eigen::Matrix3f camera_rot_;
+	StateTrans final_scaling_;
+	std::unique_ptr<BaryAtlas> bary_[2];
+
+	void ensureGeometry();
+	BaryAtlas& getBaryAtlas(uint32_t target);
+	std::vector<RayCastInstance> setupInstances(uint32_t flags, bool perturbed) const;
+	RMMatrixXf renderDepth(const std::vector<Eigen::Matrix3f>& rots);
+};
+
+}
+
+#endif
@@ -24,6 +24,54 @@ osr::Transform translate_state_to_transform(const StateVector& state)
 	return tf;
 }
 
+ArrayOfTransforms
+translate_states_to_transforms(const ArrayOfStates& qs)
+{
+	using Array = Eigen::Array<StateScalar, -1, 1>;
+	const auto N = qs.rows();
+	/*
+	 * ArrayOfStates is column major, hence qs.col(k) is already a SoA
+	 * buffer.
+	 *
+	 * The formula follows Eigen's QuaternionBase::toRotationMatrix so the
+	 * results are identical to translate_state_to_transform.
+	 */
+	Array w = qs.col(3).array();
+	Array x = qs.col(4).array();
+	Array y = qs.col(5).array();
+	Array z = qs.col(6).array();
+	Array tx = 2 * x, ty = 2 * y, tz = 2 * z;
+	Array twx = tx * w, twy = ty * w, twz = tz * w;
+	Array txx = tx * x, txy = ty * x, txz = tz * x;
+	Array tyy = ty * y, tyz = tz * y, tzz = tz * z;
+
+	ArrayOfTransforms ret;
+	ret.resize(N, Eigen::NoChange);
+	ret.col(0) = 1 - (tyy + tzz);
+	ret.col(1) = txy + twz;
+	ret.col(2) = txz - twy;
+	ret.col(3) = txy - twz;
+	ret.col(4) = 1 - (txx + tzz);
+	ret.col(5) = tyz + twx;
+	ret.col(6) = txz + twy;
+	ret.col(7) = tyz - twx;
+	ret.col(8) = 1 - (txx + tyy);
+	ret.col(9) = qs.col(0);
+	ret.col(10) = qs.col(1);
+	ret.col(11) = qs.col(2);
+	return ret;
+}
+
+osr::Transform
+extract_transform(const ArrayOfTransforms& tfs, int i)
+{
+	osr::Transform tf;
+	StateScalar* data = tf.matrix().data();
+	for (int k = 0; k < 12; k++)
+		data[k] = tfs(i, k);
+	return tf;
+}
+
 StateVector
 interpolate(const StateVector& pkey,
             const StateVector& nkey,
@@ -48,11 +96,14 @@ path_metrics(const ArrayOfStates& qs)
 {
 	Eigen::VectorXd metrics;
 	metrics.resize(qs.rows(), 1);
+	if (qs.rows() == 0)
+		return metrics;
+	const auto N = qs.rows();
+	Eigen::VectorXd steps = batch_distance(qs.topRows(N - 1), qs.bottomRows(N - 1));
 	double dist = 0.0;
-	for (size_t i = 0; i < qs.rows(); i++) {
-		if (i > 0) {
-			dist += distance(qs.row(i-1), qs.row(i));
-		}
+	metrics(0) = dist;
+	for (int i = 1; i < N; i++) {
+		dist += steps(i - 1);
 		metrics(i) = dist;
 	}
 	return metrics;
@@ -156,13 +207,7 @@ double distance(const StateVector& lhv, const StateVector& rhv)
 Eigen::VectorXd
 multi_distance(const StateVector& origin, const ArrayOfStates& targets)
 {
-	Eigen::VectorXd ret;
-	const auto N = targets.rows();
-	ret.resize(N);
-	for (int i = 0; i < N; i++) {
-		ret(i) = distance(origin, targets.row(i));
-	}
-	return ret;
+	return batch_distance(origin.transpose().replicate(targets.rows(), 1), targets);
 }
 
 Eigen::Matrix3d
@@ -172,6 +217,179 @@ extract_rotation_matrix(const StateVector& state)
 	return rot.toRotationMatrix();
 }
 
+namespace {
+
+using Array = Eigen::Array<StateScalar, -1, 1>;
+
+/*
+ * Rotation angle of lhs * rhs^{-1}, following
+ * QuaternionBase::angularDistance. Both sides must be normalized.
+ */
+Array
+angular_distance(const Array& lw, const Array& lx, const Array& ly, const Array& lz,
+                 const Array& rw, const Array& rx, const Array& ry, const Array& rz)
+{
+	// d = lhs * conj(rhs)
+	Array dw = lw * rw + lx * rx + ly * ry + lz * rz;
+	Array dx = -lw * rx + rw * lx - (ly * rz - lz * ry);
+	Array dy = -lw * ry + rw * ly - (lz * rx - lx * rz);
+	Array dz = -lw * rz + rw * lz - (lx * ry - ly * rx);
+	Array vnorm = (dx.square() + dy.square() + dz.square()).sqrt();
+	return 2 * vnorm.binaryExpr(dw.abs(),
+			[](StateScalar y, StateScalar x) { return std::atan2(y, x); });
+}
+
+void
+normalize_columns(Array& w, Array& x, Array& y, Array& z)
+{
+	Array inv = (w.square() + x.square() + y.square() + z.square()).rsqrt();
+	w *= inv;
+	x *= inv;
+	y *= inv;
+	z *= inv;
+}
+
+}
+
+std::tuple<ArrayOfTrans, ArrayOfQuats>
+batch_decompose(const ArrayOfStates& qs)
+{
+	ArrayOfTrans trans = qs.leftCols<3>();
+	Array w = qs.col(3).array();
+	Array x = qs.col(4).array();
+	Array y = qs.col(5).array();
+	Array z = qs.col(6).array();
+	normalize_columns(w, x, y, z);
+	ArrayOfQuats rots(qs.rows(), 4);
+	rots.col(0) = w;
+	rots.col(1) = x;
+	rots.col(2) = y;
+	rots.col(3) = z;
+	return std::make_tuple(trans, rots);
+}
+
+ArrayOfStates
+batch_compose(const ArrayOfTrans& trans, const ArrayOfQuats& rots)
+{
+	if (trans.rows() != rots.rows())
+		throw std::runtime_error("batch_compose: trans and rots have different number of rows");
+	Array w = rots.col(0).array();
+	Array x = rots.col(1).array();
+	Array y = rots.col(2).array();
+	Array z = rots.col(3).array();
+	normalize_columns(w, x, y, z);
+	ArrayOfStates ret(trans.rows(), kStateDimension);
+	ret.leftCols<3>() = trans;
+	ret.col(3) = w;
+	ret.col(4) = x;
+	ret.col(5) = y;
+	ret.col(6) = z;
+	return ret;
+}
+
+ArrayOfQuats
+batch_quat_multiply(const StateQuat& lhs, const ArrayOfQuats& rots)
+{
+	auto w = rots.col(0).array();
+	auto x = rots.col(1).array();
+	auto y = rots.col(2).array();
+	auto z = rots.col(3).array();
+	ArrayOfQuats ret(rots.rows(), 4);
+	ret.col(0) = lhs.w() * w - lhs.x() * x - lhs.y() * y - lhs.z() * z;
+	ret.col(1) = lhs.w() * x + lhs.x() * w + lhs.y() * z - lhs.z() * y;
+	ret.col(2) = lhs.w() * y + lhs.y() * w + lhs.z() * x - lhs.x() * z;
+	ret.col(3) = lhs.w() * z + lhs.z() * w + lhs.x() * y - lhs.y() * x;
+	return ret;
+}
+
+ArrayOfTrans
+batch_rotate(const ArrayOfQuats& rots, const StateTrans& v)
+{
+	// Same as QuaternionBase::_transformVector
+	auto w = rots.col(0).array();
+	auto x = rots.col(1).array();
+	auto y = rots.col(2).array();
+	auto z = rots.col(3).array();
+	// t = 2 * (q.vec() x v)
+	Array tx = 2 * (y * v(2) - z * v(1));
+	Array ty = 2 * (z * v(0) - x * v(2));
+	Array tz = 2 * (x * v(1) - y * v(0));
+	// v + w * t + q.vec() x t
+	ArrayOfTrans ret(rots.rows(), 3);
+	ret.col(0) = v(0) + w * tx + (y * tz - z * ty);
+	ret.col(1) = v(1) + w * ty + (z * tx - x * tz);
+	ret.col(2) = v(2) + w * tz + (x * ty - y * tx);
+	return ret;
+}
+
+Eigen::VectorXd
+batch_distance(const ArrayOfStates& lhs, const ArrayOfStates& rhs)
+{
+	if (lhs.rows() != rhs.rows())
+		throw std::runtime_error("batch_distance: lhs and rhs have different number of rows");
+	Array trdist = (lhs.leftCols<3>() - rhs.leftCols<3>()).rowwise().norm().array();
+	Array lw = lhs.col(3).array();
+	Array lx = lhs.col(4).array();
+	Array ly = lhs.col(5).array();
+	Array lz = lhs.col(6).array();
+	Array rw = rhs.col(3).array();
+	Array rx = rhs.col(4).array();
+	Array ry = rhs.col(5).array();
+	Array rz = rhs.col(6).array();
+	normalize_columns(lw, lx, ly, lz);
+	normalize_columns(rw, rx, ry, rz);
+	return (trdist + angular_distance(lw, lx, ly, lz, rw, rx, ry, rz)).matrix();
+}
+
+ArrayOfStates
+batch_interpolate(const ArrayOfStates& from,
+                  const ArrayOfStates& to,
+                  const Eigen::VectorXd& taus)
+{
+	if (from.rows() != to.rows() || from.rows() != taus.rows())
+		throw std::runtime_error("batch_interpolate: inputs have different number of rows");
+	const auto N = from.rows();
+	auto tau = taus.array();
+	ArrayOfStates ret(N, kStateDimension);
+	for (int k = 0; k < 3; k++)
+		ret.col(k) = from.col(k).array() * (1 - tau) + to.col(k).array() * tau;
+	Array fw = from.col(3).array();
+	Array fx = from.col(4).array();
+	Array fy = from.col(5).array();
+	Array fz = from.col(6).array();
+	Array tw = to.col(3).array();
+	Array tx = to.col(4).array();
+	Array ty = to.col(5).array();
+	Array tz = to.col(6).array();
+	normalize_columns(fw, fx, fy, fz);
+	normalize_columns(tw, tx, ty, tz);
+	/*
+	 * Vectorized QuaternionBase::slerp, including its fallback to lerp
+	 * for nearly identical rotations.
+	 */
+	const StateScalar one = StateScalar(1) - Eigen::NumTraits<StateScalar>::epsilon();
+	Array d = fw * tw + fx * tx + fy * ty + fz * tz;
+	Array absd = d.abs();
+	Array theta = absd.min(one).acos();
+	Array sin_theta = theta.sin();
+	Array scale0 = (absd >= one).select(1 - tau, ((1 - tau) * theta).sin() / sin_theta);
+	Array scale1 = (absd >= one).select(tau, (tau * theta).sin() / sin_theta);
+	scale1 = (d < 0).select(-scale1, scale1);
+	ret.col(3) = scale0 * fw + scale1 * tw;
+	ret.col(4) = scale0 * fx + scale1 * tx;
+	ret.col(5) = scale0 * fy + scale1 * ty;
+	ret.col(6) = scale0 * fz + scale1 * tz;
+	return ret;
+}
+
+ArrayOfStates
+batch_interpolate(const ArrayOfStates& from,
+                  const ArrayOfStates& to,
+                  StateScalar tau)
+{
+	return batch_interpolate(from, to, Eigen::VectorXd::Constant(from.rows(), tau));
+}
+
 std::tuple<StateTrans, AngleAxisVector, StateVector>
 differential(const StateVector& from, const StateVector& to)
 {
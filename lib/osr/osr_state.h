@@ -26,6 +26,13 @@ typedef Eigen::Matrix<double, kStateDimension, 1> StateVector; // Column vector
 typedef Eigen::Matrix<double, kActionDimension, 1> ScaleVector;
 typedef Eigen::Vector3d AngleAxisVector;
 typedef Eigen::Matrix<double, -1, kStateDimension> ArrayOfStates; // State per-ROW
+/*
+ * Row major states/points, the layout of C-contiguous numpy arrays. pybind11
+ * binds these Refs to numpy buffers without copying.
+ */
+typedef Eigen::Matrix<double, -1, kStateDimension, Eigen::RowMajor> RowMajorArrayOfStates;
+typedef Eigen::Ref<const RowMajorArrayOfStates> StatesRef;
+typedef Eigen::Ref<const Eigen::Matrix<double, -1, -1, Eigen::RowMajor>> PointsRef;
 typedef Eigen::Matrix<StateScalar, -1, kActionDimension> ArrayOfPoints;
 typedef Eigen::Matrix<double, -1, 3> ArrayOfTrans;
 typedef Eigen::Matrix<double, -1, 3> ArrayOfAA;
@@ -34,6 +41,17 @@ using Transform = Eigen::Transform<double, 3, Eigen::AffineCompact>;
 
 osr::Transform translate_state_to_transform(const StateVector& state);
 
+/*
+ * Batched translate_state_to_transform.
+ *
+ * Row i stores the 3x4 (AffineCompact) matrix of qs.row(i) in column-major
+ * order. Every column is contiguous so the whole batch is calculated in one
+ * vectorized pass. Use extract_transform to get the Transform object back.
+ */
+typedef Eigen::Matrix<StateScalar, -1, 12> ArrayOfTransforms;
+ArrayOfTransforms translate_states_to_transforms(const ArrayOfStates& qs);
+osr::Transform extract_transform(const ArrayOfTransforms& tfs, int i);
+
 /*
  * Interpolate between two SE3 states
  */
@@ -53,6 +71,47 @@ double distance(const StateVector& lhv, const StateVector& rhv);
 Eigen::VectorXd multi_distance(const StateVector& origin, const ArrayOfStates& targets);
 Eigen::Matrix3d extract_rotation_matrix(const StateVector&);
 
+/*
+ * Batched kernels over ArrayOfStates.
+ *
+ * Like translate_states_to_transforms, these functions work on the columns
+ * of ArrayOfStates, which are contiguous, so every step is a vectorized
+ * pass over all rows instead of a StateQuat per row.
+ *
+ * ArrayOfQuats stores one W-first quaternion per row.
+ */
+typedef Eigen::Matrix<StateScalar, -1, 4> ArrayOfQuats;
+
+/*
+ * Split the states into translations and normalized quaternions.
+ */
+std::tuple<ArrayOfTrans, ArrayOfQuats> batch_decompose(const ArrayOfStates& qs);
+/*
+ * Inverse of batch_decompose, the quaternions are normalized.
+ */
+ArrayOfStates batch_compose(const ArrayOfTrans& trans, const ArrayOfQuats& rots);
+/*
+ * lhs * rots.row(i) for all i.
+ */
+ArrayOfQuats batch_quat_multiply(const StateQuat& lhs, const ArrayOfQuats& rots);
+/*
+ * Rotate v by each of the unit quaternions in rots.
+ */
+ArrayOfTrans batch_rotate(const ArrayOfQuats& rots, const StateTrans& v);
+/*
+ * distance(lhs.row(i), rhs.row(i)) for all i.
+ */
+Eigen::VectorXd batch_distance(const ArrayOfStates& lhs, const ArrayOfStates& rhs);
+/*
+ * interpolate(from.row(i), to.row(i), taus(i)) for all i.
+ */
+ArrayOfStates batch_interpolate(const ArrayOfStates& from,
+                                const ArrayOfStates& to,
+                                const Eigen::VectorXd& taus);
+ArrayOfStates batch_interpolate(const ArrayOfStates& from,
+                                const ArrayOfStates& to,
+                                StateScalar tau);
+
 std::tuple<StateTrans, AngleAxisVector, StateVector>
 differential(const StateVector& from, const StateVector& to);
 
@@ -0,0 +1,266 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "se3_knn.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+namespace osr {
+
+struct SE3KNN::Query {
+	double tx, ty, tz, qw, qx, qy, qz;
+
+	Query(const double* s)
+	{
+		tx = s[0];
+		ty = s[1];
+		tz = s[2];
+		double n = std::sqrt(s[3] * s[3] + s[4] * s[4] + s[5] * s[5] + s[6] * s[6]);
+		qw = s[3] / n;
+		qx = s[4] / n;
+		qy = s[5] / n;
+		qz = s[6] / n;
+	}
+};
+
+namespace {
+
+inline double
+se3_distance(double dx, double dy, double dz, double dot)
+{
+	double trdist = std::sqrt(dx * dx + dy * dy + dz * dz);
+	// Same as Eigen::Quaternion::angularDistance
+	double rotdist = 2.0 * std::acos(std::min(std::abs(dot), 1.0));
+	return trdist + rotdist;
+}
+
+struct KNNVisitor {
+	int k;
+	std::vector<std::pair<double, int>>& heap; // Max-heap of the best k
+
+	double tau() const
+	{
+		if (int(heap.size()) < k)
+			return std::numeric_limits<double>::infinity();
+		return heap.front().first;
+	}
+
+	void visit(double d, int row)
+	{
+		if (int(heap.size()) < k) {
+			heap.emplace_back(d, row);
+			std::push_heap(heap.begin(), heap.end());
+		} else if (d < heap.front().first) {
+			std::pop_heap(heap.begin(), heap.end());
+			heap.back() = std::make_pair(d, row);
+			std::push_heap(heap.begin(), heap.end());
+		}
+	}
+};
+
+struct RadiusVisitor {
+	double r;
+	std::vector<std::pair<double, int>>& out;
+
+	double tau() const { return r; }
+
+	void visit(double d, int row)
+	{
+		if (d <= r)
+			out.emplace_back(d, row);
+	}
+};
+
+}
+
+SE3KNN::SE3KNN(const ArrayOfStates& states, int leaf_size)
+	:leaf_size_(std::max(leaf_size, 1))
+{
+	int N = states.rows();
+	// Build with AoS copies, then scatter to SoA in the final order
+	Eigen::Matrix<double, -1, kStateDimension, Eigen::RowMajor> pts = states;
+	for (int i = 0; i < N; i++) {
+		Query q(pts.row(i).data());
+		pts.row(i) << q.tx, q.ty, q.tz, q.qw, q.qx, q.qy, q.qz;
+	}
+	perm_.resize(N);
+	for (int i = 0; i < N; i++)
+		perm_[i] = i;
+	if (N > 0)
+		build(0, N, pts.data());
+
+	std::vector<double>* soa[kStateDimension] = { &tx_, &ty_, &tz_, &qw_, &qx_, &qy_, &qz_ };
+	for (int j = 0; j < kStateDimension; j++) {
+		std::vector<double> col(N);
+		for (int i = 0; i < N; i++)
+			col[i] = pts(perm_[i], j);
+		*soa[j] = std::move(col);
+	}
+}
+
+double
+SE3KNN::distanceTo(const Query& q, int pos) const
+{
+	return se3_distance(q.tx - tx_[pos], q.ty - ty_[pos], q.tz - tz_[pos],
+	                    q.qw * qw_[pos] + q.qx * qx_[pos] + q.qy * qy_[pos] + q.qz * qz_[pos]);
+}
+
+int
+SE3KNN::build(int begin, int end, const double* aos)
+{
+	auto aos_distance = [aos](int a, int b) -> double {
+		const double* pa = aos + size_t(a) * kStateDimension;
+		const double* pb = aos + size_t(b) * kStateDimension;
+		return se3_distance(pa[0] - pb[0], pa[1] - pb[1], pa[2] - pb[2],
+		                    pa[3] * pb[3] + pa[4] * pb[4] + pa[5] * pb[5] + pa[6] * pb[6]);
+	};
+	int index = int(nodes_.size());
+	nodes_.emplace_back();
+	Node node;
+	node.begin = begin;
+	node.end = end;
+	node.inside = -1;
+	node.outside = -1;
+	node.mu = 0.0;
+	if (end - begin <= leaf_size_) {
+		nodes_[index] = node;
+		return index;
+	}
+	// Deterministic choice of the vantage point
+	std::swap(perm_[begin], perm_[begin + (end - begin) / 2]);
+	int vp = perm_[begin];
+	std::vector<std::pair<double, int>> items;
+	items.reserve(end - begin - 1);
+	for (int i = begin + 1; i < end; i++)
+		items.emplace_back(aos_distance(vp, perm_[i]), perm_[i]);
+	size_t median = items.size() / 2;
+	std::nth_element(items.begin(), items.begin() + median, items.end());
+	for (size_t i = 0; i < items.size(); i++)
+		perm_[begin + 1 + i] = items[i].second;
+	int mid = begin + 1 + int(median);
+	node.mu = items[median].first;
+	items.clear();
+	items.shrink_to_fit();
+	node.inside = build(begin + 1, mid, aos);
+	node.outside = build(mid, end, aos);
+	nodes_[index] = node;
+	return index;
+}
+
+template<typename Visitor>
+void
+SE3KNN::search(const Query& q, Visitor& visitor) const
+{
+	if (nodes_.empty())
+		return;
+	// (lower bound of distances in the subtree, node)
+	std::pair<double, int> stack[128];
+	int top = 0;
+	stack[top++] = std::make_pair(0.0, 0);
+	while (top > 0) {
+		auto entry = stack[--top];
+		if (entry.first > visitor.tau())
+			continue;
+		const Node& node = nodes_[entry.second];
+		if (node.inside < 0) {
+			for (int pos = node.begin; pos < node.end; pos++)
+				visitor.visit(distanceTo(q, pos), perm_[pos]);
+			continue;
+		}
+		double d = distanceTo(q, node.begin);
+		visitor.visit(d, perm_[node.begin]);
+		double inside_bound = std::max(0.0, d - node.mu);
+		double outside_bound = std::max(0.0, node.mu - d);
+		// Push the farther subtree first, so the nearer one is visited first
+		if (d < node.mu) {
+			stack[top++] = std::make_pair(outside_bound, node.outside);
+			stack[top++] = std::make_pair(inside_bound, node.inside);
+		} else {
+			stack[top++] = std::make_pair(inside_bound, node.inside);
+			stack[top++] = std::make_pair(outside_bound, node.outside);
+		}
+	}
+}
+
+void
+SE3KNN::nearestK(const StateVector& s,
+                 int k,
+                 std::vector<std::pair<double, int>>& out) const
+{
+	out.clear();
+	if (k <= 0)
+		return;
+	Query q(s.data());
+	KNNVisitor visitor{k, out};
+	search(q, visitor);
+	std::sort_heap(out.begin(), out.end());
+}
+
+void
+SE3KNN::radius(const StateVector& s,
+               double r,
+               std::vector<std::pair<double, int>>& out) const
+{
+	out.clear();
+	Query q(s.data());
+	RadiusVisitor visitor{r, out};
+	search(q, visitor);
+	std::sort(out.begin(), out.end());
+}
+
+std::tuple<Eigen::MatrixXi, Eigen::MatrixXd>
+SE3KNN::nearestK(const ArrayOfStates& queries,
+                 int k,
+                 bool enable_mt) const
+{
+	if (k < 0)
+		throw std::runtime_error("SE3KNN::nearestK: invalid k " + std::to_string(k));
+	Eigen::MatrixXi indices = Eigen::MatrixXi::Constant(queries.rows(), k, -1);
+	Eigen::MatrixXd distances = Eigen::MatrixXd::Constant(queries.rows(), k,
+			std::numeric_limits<double>::infinity());
+	{
+		std::vector<std::pair<double, int>> out;
+#pragma omp parallel for if (enable_mt) firstprivate(out) schedule(dynamic, 64)
+		for (int i = 0; i < queries.rows(); i++) {
+			nearestK(StateVector(queries.row(i).transpose()), k, out);
+			for (size_t j = 0; j < out.size(); j++) {
+				indices(i, j) = out[j].second;
+				distances(i, j) = out[j].first;
+			}
+		}
+	}
+	return std::make_tuple(indices, distances);
+}
+
+std::tuple<Eigen::VectorXi, Eigen::VectorXi, Eigen::VectorXd>
+SE3KNN::radius(const ArrayOfStates& queries,
+               double r,
+               bool enable_mt) const
+{
+	int N = queries.rows();
+	std::vector<std::vector<std::pair<double, int>>> results(N);
+#pragma omp parallel for if (enable_mt) schedule(dynamic, 64)
+	for (int i = 0; i < N; i++)
+		radius(StateVector(queries.row(i).transpose()), r, results[i]);
+
+	Eigen::VectorXi offsets(N + 1);
+	offsets(0) = 0;
+	for (int i = 0; i < N; i++)
+		offsets(i + 1) = offsets(i) + int(results[i].size());
+	Eigen::VectorXi indices(offsets(N));
+	Eigen::VectorXd distances(offsets(N));
+	for (int i = 0; i < N; i++) {
+		for (size_t j = 0; j < results[i].size(); j++) {
+			indices(offsets(i) + j) = results[i][j].second;
+			distances(offsets(i) + j) = results[i][j].first;
+		}
+	}
+	return std::make_tuple(offsets, indices, distances);
+}
+
+}
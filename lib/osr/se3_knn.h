@@ -0,0 +1,87 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef OSR_SE3_KNN_H
+#define OSR_SE3_KNN_H
+
+#include "osr_state.h"
+#include <stdint.h>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include <Eigen/Core>
+
+namespace osr {
+
+/*
+ * Static nearest neighbor index of SE(3) states under the metric of
+ * osr::distance, i.e. translation distance plus rotation angle.
+ *
+ * The index is a vantage-point tree with leaf buckets. States are permuted so
+ * that every subtree covers a contiguous range, and stored in SoA layout.
+ *
+ * The index is immutable after construction, hence all queries are const and
+ * can run from any number of threads without locking. Batched queries are
+ * parallelized with OpenMP.
+ *
+ * Returned indices are rows of the states passed to the constructor.
+ */
+class SE3KNN {
+public:
+	SE3KNN(const ArrayOfStates& states, int leaf_size = 16);
+
+	size_t size() const { return perm_.size(); }
+
+	/*
+	 * Returns:
+	 *      indices: N x k, sorted by distance, padded with -1
+	 *      distances: N x k, padded with infinity
+	 */
+	std::tuple<Eigen::MatrixXi, Eigen::MatrixXd>
+	nearestK(const ArrayOfStates& queries,
+	         int k,
+	         bool enable_mt = true) const;
+
+	/*
+	 * Neighbors within radius r in CSR form. The neighbors of query i are
+	 * [offsets(i), offsets(i+1)) of indices and distances, sorted by
+	 * distance.
+	 */
+	std::tuple<Eigen::VectorXi, Eigen::VectorXi, Eigen::VectorXd>
+	radius(const ArrayOfStates& queries,
+	       double r,
+	       bool enable_mt = true) const;
+
+	// Single query versions. out is sorted by distance.
+	void nearestK(const StateVector& q,
+	              int k,
+	              std::vector<std::pair<double, int>>& out) const;
+	void radius(const StateVector& q,
+	            double r,
+	            std::vector<std::pair<double, int>>& out) const;
+private:
+	struct Node {
+		int32_t begin, end; // Range of permuted states
+		int32_t inside;     // -1 for leaves
+		int32_t outside;
+		double mu;          // Radius of the inside ball
+	};
+
+	// SoA, in permuted order. qw..qz are normalized
+	std::vector<double> tx_, ty_, tz_, qw_, qx_, qy_, qz_;
+	std::vector<int> perm_; // Permuted position -> row of input
+	std::vector<Node> nodes_;
+	int leaf_size_;
+
+	struct Query;
+	double distanceTo(const Query&, int pos) const;
+	int build(int begin, int end, const double* aos);
+	template<typename Visitor>
+	void search(const Query&, Visitor& visitor) const;
+};
+
+}
+
+#endif
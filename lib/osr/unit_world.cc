@@ -12,7 +12,9 @@
 #include <stdexcept>
 #include <queue>
 #include <random>
+#include <chrono>
 #include <omp.h>
+#include <sys/stat.h>
 #include <igl/doublearea.h>
 #include <igl/cross.h>
 #include <igl/barycentric_coordinates.h>
@@ -24,13 +26,52 @@
 #endif
 
 #include "ode_data.h"
+#include "visibility_file.h"
+#include "motion_cache.h"
 
 namespace osr {
 
 using std::tie;
 
+namespace {
+constexpr int kMaxMotionCheckPacket = 16;
+
+/*
+ * Rows per task of the array translations. Every chunk is copied to a column
+ * major ArrayOfStates, hence the batch kernels in osr_state.h work on SoA
+ * buffers that fit in L2.
+ */
+constexpr int kTranslationChunk = 4096;
+
+template<typename Func>
+void
+parallel_chunks(int N, Func func)
+{
+	const int nchunks = (N + kTranslationChunk - 1) / kTranslationChunk;
+#pragma omp parallel for if (nchunks > 1) schedule(static)
+	for (int c = 0; c < nchunks; c++) {
+		int begin = c * kTranslationChunk;
+		func(begin, std::min(kTranslationChunk, N - begin));
+	}
+}
+
+/*
+ * tf * V for row vectors, without the transposed temporaries of
+ * (tf * V.transpose()).transpose()
+ */
+CDModel::VMatrix
+transform_vertices(const Transform& tf, Eigen::Ref<const CDModel::VMatrix> V)
+{
+	CDModel::VMatrix ret = V * tf.linear().transpose();
+	ret.rowwise() += tf.translation().transpose();
+	return ret;
+}
+}
+
 const uint32_t UnitWorld::GEO_ENV;
 const uint32_t UnitWorld::GEO_ROB;
+const uint32_t UnitWorld::MOTION_CHECK_DISCRETE;
+const uint32_t UnitWorld::MOTION_CHECK_CONSERVATIVE_ADVANCEMENT;
 
 auto glm2Eigen(const glm::mat4& m)
 {
@@ -67,6 +108,8 @@ UnitWorld::UnitWorld()
 	perturbate_.setZero();
 	perturbate_(3) = 1.0;
 	perturbate_tf_.setIdentity();
+	calib_mat_.setIdentity();
+	inv_calib_mat_.setIdentity();
 }
 
 UnitWorld::~UnitWorld()
@@ -77,11 +120,15 @@ void
 UnitWorld::copyFrom(const UnitWorld* other)
 {
 	shared_ = true;
+	collision_backend_ = other->collision_backend_;
+	cd_image_prefix_ = other->cd_image_prefix_;
+	model_fn_ = other->model_fn_;
+	robot_fn_ = other->robot_fn_;
 	scene_.reset(new Scene(other->scene_));
-	cd_scene_.reset(new CDModel(*scene_));
+	cd_scene_ = createCDModel(GEO_ENV);
 	if (other->robot_) {
 		robot_.reset(new Scene(other->robot_));
-		cd_robot_.reset(new CDModel(*robot_));
+		cd_robot_ = createCDModel(GEO_ROB);
 	} else {
 		robot_.reset();
 	}
@@ -89,6 +136,9 @@ UnitWorld::copyFrom(const UnitWorld* other)
 	calib_mat_ = glm2Eigen(scene_->getCalibrationTransform());
 	inv_calib_mat_ = calib_mat_.inverse();
 	perturbate_ = other->perturbate_;
+	motion_check_mode_ = other->motion_check_mode_;
+	motion_cache_ = other->motion_cache_;
+	updateGeometryHash();
 }
 
 void
@@ -97,6 +147,8 @@ UnitWorld::loadModelFromFile(const std::string& fn)
 	scene_.reset(new Scene);
 	const glm::vec3 blue(0.0f, 0.0f, 1.0f);
 	scene_->load(fn, &blue);
+	model_fn_ = fn;
+	updateGeometryHash();
 }
 
 void
@@ -105,8 +157,10 @@ UnitWorld::loadRobotFromFile(const std::string& fn)
 	robot_.reset(new Scene);
 	const glm::vec3 red(1.0f, 0.0f, 0.0f);
 	robot_->load(fn, &red);
+	robot_fn_ = fn;
 	robot_state_.setZero();
 	robot_state_(3) = 1.0; // Quaternion for no rotation
+	updateGeometryHash();
 }
 
 
@@ -149,15 +203,104 @@ UnitWorld::angleModel(float latitude, float longitude)
 	calib_mat_ = glm2Eigen(scene_->getCalibrationTransform());
 	std::cerr << "Calibration matrix " << calib_mat_ << std::endl;
 	inv_calib_mat_ = calib_mat_.inverse();
-	cd_scene_.reset(new CDModel(*scene_));
+	cd_scene_ = createCDModel(GEO_ENV);
 	if (robot_) {
 		robot_->resetTransform();
 		robot_->moveToCenter();
 		robot_->scale(glm::vec3(scene_scale_));
 		robot_->rotate(glm::radians(latitude), 1, 0, 0);      // latitude
 		robot_->rotate(glm::radians(longitude), 0, 1, 0);     // longitude
-		cd_robot_.reset(new CDModel(*robot_));
+		cd_robot_ = createCDModel(GEO_ROB);
 	}
+	updateGeometryHash();
+}
+
+
+std::shared_ptr<CDModel>
+UnitWorld::createCDModel(uint32_t geo) const
+{
+	const Scene& scene = geo == GEO_ENV ? *scene_ : *robot_;
+	std::shared_ptr<CDModel> ret;
+	std::string image_fn;
+	uint64_t key = 0;
+	if (!cd_image_prefix_.empty()) {
+		const std::string& fn = geo == GEO_ENV ? model_fn_ : robot_fn_;
+		image_fn = cd_image_prefix_ + (geo == GEO_ENV ? ".env.cdimg" : ".rob.cdimg");
+		// Source file, its size and mtime, and the calibration
+		int64_t meta[2] = { 0, 0 };
+		struct stat st;
+		if (::stat(fn.c_str(), &st) == 0) {
+			meta[0] = st.st_size;
+			meta[1] = st.st_mtime;
+		}
+		glm::mat4 calib = scene.getCalibrationTransform();
+		key = MotionCache::hashBytes(fn.data(), fn.size(), geo);
+		key = MotionCache::hashBytes(meta, sizeof(meta), key);
+		key = MotionCache::hashBytes(&calib, sizeof(calib), key);
+		ret = CDModel::loadImage(image_fn, key);
+	}
+	if (!ret) {
+		ret = std::make_shared<CDModel>(scene);
+		if (!image_fn.empty())
+			ret->saveImage(image_fn, key);
+	}
+	ret->setBackend(collision_backend_);
+	return ret;
+}
+
+
+void
+UnitWorld::setCDImagePrefix(const std::string& prefix)
+{
+	cd_image_prefix_ = prefix;
+}
+
+
+std::string
+UnitWorld::getCDImagePrefix() const
+{
+	return cd_image_prefix_;
+}
+
+
+uint64_t
+UnitWorld::collisionMask(const StateVector* states, int n) const
+{
+	if (!cd_scene_ || !cd_robot_)
+		return 0;
+	Transform envTf;
+	Transform robTfs[kMaxMotionCheckPacket];
+	for (int i = 0; i < n; i++)
+		std::tie(envTf, robTfs[i]) = getCDTransforms(states[i]);
+	return CDModel::collideMany(*cd_scene_, envTf, *cd_robot_, robTfs, n);
+}
+
+
+int
+UnitWorld::motionCheckPacketSize() const
+{
+	// Packets only pay off when the BVH traversal is shared
+	if (collision_backend_ == CDModel::BACKEND_FLAT_BVH)
+		return kMaxMotionCheckPacket;
+	return 1;
+}
+
+
+void
+UnitWorld::setCollisionBackend(uint32_t backend)
+{
+	if (cd_scene_)
+		cd_scene_->setBackend(backend);
+	if (cd_robot_)
+		cd_robot_->setBackend(backend);
+	collision_backend_ = backend;
+}
+
+
+uint32_t
+UnitWorld::getCollisionBackend() const
+{
+	return collision_backend_;
 }
 
 
@@ -246,6 +389,40 @@ UnitWorld::isValid(const StateVector& state) const
 	return !CDModel::collide(*cd_scene_, envTf, *cd_robot_, robTf);
 }
 
+Eigen::Matrix<uint8_t, -1, 1>
+UnitWorld::isValidBatch(const ArrayOfStates& qs,
+                        bool qs_are_unit_states,
+                        bool enable_mt) const
+{
+	const int N = qs.rows();
+	const int NBytes = (N + 7) / 8;
+	Eigen::Matrix<uint8_t, -1, 1> ret;
+	if (!cd_scene_ || !cd_robot_) {
+		ret.setConstant(NBytes, 0xFF);
+		return ret;
+	}
+	ret.setZero(NBytes);
+
+	ArrayOfTransforms robTfs = translate_states_to_transforms(ppToUnitStates(qs, qs_are_unit_states));
+	const Transform envTf = translate_state_to_transform(perturbate_);
+	/*
+	 * One byte per iteration so threads never share the output, and
+	 * dynamic scheduling since the cost of FCL queries varies a lot.
+	 */
+#pragma omp parallel for if (enable_mt) schedule(dynamic, 16)
+	for (int b = 0; b < NBytes; b++) {
+		uint8_t bits = 0;
+		int end = std::min(N, 8 * (b + 1));
+		for (int i = 8 * b; i < end; i++) {
+			Transform robTf = extract_transform(robTfs, i);
+			if (!CDModel::collide(*cd_scene_, envTf, *cd_robot_, robTf))
+				bits |= uint8_t(1u << (i - 8 * b));
+		}
+		ret(b) = bits;
+	}
+	return ret;
+}
+
 bool UnitWorld::isDisentangled(const StateVector& state) const
 {
 	if (!cd_scene_ || !cd_robot_) {
@@ -264,6 +441,43 @@ bool UnitWorld::isDisentangled(const StateVector& state) const
 }
 
 
+double
+UnitWorld::distanceToCollision(const StateVector& state,
+                               double threshold) const
+{
+	if (!cd_scene_ || !cd_robot_)
+		return threshold;
+	Transform envTf;
+	Transform robTf;
+	std::tie(envTf, robTf) = getCDTransforms(state);
+	return CDModel::distance(*cd_scene_, envTf, *cd_robot_, robTf, threshold);
+}
+
+
+Eigen::VectorXd
+UnitWorld::clearances(const ArrayOfStates& qs,
+                      bool qs_are_unit_states,
+                      double threshold,
+                      bool enable_mt) const
+{
+	const int N = qs.rows();
+	Eigen::VectorXd ret;
+	if (!cd_scene_ || !cd_robot_) {
+		ret.setConstant(N, threshold);
+		return ret;
+	}
+	ret.resize(N);
+	ArrayOfTransforms robTfs = translate_states_to_transforms(ppToUnitStates(qs, qs_are_unit_states));
+	const Transform envTf = translate_state_to_transform(perturbate_);
+#pragma omp parallel for if (enable_mt) schedule(dynamic, 16)
+	for (int i = 0; i < N; i++) {
+		Transform robTf = extract_transform(robTfs, i);
+		ret(i) = CDModel::distance(*cd_scene_, envTf, *cd_robot_, robTf, threshold);
+	}
+	return ret;
+}
+
+
 std::tuple<StateVector, bool, float>
 UnitWorld::transitState(const StateVector& state,
                        int action,
@@ -397,7 +611,26 @@ UnitWorld::transitStateTo(const StateVector& from,
                           const StateVector& to,
                           double verify_delta) const
 {
+	MotionCache::Key key;
+	if (motion_cache_) {
+		MotionCache::Value value;
+		key = motion_cache_->makeKey(from, to, verify_delta, motionCacheSalt());
+		if (motion_cache_->lookup(key, value) &&
+		    (value.flags & MotionCache::HAS_PROGRESS)) {
+			bool valid = value.flags & MotionCache::IS_VALID;
+			return std::make_tuple(value.last_free, valid, float(value.tau));
+		}
+	}
 	auto tup = transitStateToWithContact(from, to, verify_delta);
+	if (motion_cache_) {
+		MotionCache::Value value;
+		value.flags = MotionCache::HAS_VALIDITY | MotionCache::HAS_PROGRESS;
+		if (std::get<2>(tup))
+			value.flags |= MotionCache::IS_VALID;
+		value.tau = std::get<3>(tup);
+		value.last_free = std::get<0>(tup);
+		motion_cache_->insert(key, value);
+	}
 	return std::make_tuple(std::get<0>(tup), std::get<2>(tup), std::get<3>(tup));
 }
 
@@ -407,6 +640,9 @@ UnitWorld::transitStateToWithContact(const StateVector& from,
                                      const StateVector& to,
                                      double verify_delta) const
 {
+	if (motion_check_mode_ == MOTION_CHECK_CONSERVATIVE_ADVANCEMENT &&
+	    cd_scene_ && cd_robot_)
+		return transitStateToWithCA(from, to, verify_delta);
 	double dist = distance(from, to);
 	// std::cerr << "\t\tNSeg: " << nseg << std::endl;
 #if 0 // Parallel Version
@@ -445,32 +681,91 @@ UnitWorld::transitStateToWithContact(const StateVector& from,
 	if (verify_delta >= dist) {
 		return std::make_tuple(from, to, false, 0.0, 1.0);
 	}
+	/*
+	 * States at tau_k = min(k * verify_delta, dist) / dist, k = 1 ... n
+	 * are checked in order, motionCheckPacketSize() states at a time.
+	 */
+	const int64_t n = int64_t(std::ceil(dist / verify_delta));
+	const int packet = motionCheckPacketSize();
+	StateVector states[kMaxMotionCheckPacket];
+	double taus[kMaxMotionCheckPacket];
 	StateVector last_free = from;
-	double delta = verify_delta;
-	double inv_dist = 1.0/dist;
 	double last_tau = 0.0;
-	double tau = 0.0;
-	StateVector state = from;
-	while (delta <= dist) {
-		double tau = delta * inv_dist;
-		state = interpolate(from, to, tau);
-		if (!isValid(state)) {
-			return std::make_tuple(last_free, state, false, last_tau, tau);
+	for (int64_t k0 = 1; k0 <= n; k0 += packet) {
+		int m = int(std::min<int64_t>(packet, n - k0 + 1));
+		for (int i = 0; i < m; i++) {
+			taus[i] = std::min((k0 + i) * verify_delta, dist) / dist;
+			states[i] = interpolate(from, to, taus[i]);
 		}
-		last_tau = tau;
-		last_free = state;
-		if (delta < dist) {
-			// make sure tau = 1.0 is checked.
-			delta += verify_delta;
-			delta = std::min(dist, delta);
-		} else {
-			// make sure tau = 1.0 is NOT double-checked.
-			delta += verify_delta;
+		uint64_t mask = collisionMask(states, m);
+		if (mask) {
+			int i = __builtin_ctzll(mask);
+			if (i > 0) {
+				last_free = states[i - 1];
+				last_tau = taus[i - 1];
+			}
+			return std::make_tuple(last_free, states[i], false, last_tau, taus[i]);
 		}
+		last_free = states[m - 1];
+		last_tau = taus[m - 1];
 	}
+	/*
+	 * <4> stays 0.0 on a free motion, callers (e.g. touchq_util.py)
+	 * persist this value.
+	 */
+	return std::make_tuple(last_free, last_free, true, last_tau, 0.0);
 #endif
-	// We may assert (delta > dist) == true
-	return std::make_tuple(last_free, state, delta > dist, last_tau, tau);
+}
+
+
+/*
+ * Conservative advancement
+ *
+ * Any point p of the robot moves along interpolate(from, to, tau) with
+ *      |dx/dtau| <= |t1 - t0| + |p| * theta
+ * where theta is the rotation angle between from and to. Hence with
+ * clearance d at tau, [tau, tau + d / motion_bound) is collision free.
+ *
+ * verify_delta is used as the minimal step, so segments near contact are
+ * checked no worse than the discrete version.
+ */
+std::tuple<StateVector, StateVector, bool, float, float>
+UnitWorld::transitStateToWithCA(const StateVector& from,
+                                const StateVector& to,
+                                double verify_delta) const
+{
+	double dist = distance(from, to);
+	if (verify_delta >= dist) {
+		return std::make_tuple(from, to, false, 0.0, 1.0);
+	}
+	StateTrans from_t, to_t;
+	StateQuat from_r, to_r;
+	std::tie(from_t, from_r) = decompose(from);
+	std::tie(to_t, to_r) = decompose(to);
+	double motion_bound = (to_t - from_t).norm() +
+	                      cd_robot_->maxRadius() * from_r.angularDistance(to_r);
+	double min_dtau = verify_delta / dist;
+
+	Transform envTf = translate_state_to_transform(perturbate_);
+	StateVector last_free = from;
+	StateVector state = from;
+	double last_tau = 0.0;
+	double tau = 0.0;
+	while (true) {
+		Transform robTf = translate_state_to_transform(state);
+		double clearance = CDModel::distance(*cd_scene_, envTf, *cd_robot_, robTf);
+		if (clearance <= 0.0)
+			return std::make_tuple(last_free, state, false, last_tau, tau);
+		last_free = state;
+		last_tau = tau;
+		if (tau >= 1.0)
+			break;
+		double dtau = motion_bound > 0.0 ? clearance / motion_bound : 1.0;
+		tau = std::min(1.0, tau + std::max(dtau, min_dtau));
+		state = interpolate(from, to, tau);
+	}
+	// Same as the discrete version, <4> is 0.0 on a free motion
+	return std::make_tuple(last_free, state, true, last_tau, 0.0);
 }
 
 
@@ -481,8 +776,159 @@ UnitWorld::isValidTransition(const StateVector& from,
 {
 	double d = distance(from, to);
 	auto vdelta = std::min(d / 2.0, initial_verify_delta);
-	auto tup = transitStateTo(from, to, vdelta);
-	return std::get<1>(tup);
+	if (motion_check_mode_ != MOTION_CHECK_DISCRETE) {
+		auto tup = transitStateTo(from, to, vdelta);
+		return std::get<1>(tup);
+	}
+	MotionCache::Key key;
+	if (motion_cache_) {
+		MotionCache::Value value;
+		key = motion_cache_->makeKey(from, to, vdelta, motionCacheSalt());
+		if (motion_cache_->lookup(key, value) &&
+		    (value.flags & MotionCache::HAS_VALIDITY))
+			return value.flags & MotionCache::IS_VALID;
+	}
+	bool valid = isValidTransitionBisection(from, to, vdelta);
+	if (motion_cache_) {
+		MotionCache::Value value;
+		value.flags = MotionCache::HAS_VALIDITY;
+		if (valid)
+			value.flags |= MotionCache::IS_VALID;
+		motion_cache_->insert(key, value);
+	}
+	return valid;
+}
+
+
+/*
+ * Checks the same discrete states as transitStateToWithContact, i.e.
+ *      tau_k = min(k * verify_delta, dist) / dist, k = 1 ... n
+ * but in bisection (van der Corput) order: tau_n first, then the midpoints
+ * of the intervals in BFS order.
+ */
+bool
+UnitWorld::isValidTransitionBisection(const StateVector& from,
+                                      const StateVector& to,
+                                      double verify_delta) const
+{
+	double dist = distance(from, to);
+	if (verify_delta >= dist)
+		return false;
+	int64_t n = int64_t(std::ceil(dist / verify_delta));
+	int64_t checked = 0;
+	const int packet = motionCheckPacketSize();
+	StateVector states[kMaxMotionCheckPacket];
+	std::vector<int64_t> batch;
+	batch.reserve(packet);
+	batch.emplace_back(n);
+
+	bool valid = true;
+	std::queue<std::pair<int64_t, int64_t>> Q; // Open intervals (lo, hi)
+	Q.emplace(0, n);
+	while (valid && !batch.empty()) {
+		for (size_t i = 0; i < batch.size(); i++) {
+			double tau = std::min(batch[i] * verify_delta, dist) / dist;
+			states[i] = interpolate(from, to, tau);
+		}
+		checked += batch.size();
+		valid = collisionMask(states, int(batch.size())) == 0;
+		batch.clear();
+		while (!Q.empty() && int(batch.size()) < packet) {
+			int64_t lo, hi;
+			std::tie(lo, hi) = Q.front();
+			Q.pop();
+			if (hi - lo < 2)
+				continue;
+			int64_t mid = lo + (hi - lo) / 2;
+			batch.emplace_back(mid);
+			Q.emplace(lo, mid);
+			Q.emplace(mid, hi);
+		}
+	}
+	mc_checked_states_.fetch_add(checked, std::memory_order_relaxed);
+	mc_skipped_states_.fetch_add(n - checked, std::memory_order_relaxed);
+	return valid;
+}
+
+
+std::tuple<uint64_t, uint64_t>
+UnitWorld::getMotionCheckCounters() const
+{
+	return std::make_tuple(mc_checked_states_.load(), mc_skipped_states_.load());
+}
+
+
+void
+UnitWorld::resetMotionCheckCounters()
+{
+	mc_checked_states_.store(0);
+	mc_skipped_states_.store(0);
+}
+
+
+void
+UnitWorld::enableMotionCache(size_t lru_capacity,
+                             const std::string& fn,
+                             size_t disk_slots,
+                             double quantum)
+{
+	if (!cd_scene_)
+		throw std::runtime_error("UnitWorld::enableMotionCache: geometry is not loaded");
+	updateGeometryHash();
+	motion_cache_ = std::make_shared<MotionCache>(lru_capacity, fn, disk_slots, quantum);
+}
+
+
+/*
+ * Hash of everything the motion check results depend on, besides the
+ * per-query arguments. The file names are included because a loaded model
+ * only replaces the collision models after angleModel.
+ */
+void
+UnitWorld::updateGeometryHash()
+{
+	uint64_t h = 0;
+	for (const auto& fn : { model_fn_, robot_fn_ })
+		h = MotionCache::hashBytes(fn.data(), fn.size(), h);
+	for (const auto& cd : { cd_scene_, cd_robot_ }) {
+		if (!cd) {
+			h = MotionCache::hashBytes(nullptr, 0, h);
+			continue;
+		}
+		const auto& V = cd->vertices();
+		const auto& F = cd->faces();
+		h = MotionCache::hashBytes(V.data(), V.size() * sizeof(V(0,0)), h);
+		h = MotionCache::hashBytes(F.data(), F.size() * sizeof(F(0,0)), h);
+	}
+	h = MotionCache::hashBytes(calib_mat_.data(), calib_mat_.size() * sizeof(calib_mat_(0,0)), h);
+	geometry_hash_ = h;
+}
+
+
+void
+UnitWorld::disableMotionCache()
+{
+	motion_cache_.reset();
+}
+
+
+std::tuple<uint64_t, uint64_t, uint64_t>
+UnitWorld::getMotionCacheStats() const
+{
+	if (!motion_cache_)
+		return std::make_tuple(0, 0, 0);
+	return motion_cache_->getStats();
+}
+
+
+uint64_t
+UnitWorld::motionCacheSalt() const
+{
+	uint64_t h = MotionCache::hashBytes(perturbate_.data(),
+	                                    perturbate_.size() * sizeof(perturbate_(0)),
+	                                    geometry_hash_);
+	h = MotionCache::hashBytes(&motion_check_mode_, sizeof(motion_check_mode_), h);
+	return MotionCache::hashBytes(&collision_backend_, sizeof(collision_backend_), h);
 }
 
 
@@ -554,8 +1000,52 @@ UnitWorld::translateFromUnitState(const StateVector& pstate) const
 #endif
 }
 
+/*
+ * Batched translateToUnitState: calibration followed by the perturbation.
+ */
+ArrayOfStates
+UnitWorld::translateToUnitStates(const ArrayOfStates& qs) const
+{
+	ArrayOfTrans trans;
+	ArrayOfQuats rots;
+	std::tie(trans, rots) = batch_decompose(qs);
+	trans = (trans * calib_mat_.topLeftCorner<3, 3>().transpose()).rowwise()
+	        + calib_mat_.topRightCorner<3, 1>().transpose();
+	StateTrans ptrans;
+	StateQuat prot;
+	std::tie(ptrans, prot) = decompose(perturbate_);
+	trans = (trans * prot.toRotationMatrix().transpose()).rowwise() + ptrans.transpose();
+	return batch_compose(trans, batch_quat_multiply(prot, rots));
+}
+
+ArrayOfStates
+UnitWorld::translateFromUnitStates(const ArrayOfStates& qs) const
+{
+	ArrayOfTrans trans;
+	ArrayOfQuats rots;
+	std::tie(trans, rots) = batch_decompose(qs);
+	StateTrans ptrans;
+	StateQuat prot;
+	std::tie(ptrans, prot) = decompose(perturbate_);
+	StateQuat inv_prot = prot.inverse();
+	trans = (trans.rowwise() - ptrans.transpose()) * inv_prot.toRotationMatrix().transpose();
+	trans = (trans * inv_calib_mat_.topLeftCorner<3, 3>().transpose()).rowwise()
+	        + inv_calib_mat_.topRightCorner<3, 1>().transpose();
+	return batch_compose(trans, batch_quat_multiply(inv_prot, rots));
+}
+
+ArrayOfStates
+UnitWorld::translateUnitStateToOMPLState(const StatesRef& qs, bool to_angle_axis) const
+{
+	ArrayOfStates ret(qs.rows(), kStateDimension);
+	parallel_chunks(qs.rows(), [&](int begin, int n) {
+		ret.middleRows(begin, n) = unitToOMPLChunk(qs.middleRows(begin, n), to_angle_axis);
+	});
+	return ret;
+}
+
 ArrayOfStates
-UnitWorld::translateUnitStateToOMPLState(const ArrayOfStates& qs, bool to_angle_axis) const
+UnitWorld::unitToOMPLChunk(const ArrayOfStates& qs, bool to_angle_axis) const
 {
 	int N = qs.rows();
 	ArrayOfStates ret;
@@ -563,12 +1053,11 @@ UnitWorld::translateUnitStateToOMPLState(const ArrayOfStates& qs, bool to_angle_
 	// Handle the case of using enforceRobotCenter
 	Eigen::Vector3d delta_center = glm2Eigen(robot_->getOMPLCenter() - robot_->getCenter());
 	delta_center *= scene_scale_;
-	for (int i = 0; i < N; i++) {
-		auto tup = decompose(qs.row(i).transpose());
-		Eigen::Vector3d t_prime = std::get<0>(tup) + std::get<1>(tup) * delta_center;
-		ret.row(i) = compose(t_prime, std::get<1>(tup));
-		ret.row(i) = translateFromUnitState(ret.row(i));
-	}
+	ArrayOfTrans trans;
+	ArrayOfQuats rots;
+	std::tie(trans, rots) = batch_decompose(qs);
+	trans += batch_rotate(rots, delta_center);
+	ret = translateFromUnitStates(batch_compose(trans, rots));
 	// OMPL uses W last while we uses W first
 	Eigen::Matrix<double, -1, 4> wfirst(N, 4);
 	wfirst = ret.block(0, 3, N, 4);
@@ -604,7 +1093,17 @@ UnitWorld::translateUnitStateToOMPLState(const ArrayOfStates& qs, bool to_angle_
  * t_(ompl} = t_{vanilla} + R_{ompl} O
  */
 ArrayOfStates
-UnitWorld::translateVanillaStateToOMPLState(const ArrayOfStates& qs) const
+UnitWorld::translateVanillaStateToOMPLState(const StatesRef& qs) const
+{
+	ArrayOfStates ret(qs.rows(), kStateDimension);
+	parallel_chunks(qs.rows(), [&](int begin, int n) {
+		ret.middleRows(begin, n) = vanillaToOMPLChunk(qs.middleRows(begin, n));
+	});
+	return ret;
+}
+
+ArrayOfStates
+UnitWorld::vanillaToOMPLChunk(const ArrayOfStates& qs) const
 {
 	static_assert(kStateDimension == 7, "Only support SE(3) for now");
 	int N = qs.rows();
@@ -614,17 +1113,9 @@ UnitWorld::translateVanillaStateToOMPLState(const ArrayOfStates& qs) const
 	ret.block(0, 3, N, 4) = qs.block(0, 3, N, 4);
 	// Get OMPL center
 	Eigen::Vector3d ompl_center = glm2Eigen(robot_->getOMPLCenter());
-	for (int i = 0; i < N; i++) {
-		// Vanilla state also uses w-last quaternion
-		// TODO: Generalize to multi-body
-		StateQuat rot(qs(i,6), qs(i,3), qs(i,4), qs(i,5));
-		// Eigen::Vector3d roo = rot.normalized().toRotationMatrix() * ompl_center;
-		Eigen::Vector3d roo = rot.normalized()._transformVector(ompl_center);
-		// ret.block(i, 0, 1, 3) = roo; <- this causes segfault
-		ret(i, 0) = qs(i,0) + roo(0);
-		ret(i, 1) = qs(i,1) + roo(1);
-		ret(i, 2) = qs(i,2) + roo(2);
-	}
+	// Vanilla state also uses w-last quaternion
+	// TODO: Generalize to multi-body
+	ret.leftCols<3>() = qs.leftCols<3>() + batch_rotate(wlastToQuats(qs), ompl_center);
 	return ret;
 }
 
@@ -637,7 +1128,17 @@ UnitWorld::translateVanillaStateToOMPLState(const ArrayOfStates& qs) const
  * t_{vanilla} = t_(ompl} - R_{ompl} O
  */
 ArrayOfStates
-UnitWorld::translateOMPLStateToVanillaState(const ArrayOfStates& qs) const
+UnitWorld::translateOMPLStateToVanillaState(const StatesRef& qs) const
+{
+	ArrayOfStates ret(qs.rows(), kStateDimension);
+	parallel_chunks(qs.rows(), [&](int begin, int n) {
+		ret.middleRows(begin, n) = omplToVanillaChunk(qs.middleRows(begin, n));
+	});
+	return ret;
+}
+
+ArrayOfStates
+UnitWorld::omplToVanillaChunk(const ArrayOfStates& qs) const
 {
 	static_assert(kStateDimension == 7, "Only support SE(3) for now");
 	int N = qs.rows();
@@ -647,47 +1148,54 @@ UnitWorld::translateOMPLStateToVanillaState(const ArrayOfStates& qs) const
 	van.block(0, 3, N, 4) = qs.block(0, 3, N, 4);
 	// Get OMPL center
 	Eigen::Vector3d ompl_center = glm2Eigen(robot_->getOMPLCenter());
-	for (int i = 0; i < N; i++) {
-		// Vanilla state also uses w-last quaternion
-		// TODO: Generalize to multi-body
-		StateQuat rot(qs(i,6), qs(i,3), qs(i,4), qs(i,5));
-		Eigen::Vector3d roo = rot.normalized()._transformVector(ompl_center);
-		van(i, 0) = qs(i,0) - roo(0);
-		van(i, 1) = qs(i,1) - roo(1);
-		van(i, 2) = qs(i,2) - roo(2);
-	}
+	// Vanilla state also uses w-last quaternion
+	// TODO: Generalize to multi-body
+	van.leftCols<3>() = qs.leftCols<3>() - batch_rotate(wlastToQuats(qs), ompl_center);
 	return van;
 }
 
 ArrayOfStates
-UnitWorld::translateVanillaStateToUnitState(ArrayOfStates qs) const
+UnitWorld::translateVanillaStateToUnitState(const StatesRef& qs) const
 {
-	return translateOMPLStateToUnitState(translateVanillaStateToOMPLState(qs));
+	ArrayOfStates ret(qs.rows(), kStateDimension);
+	parallel_chunks(qs.rows(), [&](int begin, int n) {
+		ret.middleRows(begin, n) = omplToUnitChunk(vanillaToOMPLChunk(qs.middleRows(begin, n)));
+	});
+	return ret;
 }
 
 Eigen::MatrixXd
 UnitWorld::translateVanillaPointsToUnitPoints(uint32_t geo,
-                                              const Eigen::MatrixXd& pts) const
+                                              const PointsRef& pts) const
 {
 	if (pts.rows() <= 0)
 		return Eigen::MatrixXd();
-	Eigen::MatrixXd afpts;
-	// std::cerr << "afpts " << afpts.rows() << " * " << afpts.cols() << std::endl;
-	if (geo == GEO_ENV) {
-		afpts = pts.block(0, 0, pts.rows(), 3);
-	} else {
-		auto oc = robot_->getOMPLCenter();
-		afpts = pts.block(0, 0, pts.rows(), 3).rowwise() - glm2Eigen(oc).transpose();
-	}
-	afpts.conservativeResize(afpts.rows(), 4);
-	afpts.col(3) = Eigen::VectorXd::Constant(afpts.rows(), 1.0);
-	Eigen::MatrixXd upts = (calib_mat_ * afpts.transpose()).transpose();
-	// std::cerr << "upts " << upts.rows() << " * " << upts.cols() << std::endl;
-	return upts.block(0, 0, pts.rows(), 3);
+	if (pts.cols() < 3)
+		throw std::runtime_error("translateVanillaPointsToUnitPoints: points need 3 columns");
+	Eigen::RowVector3d oc = Eigen::RowVector3d::Zero();
+	if (geo != GEO_ENV)
+		oc = glm2Eigen(robot_->getOMPLCenter()).transpose();
+	Eigen::Matrix3d rot_t = calib_mat_.topLeftCorner<3, 3>().transpose();
+	Eigen::RowVector3d trans = calib_mat_.topRightCorner<3, 1>().transpose();
+	Eigen::MatrixXd upts(pts.rows(), 3);
+	parallel_chunks(pts.rows(), [&](int begin, int n) {
+		upts.middleRows(begin, n) = ((pts.block(begin, 0, n, 3).rowwise() - oc) * rot_t).rowwise() + trans;
+	});
+	return upts;
+}
+
+ArrayOfStates
+UnitWorld::translateOMPLStateToUnitState(const StatesRef& qs) const
+{
+	ArrayOfStates ret(qs.rows(), kStateDimension);
+	parallel_chunks(qs.rows(), [&](int begin, int n) {
+		ret.middleRows(begin, n) = omplToUnitChunk(qs.middleRows(begin, n));
+	});
+	return ret;
 }
 
 ArrayOfStates
-UnitWorld::translateOMPLStateToUnitState(ArrayOfStates qs) const
+UnitWorld::omplToUnitChunk(ArrayOfStates qs) const
 {
 	int N = qs.rows();
 	Eigen::Matrix<double, -1, 4> wlast(N, 4);
@@ -697,17 +1205,13 @@ UnitWorld::translateOMPLStateToUnitState(ArrayOfStates qs) const
 	qs.col(3 + 2) = wlast.col(1);
 	qs.col(3 + 3) = wlast.col(2);
 
-	ArrayOfStates ret;
-	ret.resize(qs.rows(), qs.cols());
 	Eigen::Vector3d delta_center = glm2Eigen(robot_->getOMPLCenter() - robot_->getCenter());
 	delta_center *= scene_scale_;
-	for (int i = 0; i < N; i++) {
-		ret.row(i) = translateToUnitState(qs.row(i));
-		auto tup = decompose(ret.row(i).transpose());
-		Eigen::Vector3d t_prime = std::get<0>(tup) - std::get<1>(tup) * delta_center;
-		ret.row(i) = compose(t_prime, std::get<1>(tup));
-	}
-	return ret;
+	ArrayOfTrans trans;
+	ArrayOfQuats rots;
+	std::tie(trans, rots) = batch_decompose(translateToUnitStates(qs));
+	trans -= batch_rotate(rots, delta_center);
+	return batch_compose(trans, rots);
 }
 
 StateVector
@@ -743,11 +1247,8 @@ UnitWorld::calculateVisibilityMatrix(ArrayOfStates qs,
                                      double verify_magnitude)
 {
 	int N = qs.rows();
-	if (!is_unit_states) {
-#pragma omp parallel for
-		for (int i = 0; i < N; i++)
-			qs.row(i) = translateToUnitState(qs.row(i)).transpose();
-	}
+	if (!is_unit_states)
+		qs = translateToUnitStates(qs);
 	Eigen::Matrix<int8_t, -1, -1> ret;
 	ret.resize(N, N);
 #pragma omp parallel for
@@ -772,13 +1273,9 @@ UnitWorld::calculateVisibilityMatrix2(ArrayOfStates qs0,
 	int M = qs0.rows();
 	int N = qs1.rows();
 	if (!qs0_is_unit_states)
-#pragma omp parallel for if (enable_mt)
-		for (int i = 0; i < M; i++)
-			qs0.row(i) = translateToUnitState(qs0.row(i)).transpose();
+		qs0 = translateToUnitStates(qs0);
 	if (!qs1_is_unit_states)
-#pragma omp parallel for if (enable_mt)
-		for (int i = 0; i < N; i++)
-			qs1.row(i) = translateToUnitState(qs1.row(i)).transpose();
+		qs1 = translateToUnitStates(qs1);
 	Eigen::Matrix<int8_t, -1, -1> ret;
 	ret.resize(M, N);
 	std::atomic<int> prog(0);
@@ -796,6 +1293,83 @@ UnitWorld::calculateVisibilityMatrix2(ArrayOfStates qs0,
 	return ret;
 }
 
+Eigen::MatrixXd
+UnitWorld::calculateVisibilityMatrixTiled(ArrayOfStates qs0,
+                                          bool qs0_is_unit_states,
+                                          ArrayOfStates qs1,
+                                          bool qs1_is_unit_states,
+                                          double verify_magnitude,
+                                          const std::string& fn,
+                                          int tile_size,
+                                          bool enable_mt)
+{
+	const int M = qs0.rows();
+	const int N = qs1.rows();
+	// The states, their flags and the geometry (via the salt)
+	uint64_t input_hash = motionCacheSalt();
+	for (const auto* qs : { &qs0, &qs1 })
+		input_hash = MotionCache::hashBytes(qs->data(), qs->size() * sizeof(double), input_hash);
+	bool unit_flags[2] = { qs0_is_unit_states, qs1_is_unit_states };
+	input_hash = MotionCache::hashBytes(unit_flags, sizeof(unit_flags), input_hash);
+	VisibilityFile vf(fn, M, N, tile_size, verify_magnitude, input_hash);
+	const int TR = vf.nTileRows();
+	const int TC = vf.nTileCols();
+
+	std::vector<int> todo;
+	for (int t = 0; t < TR * TC; t++)
+		if (!vf.isTileDone(t))
+			todo.emplace_back(t);
+	std::cerr << "[Visibility] " << todo.size() << "/" << TR * TC
+	          << " tiles to calculate" << std::endl;
+	if (!todo.empty()) {
+		if (!qs0_is_unit_states)
+			qs0 = translateToUnitStates(qs0);
+		if (!qs1_is_unit_states)
+			qs1 = translateToUnitStates(qs1);
+	}
+
+	const int NT = todo.size();
+	const int report_every = std::max(1, NT / 100);
+	std::atomic<int> prog(0);
+#pragma omp parallel for if (enable_mt) schedule(dynamic, 1)
+	for (int k = 0; k < NT; k++) {
+		auto begin = std::chrono::steady_clock::now();
+		const int t = todo[k];
+		const int r0 = (t / TC) * tile_size;
+		const int c0 = (t % TC) * tile_size;
+		const int r1 = std::min(M, r0 + tile_size);
+		const int c1 = std::min(N, c0 + tile_size);
+		for (int fi = r0; fi < r1; fi++) {
+			uint8_t* row = vf.rowBits(fi);
+			// c0 is a multiple of 8, so this tile owns the bytes
+			for (int cb = c0; cb < c1; cb += 8) {
+				uint8_t bits = 0;
+				const int cend = std::min(c1, cb + 8);
+				for (int ti = cb; ti < cend; ti++)
+					if (isValidTransition(qs0.row(fi), qs1.row(ti), verify_magnitude))
+						bits |= uint8_t(1u << (ti - cb));
+				row[cb / 8] = bits;
+			}
+		}
+		std::chrono::duration<double> secs = std::chrono::steady_clock::now() - begin;
+		vf.markTileDone(t, secs.count());
+		int finished = ++prog;
+		if (finished % report_every == 0 || finished == NT) {
+			vf.sync();
+#pragma omp critical
+			std::cerr << "[Visibility] " << finished << "/" << NT
+			          << " tiles, last tile took " << secs.count() << "s"
+			          << std::endl;
+		}
+	}
+
+	Eigen::MatrixXd ret;
+	ret.resize(TR, TC);
+	for (int t = 0; t < TR * TC; t++)
+		ret(t / TC, t % TC) = vf.tileSeconds(t);
+	return ret;
+}
+
 Eigen::Matrix<int8_t, -1, 1>
 UnitWorld::calculateVisibilityPair(ArrayOfStates qs0,
                                    bool qs0_is_unit_states,
@@ -808,13 +1382,9 @@ UnitWorld::calculateVisibilityPair(ArrayOfStates qs0,
 	int N = qs1.rows();
 	int Max = std::max(M, N);
 	if (!qs0_is_unit_states)
-#pragma omp parallel for if (enable_mt)
-		for (int i = 0; i < M; i++)
-			qs0.row(i) = translateToUnitState(qs0.row(i)).transpose();
+		qs0 = translateToUnitStates(qs0);
 	if (!qs1_is_unit_states)
-#pragma omp parallel for if (enable_mt)
-		for (int i = 0; i < N; i++)
-			qs1.row(i) = translateToUnitState(qs1.row(i)).transpose();
+		qs1 = translateToUnitStates(qs1);
 	Eigen::Matrix<int8_t, -1, 1> ret;
 	ret.resize(Max, 1);
 	std::atomic<int> prog(0);
@@ -852,7 +1422,7 @@ UnitWorld::intersectionRegionSurfaceAreas(ArrayOfStates qs,
 
 	Transform envTf = std::get<0>(getCDTransforms(robot_state_));
 
-	CDModel::VMatrix env_V = (envTf * cd_scene_->vertices().transpose()).transpose();
+	CDModel::VMatrix env_V = transform_vertices(envTf, cd_scene_->vertices());
 	auto env_F = cd_scene_->faces();
 
 	auto rob_F = cd_robot_->faces();
@@ -860,7 +1430,7 @@ UnitWorld::intersectionRegionSurfaceAreas(ArrayOfStates qs,
 	for (int i = 0; i < Nq; i++) {
 		StateVector state = qsu.row(i).transpose();
 		Transform robTf = translate_state_to_transform(state);
-		CDModel::VMatrix rob_V = (robTf * cd_robot_->vertices().transpose()).transpose();
+		CDModel::VMatrix rob_V = transform_vertices(robTf, cd_robot_->vertices());
 
 		CDModel::VMatrix RV;
 		CDModel::FMatrix RF;
@@ -875,22 +1445,24 @@ UnitWorld::intersectionRegionSurfaceAreas(ArrayOfStates qs,
 	return ret;
 }
 
-// FIXME: too much duplicated code here
 std::tuple<UnitWorld::VMatrix, UnitWorld::FMatrix>
 UnitWorld::intersectingGeometry(const StateVector& q,
                                 bool q_is_unit)
 {
-	CDModel::VMatrix env_V, rob_V, RV;
-	CDModel::FMatrix env_F, rob_F, RF;
-	std::tie(env_V, env_F) = getSceneGeometry(q, q_is_unit);
-#if 1
-	std::tie(rob_V, rob_F) = getRobotGeometry(q, q_is_unit);
-	mesh_bool(env_V, env_F,
-	          rob_V, rob_F,
+	StateVector qu = q;
+	if (!q_is_unit)
+		qu = translateToUnitState(q);
+	Transform envTf, robTf;
+	std::tie(envTf, robTf) = getCDTransforms(qu);
+	CDModel::VMatrix env_V = transform_vertices(envTf, cd_scene_->vertices());
+	CDModel::VMatrix rob_V = transform_vertices(robTf, cd_robot_->vertices());
+	CDModel::VMatrix RV;
+	CDModel::FMatrix RF;
+	mesh_bool(env_V, cd_scene_->faces(),
+	          rob_V, cd_robot_->faces(),
 	          igl::MESH_BOOLEAN_TYPE_INTERSECT,
 	          RV, RF);
 	return std::make_tuple(RV, RF);
-#endif
 }
 
 #endif // PYOSR_HAS_MESHBOOL
@@ -899,16 +1471,12 @@ std::tuple<UnitWorld::VMatrix, UnitWorld::FMatrix>
 UnitWorld::getRobotGeometry(const StateVector& q,
                             bool q_is_unit) const
 {
-#if 1
 	StateVector qu = q;
 	if (!q_is_unit)
 		qu = translateToUnitState(q);
-	auto rob_F = cd_robot_->faces();
 	Transform robTf = translate_state_to_transform(qu);
-	CDModel::VMatrix rob_V = (robTf * cd_robot_->vertices().transpose()).transpose();
-
-	return std::make_tuple(rob_V, rob_F);
-#endif
+	return std::make_tuple(transform_vertices(robTf, cd_robot_->vertices()),
+	                       CDModel::FMatrix(cd_robot_->faces()));
 }
 
 std::tuple<UnitWorld::VMatrix, UnitWorld::FMatrix>
@@ -919,9 +1487,8 @@ UnitWorld::getSceneGeometry(const StateVector& q,
 	if (!q_is_unit)
 		qu = translateToUnitState(q);
 	Transform envTf = std::get<0>(getCDTransforms(qu));
-	CDModel::VMatrix env_V = (envTf * cd_scene_->vertices().transpose()).transpose();
-	auto env_F = cd_scene_->faces();
-	return std::make_tuple(env_V, env_F);
+	return std::make_tuple(transform_vertices(envTf, cd_scene_->vertices()),
+	                       CDModel::FMatrix(cd_scene_->faces()));
 }
 
 std::tuple<UnitWorld::FMatrix, UnitWorld::VMatrix>
@@ -977,40 +1544,86 @@ UnitWorld::intersectingSegments(StateVector unitq)
 #if 0
 	std::cerr << "debug: face pairs\n" << face_pairs << std::endl;
 #endif
-	CDModel::VMatrix env_V = (env_tf * cd_scene_->vertices().transpose()).transpose();
-	CDModel::VMatrix rob_V = (rob_tf * cd_robot_->vertices().transpose()).transpose();
-	auto env_F = cd_scene_->faces();
-	auto rob_F = cd_robot_->faces();
-	Eigen::Matrix<StateScalar, -1, 6> col_segs;
-	Eigen::Matrix<int, -1, 1> coplanars;
-	// NOTE: The (rob, env) order should be the same as calling
-	// CDModel::collideForDetails
-	tritri::TriTri(env_V, env_F,
-	               rob_V, rob_F,
-	               face_pairs,
-	               col_segs, coplanars);
-	int m = col_segs.rows();
-	ret_pos = col_segs.block(0, 0, m, 3);
-	ret_vec = col_segs.block(0, 3, m, 3);
-	ret_mag = (ret_vec - ret_pos).array().square().rowwise().sum().sqrt().matrix(); // L2 norm per row
-#if 0
-	ret_pos = 0.5 * (col_segs.block(0, 0, m, 3) + col_segs.block(0, 3, m, 3));
-	ret_vec = col_segs.block(0, 0, m, 3) - col_segs.block(0, 3, m, 3);
-	for (int i = 0; i < m; i++) {
-		// Face Normals (UNnormalized)
-		Eigen::Vector3i rob_face = rob_F.row(face_pairs(i, 0));
-		Eigen::Vector3i env_face = env_F.row(face_pairs(i, 0));
-		Eigen::Vector3d rob_fn = (rob_V.row(rob_face(1)) - rob_V.row(rob_face(0))).cross(rob_V.row(rob_face(2)) - rob_V.row(rob_face(0)));
-		Eigen::Vector3d env_fn = (env_V.row(env_face(1)) - env_V.row(env_face(0))).cross(env_V.row(env_face(2)) - env_V.row(env_face(0)));
-		// Rational: force should be orthogonal w.r.t. intersecting
-		// line segment and the robot's face normal (since robot is
-		// movable)
-		ret_vec.row(i) = rob_fn.cross(ret_vec.row(i)).normalized();
-	}
-#endif
+	int m = face_pairs.rows();
+	ret_pos.resize(m, Eigen::NoChange);
+	ret_vec.resize(m, Eigen::NoChange);
+	contactSegments(env_tf, rob_tf, face_pairs, ret_pos, ret_vec, 0);
+	ret_mag = (ret_vec - ret_pos).rowwise().norm();
 	return std::tie(ret_pos, ret_vec, ret_mag, face_pairs);
 }
 
+std::tuple<
+	ArrayOfPoints,
+	ArrayOfPoints,
+	Eigen::Matrix<StateScalar, -1, 1>,
+	Eigen::Matrix<int, -1, 2>,
+	Eigen::VectorXi
+>
+UnitWorld::multiIntersectingSegments(const ArrayOfStates& unitqs,
+                                     bool enable_mt) const
+{
+	const int N = unitqs.rows();
+	std::vector<Eigen::Matrix<int, -1, 2>> pairs(N);
+	std::vector<Transform> env_tfs(N), rob_tfs(N);
+	// FCL queries dominate, and their costs vary a lot
+#pragma omp parallel for if (enable_mt) schedule(dynamic, 4)
+	for (int i = 0; i < N; i++) {
+		std::tie(env_tfs[i], rob_tfs[i]) = getCDTransforms(unitqs.row(i));
+		if (!CDModel::collideForDetails(*cd_scene_, env_tfs[i], *cd_robot_, rob_tfs[i], pairs[i]))
+			pairs[i].resize(0, Eigen::NoChange);
+	}
+	Eigen::VectorXi offsets(N + 1);
+	offsets(0) = 0;
+	for (int i = 0; i < N; i++)
+		offsets(i + 1) = offsets(i) + int(pairs[i].rows());
+	const int M = offsets(N);
+	ArrayOfPoints ret_pos(M, 3), ret_vec(M, 3);
+	Eigen::Matrix<int, -1, 2> face_pairs(M, 2);
+#pragma omp parallel for if (enable_mt) schedule(dynamic, 16)
+	for (int i = 0; i < N; i++) {
+		if (pairs[i].rows() == 0)
+			continue;
+		face_pairs.middleRows(offsets(i), pairs[i].rows()) = pairs[i];
+		contactSegments(env_tfs[i], rob_tfs[i], pairs[i], ret_pos, ret_vec, offsets(i));
+	}
+	Eigen::Matrix<StateScalar, -1, 1> ret_mag = (ret_vec - ret_pos).rowwise().norm();
+	return std::make_tuple(ret_pos, ret_vec, ret_mag, face_pairs, offsets);
+}
+
+void
+UnitWorld::contactSegments(const Transform& env_tf,
+                           const Transform& rob_tf,
+                           const Eigen::Matrix<int, -1, 2>& face_pairs,
+                           ArrayOfPoints& begins,
+                           ArrayOfPoints& ends,
+                           int offset) const
+{
+	const auto env_V = cd_scene_->vertices();
+	const auto env_F = cd_scene_->faces();
+	const auto rob_V = cd_robot_->vertices();
+	const auto rob_F = cd_robot_->faces();
+	for (int i = 0; i < face_pairs.rows(); i++) {
+		// NOTE: The (env, rob) order follows CDModel::collideForDetails
+		Eigen::Vector3i ef = env_F.row(face_pairs(i, 0));
+		Eigen::Vector3i rf = rob_F.row(face_pairs(i, 1));
+		Eigen::Vector3d v0 = env_tf * Eigen::Vector3d(env_V.row(ef(0)));
+		Eigen::Vector3d v1 = env_tf * Eigen::Vector3d(env_V.row(ef(1)));
+		Eigen::Vector3d v2 = env_tf * Eigen::Vector3d(env_V.row(ef(2)));
+		Eigen::Vector3d u0 = rob_tf * Eigen::Vector3d(rob_V.row(rf(0)));
+		Eigen::Vector3d u1 = rob_tf * Eigen::Vector3d(rob_V.row(rf(1)));
+		Eigen::Vector3d u2 = rob_tf * Eigen::Vector3d(rob_V.row(rf(2)));
+		Eigen::Vector3d pt0 = Eigen::Vector3d::Zero();
+		Eigen::Vector3d pt1 = Eigen::Vector3d::Zero();
+		int coplanar;
+		tritri::TriTriIntersect(v0, v1, v2,
+		                        u0, u1, u2,
+		                        &coplanar,
+		                        pt0, pt1);
+		begins.row(offset + i) = pt0.transpose();
+		ends.row(offset + i) = pt1.transpose();
+	}
+}
+
 ArrayOfPoints
 UnitWorld::getRobotFaceNormalsFromIndices(const Eigen::Matrix<int, -1, 1>& faces)
 {
@@ -1056,16 +1669,25 @@ UnitWorld::forceDirectionFromIntersectingSegments(
 	return std::tie(ret_pos, ret_dir);
 }
 
+ArrayOfQuats
+UnitWorld::wlastToQuats(const ArrayOfStates& qs)
+{
+	ArrayOfQuats rots(qs.rows(), 4);
+	rots.col(0) = qs.col(6);
+	rots.col(1) = qs.col(3);
+	rots.col(2) = qs.col(4);
+	rots.col(3) = qs.col(5);
+	rots.rowwise().normalize();
+	return rots;
+}
+
 ArrayOfStates
 UnitWorld::ppToUnitStates(const ArrayOfStates& qs,
-                          bool qs_are_unit_states)
+                          bool qs_are_unit_states) const
 {
 	if (qs_are_unit_states)
 		return qs;
-	ArrayOfStates qsu(qs.rows(), qs.cols());
-	for (int i = 0; i < qs.rows(); i++)
-		qsu.row(i) = translateToUnitState(qs.row(i));
-	return qsu;
+	return translateToUnitStates(qs);
 }
 
 StateVector
@@ -1583,14 +2205,35 @@ UnitWorld::kineticEnergyDistance(const StateVector& q0,
 
 Eigen::VectorXd
 UnitWorld::multiKineticEnergyDistance(const StateVector& origin,
-                                      const ArrayOfStates& targets)
+                                      const StatesRef& targets) const
 {
-	Eigen::VectorXd ret;
-	const auto N = targets.rows();
-	ret.resize(N);
-	for (int i = 0; i < N; i++) {
-		ret(i) = kineticEnergyDistance(origin, targets.row(i));
-	}
+	StateTrans q0t;
+	StateQuat q0r;
+	std::tie(q0t, q0r) = decompose(origin);
+	const StateQuat inv = q0r.inverse();
+	const auto& robcd = *getCDModel(GEO_ROB);
+	const Eigen::Matrix3d I = robcd.inertiaTensorForCenter();
+	const double rot_scale = 4.0 / robcd.volume();
+	Eigen::VectorXd ret(targets.rows());
+	parallel_chunks(targets.rows(), [&](int begin, int n) {
+		ArrayOfTrans trans;
+		ArrayOfQuats rots;
+		std::tie(trans, rots) = batch_decompose(targets.middleRows(begin, n));
+		auto w = rots.col(0).array();
+		auto x = rots.col(1).array();
+		auto y = rots.col(2).array();
+		auto z = rots.col(3).array();
+		// vec() of dr = q1r * q0r^{-1}
+		Eigen::ArrayXd vx = w * inv.x() + inv.w() * x + (y * inv.z() - z * inv.y());
+		Eigen::ArrayXd vy = w * inv.y() + inv.w() * y + (z * inv.x() - x * inv.z());
+		Eigen::ArrayXd vz = w * inv.z() + inv.w() * z + (x * inv.y() - y * inv.x());
+		Eigen::ArrayXd rot = I(0, 0) * vx * vx + I(1, 1) * vy * vy + I(2, 2) * vz * vz
+		                   + (I(0, 1) + I(1, 0)) * vx * vy
+		                   + (I(0, 2) + I(2, 0)) * vx * vz
+		                   + (I(1, 2) + I(2, 1)) * vy * vz;
+		ret.segment(begin, n) = (trans.rowwise() - q0t.transpose()).rowwise().squaredNorm()
+		                        + (rot * rot_scale).matrix();
+	});
 	return ret;
 }
 
@@ -8,13 +8,17 @@
 
 #include <glm/mat4x4.hpp>
 
+#include <limits>
 #include <memory>
+#include <string>
 #include <tuple>
+#include <atomic>
 #include "osr_state.h"
 #include <stdint.h>
 
 namespace osr {
 class Scene;
+class MotionCache;
 class CDModel;
 struct OdeData;
 
@@ -26,6 +30,17 @@ public:
 	static const uint32_t GEO_ENV = 0;
 	static const uint32_t GEO_ROB = 1;
 
+	/*
+	 * Motion check modes used by transitStateTo* and isValidTransition
+	 *
+	 *      DISCRETE: check every verify_delta along the segment.
+	 *      CONSERVATIVE_ADVANCEMENT: step by clearance / motion bound,
+	 *              where the motion bound comes from the maximal radius
+	 *              of the robot. verify_delta is the minimal step.
+	 */
+	static const uint32_t MOTION_CHECK_DISCRETE = 0;
+	static const uint32_t MOTION_CHECK_CONSERVATIVE_ADVANCEMENT = 1;
+
 	void copyFrom(const UnitWorld*);
 	// Model, also known as Scene Geometry (commonly used in Renderer),
 	// or Environment Geometry (abbr. into "env" in Python code)
@@ -55,6 +70,45 @@ public:
 	bool isValid(const StateVector& state) const;
 	bool isDisentangled(const StateVector& state) const;
 
+	/*
+	 * Batched isValid
+	 *
+	 * Transforms of all states are calculated in one pass, and the
+	 * collision queries are distributed to the OpenMP thread pool.
+	 *
+	 * Return value: packed bit vector, isValid(qs.row(i)) is stored in
+	 *               the bit (i % 8) of byte (i / 8), i.e. the LSB first
+	 *               order (numpy.unpackbits(..., bitorder='little'))
+	 */
+	Eigen::Matrix<uint8_t, -1, 1>
+	isValidBatch(const ArrayOfStates& qs,
+	             bool qs_are_unit_states = true,
+	             bool enable_mt = true) const;
+
+	/*
+	 * Clearance of the robot at the given unit state, i.e. the minimal
+	 * distance between the robot and the environment, calculated by FCL
+	 * on the OBBRSS models.
+	 *
+	 * Colliding states return non-positive values. Note FCL does not
+	 * calculate penetration depth for meshes.
+	 *
+	 * threshold: early-out. The return value is min(clearance, threshold)
+	 *            and is much cheaper for queries like "clearance > eps".
+	 */
+	double
+	distanceToCollision(const StateVector& state,
+	                    double threshold = std::numeric_limits<double>::infinity()) const;
+
+	/*
+	 * Batched distanceToCollision, distributed to the OpenMP thread pool.
+	 */
+	Eigen::VectorXd
+	clearances(const ArrayOfStates& qs,
+	           bool qs_are_unit_states = true,
+	           double threshold = std::numeric_limits<double>::infinity(),
+	           bool enable_mt = true) const;
+
 	/*
 	 * State transition
 	 *
@@ -99,18 +153,59 @@ public:
 	//      4: first colliding/total length of trajectory
 	// Note: this function returns
 	//      a) (from, to, false, 0.0, 1.0) if verify_delta >= |from - to|
-	//      b) (to, to, true, 1.0, 1.0) if from -- to is collision-free.
+	//      b) (to, to, true, 1.0, 0.0) if from -- to is collision-free.
 	//           b.1) so do not use <1> without checking <2>
 	std::tuple<StateVector, StateVector, bool, float, float>
 	transitStateToWithContact(const StateVector& from,
 	                          const StateVector& to,
 	                          double verify_delta) const;
 
+	/*
+	 * Boolean-only motion check. Under MOTION_CHECK_DISCRETE the
+	 * discrete states are visited in bisection order, which is
+	 * identical to transitStateTo in result, but finds the collision
+	 * earlier on average.
+	 */
 	bool
 	isValidTransition(const StateVector& from,
 	                  const StateVector& to,
 	                  double initial_verify_delta) const;
 
+	/*
+	 * Counters of isValidTransition, returns
+	 *      0: number of discrete states checked
+	 *      1: number of discrete states skipped due to early exit
+	 */
+	std::tuple<uint64_t, uint64_t>
+	getMotionCheckCounters() const;
+	void resetMotionCheckCounters();
+
+	/*
+	 * Cache the results of isValidTransition and transitStateTo.
+	 *
+	 * Entries are keyed by the end points quantized by quantum, the
+	 * verify delta, the motion check mode, the collision backend, the
+	 * perturbation and the hash of the loaded geometry. Hence the
+	 * geometry must be loaded before enabling the cache.
+	 *
+	 * The geometry hash is updated whenever the collision models are
+	 * rebuilt or another model is loaded, so the cached results of the
+	 * previous geometry are never returned.
+	 *
+	 * If fn is not empty, a mmap'ed file with disk_slots slots is used
+	 * as the second tier, and the results are persistent across runs.
+	 *
+	 * The cache is shared with UnitWorld objects created by copyFrom.
+	 */
+	void enableMotionCache(size_t lru_capacity,
+	                       const std::string& fn = std::string(),
+	                       size_t disk_slots = 0,
+	                       double quantum = 1e-9);
+	void disableMotionCache();
+	// Returns: memory hits, disk hits, misses
+	std::tuple<uint64_t, uint64_t, uint64_t>
+	getMotionCacheStats() const;
+
 	std::tuple<StateVector, bool, float>
 	transitStateBy(const StateVector& from,
 	               const StateTrans& tr,
@@ -132,24 +227,31 @@ public:
 	 */
 	StateVector translateToUnitState(const StateVector& state) const;
 	StateVector translateFromUnitState(const StateVector& state) const;
+	// Batched versions of the above
+	ArrayOfStates translateToUnitStates(const ArrayOfStates& qs) const;
+	ArrayOfStates translateFromUnitStates(const ArrayOfStates& qs) const;
+	/*
+	 * The array translations below take row major Refs so numpy arrays
+	 * are passed without copying, and split the rows into chunks
+	 * translated in parallel. They are thread safe.
+	 */
 	// Translate an array of unit cube coordinate states to OMPL state
 	// Note: this is different from translateFromUnitState since OMPL has
 	//       fixed center, while our center can be overrided by
 	//       enforceRobotCenter.
-	ArrayOfStates translateUnitStateToOMPLState(const ArrayOfStates& qs,
+	ArrayOfStates translateUnitStateToOMPLState(const StatesRef& qs,
 	                                            bool to_angle_axis = false) const;
-	// Note: do not pass by const& because the implementation does need a copy
-	ArrayOfStates translateOMPLStateToUnitState(ArrayOfStates qs) const;
+	ArrayOfStates translateOMPLStateToUnitState(const StatesRef& qs) const;
 	// Translate the OMPL state to Vanillay State, which is the direct
 	// translation from the geometry's own coordinate system.
 	// Vanilla state also uses w-last format
-	ArrayOfStates translateVanillaStateToOMPLState(const ArrayOfStates& qs) const;
-	ArrayOfStates translateOMPLStateToVanillaState(const ArrayOfStates& qs) const;
+	ArrayOfStates translateVanillaStateToOMPLState(const StatesRef& qs) const;
+	ArrayOfStates translateOMPLStateToVanillaState(const StatesRef& qs) const;
 
-	ArrayOfStates translateVanillaStateToUnitState(ArrayOfStates qs) const;
+	ArrayOfStates translateVanillaStateToUnitState(const StatesRef& qs) const;
 
 	Eigen::MatrixXd translateVanillaPointsToUnitPoints(uint32_t geo,
-							   const Eigen::MatrixXd& pts) const;
+							   const PointsRef& pts) const;
 
 	StateVector applyPertubation(const StateVector& state) const;
 	StateVector unapplyPertubation(const StateVector& state) const;
@@ -168,6 +270,26 @@ public:
 	                           bool qs1_is_unit_states,
 	                           double verify_magnitude,
 				   bool enable_mt = true);
+	/*
+	 * Tiled and resumable calculateVisibilityMatrix2
+	 *
+	 * The M x N job is split into tile_size x tile_size blocks, which are
+	 * scheduled dynamically across threads. Finished tiles are streamed
+	 * to the bit-packed file fn (see VisibilityFile), and tiles finished
+	 * by a previous (interrupted) run with the same fn are skipped.
+	 *
+	 * Return value: seconds spent on each tile, in (tile row, tile col)
+	 * layout.
+	 */
+	Eigen::MatrixXd
+	calculateVisibilityMatrixTiled(ArrayOfStates qs0,
+	                               bool qs0_is_unit_states,
+	                               ArrayOfStates qs1,
+	                               bool qs1_is_unit_states,
+	                               double verify_magnitude,
+	                               const std::string& fn,
+	                               int tile_size = 256,
+	                               bool enable_mt = true);
 	Eigen::Matrix<int8_t, -1, 1>
 	calculateVisibilityPair(ArrayOfStates qs0,
 			        bool qs0_is_unit_states,
@@ -226,6 +348,20 @@ public:
 	>
 	intersectingSegments(StateVector unitq);
 
+	/*
+	 * Batched intersectingSegments. Segments of unitqs.row(i) are rows
+	 * [offsets(i), offsets(i+1)) of the returned arrays.
+	 */
+	std::tuple<
+		ArrayOfPoints, // Segment beginnings
+		ArrayOfPoints, // Segment ends
+		Eigen::Matrix<StateScalar, -1, 1>,                // Segment magnititudes
+		Eigen::Matrix<int, -1, 2>,                        // (env, rob) face indices
+		Eigen::VectorXi                                   // offsets
+	>
+	multiIntersectingSegments(const ArrayOfStates& unitqs,
+	                          bool enable_mt = true) const;
+
 	ArrayOfPoints
 	getRobotFaceNormalsFromIndices(const Eigen::Matrix<int, -1, 1>&);
 	ArrayOfPoints
@@ -332,13 +468,56 @@ public:
 		return recCres_;
 	}
 
+	void
+	setMotionCheckMode(uint32_t mode)
+	{
+		motion_check_mode_ = mode;
+	}
+
+	uint32_t
+	getMotionCheckMode() const
+	{
+		return motion_check_mode_;
+	}
+
+	/*
+	 * Select the backend of collision detection, see
+	 * CDModel::BACKEND_*.
+	 *
+	 * Takes effect on the loaded geometry and on the geometry loaded
+	 * afterwards.
+	 */
+	void setCollisionBackend(uint32_t backend);
+	uint32_t getCollisionBackend() const;
+
+	/*
+	 * Store the processed collision meshes and their FlatBVH in CDModel
+	 * images (see CDModel::saveImage) named <prefix>.env.cdimg and
+	 * <prefix>.rob.cdimg. Images are loaded by angleModel and copyFrom,
+	 * and created if missing or stale.
+	 *
+	 * An image only saves the FlatBVH construction and the mesh
+	 * processing of CDModel (normals, bounding box, inertia), and only
+	 * CDModel::BACKEND_FLAT_BVH collision checks run entirely on the
+	 * mapped data. Every process still
+	 *      a) imports the model files with Assimp;
+	 *      b) builds FCL's BVH on the first query that needs it, i.e.
+	 *         any query under CDModel::BACKEND_FCL (the default), and
+	 *         distance, conservative advancement and collideForDetails
+	 *         under any backend.
+	 *
+	 * Empty prefix (default) disables images.
+	 */
+	void setCDImagePrefix(const std::string& prefix);
+	std::string getCDImagePrefix() const;
+
 	double
 	kineticEnergyDistance(const StateVector& q0,
 	                      const StateVector& q1) const;
 
 	Eigen::VectorXd
 	multiKineticEnergyDistance(const StateVector& origin,
-	                           const ArrayOfStates& targets);
+	                           const StatesRef& targets) const;
 
 	double getSceneScale() const
 	{
@@ -364,7 +543,26 @@ protected:
 
 	// pp: PreProcess
 	ArrayOfStates ppToUnitStates(const ArrayOfStates& qs,
-	                             bool qs_are_unit_states);
+	                             bool qs_are_unit_states) const;
+	/*
+	 * Intersecting segments of the face pairs reported by
+	 * CDModel::collideForDetails, written to rows [offset, offset + #pairs)
+	 * of begins and ends. Only the triangles in face_pairs are
+	 * transformed.
+	 */
+	void contactSegments(const Transform& env_tf,
+	                     const Transform& rob_tf,
+	                     const Eigen::Matrix<int, -1, 2>& face_pairs,
+	                     ArrayOfPoints& begins,
+	                     ArrayOfPoints& ends,
+	                     int offset) const;
+	// Normalized W-first quaternions of w-last (OMPL/vanilla) states
+	static ArrayOfQuats wlastToQuats(const ArrayOfStates& qs);
+	// Single threaded kernels of the array translations, over SoA chunks
+	ArrayOfStates unitToOMPLChunk(const ArrayOfStates& qs, bool to_angle_axis) const;
+	ArrayOfStates omplToUnitChunk(ArrayOfStates qs) const;
+	ArrayOfStates vanillaToOMPLChunk(const ArrayOfStates& qs) const;
+	ArrayOfStates omplToVanillaChunk(const ArrayOfStates& qs) const;
 
 	std::unique_ptr<OdeData> ode_;
 
@@ -382,6 +580,45 @@ protected:
 	                Eigen::Vector3d *fn) const;
 
 	double recCres_;
+
+	uint32_t motion_check_mode_ = MOTION_CHECK_DISCRETE;
+	uint32_t collision_backend_ = 0; // CDModel::BACKEND_FCL
+
+	std::string cd_image_prefix_;
+	std::string model_fn_;
+	std::string robot_fn_;
+	std::shared_ptr<CDModel> createCDModel(uint32_t geo) const;
+
+	std::tuple<StateVector, StateVector, bool, float, float>
+	transitStateToWithCA(const StateVector& from,
+	                     const StateVector& to,
+	                     double verify_delta) const;
+
+	/*
+	 * Bit i of the return value is set if states[i] is in collision.
+	 * n must not exceed motionCheckPacketSize().
+	 */
+	uint64_t
+	collisionMask(const StateVector* states, int n) const;
+
+	/*
+	 * Number of states checked together by the motion checks.
+	 */
+	int
+	motionCheckPacketSize() const;
+
+	bool
+	isValidTransitionBisection(const StateVector& from,
+	                           const StateVector& to,
+	                           double verify_delta) const;
+
+	mutable std::atomic<uint64_t> mc_checked_states_{0};
+	mutable std::atomic<uint64_t> mc_skipped_states_{0};
+
+	std::shared_ptr<MotionCache> motion_cache_;
+	uint64_t geometry_hash_ = 0;
+	uint64_t motionCacheSalt() const;
+	void updateGeometryHash();
 };
 
 auto glm2Eigen(const glm::mat4& m);
@@ -0,0 +1,238 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "visibility_file.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+
+namespace osr {
+
+namespace {
+
+const char kMagic[8] = { 'O', 'S', 'R', 'V', 'I', 'S', '0', '2' };
+
+size_t align8(size_t off)
+{
+	return (off + 7) & ~size_t(7);
+}
+
+/*
+ * tile_size must be positive. total is SIZE_MAX if the layout overflows,
+ * which never matches the size of a file.
+ */
+struct Layout {
+	size_t n_tile_cols;
+	size_t n_tiles;
+	size_t row_stride;
+	size_t done_off;
+	size_t seconds_off;
+	size_t bits_off;
+	size_t total;
+
+	Layout(size_t rows, size_t cols, size_t tile_size)
+	{
+		size_t tr = rows / tile_size + (rows % tile_size != 0);
+		n_tile_cols = cols / tile_size + (cols % tile_size != 0);
+		row_stride = cols / 8 + (cols % 8 != 0);
+		done_off = sizeof(VisibilityFile::Header);
+		size_t seconds_size, bits_size;
+		bool overflow = __builtin_mul_overflow(tr, n_tile_cols, &n_tiles) ||
+		                __builtin_mul_overflow(n_tiles, sizeof(double), &seconds_size) ||
+		                __builtin_mul_overflow(rows, row_stride, &bits_size) ||
+		                n_tiles > SIZE_MAX / 4 || seconds_size > SIZE_MAX / 4 || bits_size > SIZE_MAX / 4;
+		if (overflow) {
+			n_tiles = 0;
+			seconds_off = bits_off = done_off;
+			total = SIZE_MAX;
+			return;
+		}
+		seconds_off = align8(done_off + n_tiles);
+		bits_off = align8(seconds_off + seconds_size);
+		total = bits_off + bits_size;
+	}
+};
+
+void throw_errno(const std::string& what, const std::string& fn)
+{
+	throw std::runtime_error(what + " " + fn + ": " + strerror(errno));
+}
+
+}
+
+VisibilityFile::VisibilityFile(const std::string& fn,
+                               size_t rows,
+                               size_t cols,
+                               size_t tile_size,
+                               double verify_magnitude,
+                               uint64_t input_hash)
+{
+	if (tile_size == 0 || tile_size % 8 != 0)
+		throw std::runtime_error("VisibilityFile: tile size must be a positive multiple of 8, got " + std::to_string(tile_size));
+	Layout layout(rows, cols, tile_size);
+	fd_ = ::open(fn.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd_ < 0)
+		throw_errno("Cannot open", fn);
+	auto fail = [this, &fn](const char* what) {
+		int err = errno;
+		::close(fd_);
+		errno = err;
+		throw_errno(what, fn);
+	};
+	struct stat st;
+	if (fstat(fd_, &st) < 0)
+		fail("Cannot stat");
+	bool resume = st.st_size > 0;
+	if (resume && size_t(st.st_size) != layout.total) {
+		::close(fd_);
+		throw std::runtime_error("VisibilityFile: size of existing file " + fn + " does not match");
+	}
+	if (!resume && ftruncate(fd_, layout.total) < 0)
+		fail("Cannot resize");
+	size_ = layout.total;
+	void* addr = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if (addr == MAP_FAILED)
+		fail("Cannot mmap");
+	base_ = static_cast<uint8_t*>(addr);
+	header_ = reinterpret_cast<Header*>(base_);
+	if (resume) {
+		bool match = memcmp(header_->magic, kMagic, sizeof(kMagic)) == 0 &&
+		             header_->rows == rows &&
+		             header_->cols == cols &&
+		             header_->tile_size == tile_size &&
+		             header_->verify_magnitude == verify_magnitude &&
+		             header_->input_hash == input_hash;
+		if (!match) {
+			munmap(base_, size_);
+			::close(fd_);
+			throw std::runtime_error("VisibilityFile: existing file " + fn + " was created with different arguments, states or geometry");
+		}
+	} else {
+		memcpy(header_->magic, kMagic, sizeof(kMagic));
+		header_->rows = rows;
+		header_->cols = cols;
+		header_->tile_size = tile_size;
+		header_->verify_magnitude = verify_magnitude;
+		header_->input_hash = input_hash;
+	}
+	setupPointers();
+}
+
+VisibilityFile::~VisibilityFile()
+{
+	if (base_) {
+		msync(base_, size_, MS_SYNC);
+		munmap(base_, size_);
+	}
+	if (fd_ >= 0)
+		::close(fd_);
+}
+
+void
+VisibilityFile::setupPointers()
+{
+	Layout layout(header_->rows, header_->cols, header_->tile_size);
+	done_ = base_ + layout.done_off;
+	seconds_ = reinterpret_cast<double*>(base_ + layout.seconds_off);
+	bits_ = base_ + layout.bits_off;
+	row_stride_ = layout.row_stride;
+	n_tile_rows_ = (header_->rows + header_->tile_size - 1) / header_->tile_size;
+	n_tile_cols_ = (header_->cols + header_->tile_size - 1) / header_->tile_size;
+}
+
+bool
+VisibilityFile::isTileDone(size_t tile) const
+{
+	return done_[tile] != 0;
+}
+
+double
+VisibilityFile::tileSeconds(size_t tile) const
+{
+	return seconds_[tile];
+}
+
+void
+VisibilityFile::markTileDone(size_t tile, double seconds)
+{
+	seconds_[tile] = seconds;
+	// The done mark must not be visible before the bits of the tile
+	std::atomic_thread_fence(std::memory_order_release);
+	done_[tile] = 1;
+}
+
+uint8_t*
+VisibilityFile::rowBits(size_t row)
+{
+	return bits_ + row * row_stride_;
+}
+
+void
+VisibilityFile::sync(bool async)
+{
+	msync(base_, size_, async ? MS_ASYNC : MS_SYNC);
+}
+
+Eigen::Matrix<int8_t, -1, -1>
+VisibilityFile::readRows(const std::string& fn, size_t begin, size_t end, bool allow_unfinished)
+{
+	int fd = ::open(fn.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw_errno("Cannot open", fn);
+	struct stat st;
+	if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(Header)) {
+		::close(fd);
+		throw std::runtime_error("VisibilityFile: " + fn + " is not a visibility file");
+	}
+	void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (addr == MAP_FAILED)
+		throw_errno("Cannot mmap", fn);
+	const uint8_t* base = static_cast<const uint8_t*>(addr);
+	const Header* header = reinterpret_cast<const Header*>(base);
+	auto fail = [&](const std::string& why) {
+		munmap(addr, st.st_size);
+		throw std::runtime_error("VisibilityFile: " + fn + " " + why);
+	};
+	if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0)
+		fail("is not a visibility file");
+	// Same requirements as the constructor
+	const size_t tile_size = header->tile_size;
+	if (tile_size == 0 || tile_size % 8 != 0)
+		fail("has an invalid tile size " + std::to_string(tile_size));
+	Layout layout(header->rows, header->cols, tile_size);
+	if (size_t(st.st_size) != layout.total)
+		fail("is truncated or does not match its header");
+	end = std::min<size_t>(end, header->rows);
+	begin = std::min(begin, end);
+	const size_t cols = header->cols;
+	const uint8_t* done = base + layout.done_off;
+	Eigen::Matrix<int8_t, -1, -1> ret;
+	ret.resize(end - begin, cols);
+	for (size_t r = begin; r < end; r++) {
+		const uint8_t* row = base + layout.bits_off + r * layout.row_stride;
+		const uint8_t* row_done = done + (r / tile_size) * layout.n_tile_cols;
+		for (size_t c = 0; c < cols; c++) {
+			if (row_done[c / tile_size]) {
+				ret(r - begin, c) = (row[c / 8] >> (c % 8)) & 1;
+			} else if (allow_unfinished) {
+				ret(r - begin, c) = -1;
+			} else {
+				fail("has unfinished tiles in rows [" + std::to_string(begin) +
+				     ", " + std::to_string(end) + ")");
+			}
+		}
+	}
+	munmap(addr, st.st_size);
+	return ret;
+}
+
+}
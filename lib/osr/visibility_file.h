@@ -0,0 +1,102 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef OSR_VISIBILITY_FILE_H
+#define OSR_VISIBILITY_FILE_H
+
+#include <string>
+#include <stdint.h>
+#include <Eigen/Core>
+
+namespace osr {
+
+/*
+ * Bit-packed visibility matrix stored in a memory mapped file, with per-tile
+ * checkpoints so an interrupted calculation can be resumed.
+ *
+ * Layout:
+ *      Header
+ *      uint8_t tile_done[n_tiles]
+ *      double  tile_seconds[n_tiles]           (aligned to 8 bytes)
+ *      uint8_t bits[rows][row_stride]          (aligned to 8 bytes)
+ *
+ * row_stride = ceil(cols / 8). Bit (col % 8) of bits[row][col / 8] stores
+ * entry (row, col), i.e. LSB first.
+ *
+ * Tiles are tile_size x tile_size blocks in row-major order. tile_size must
+ * be a multiple of 8 so tiles never share bytes.
+ */
+class VisibilityFile {
+public:
+	struct Header {
+		char magic[8];
+		uint64_t rows;
+		uint64_t cols;
+		uint64_t tile_size;
+		double verify_magnitude;
+		uint64_t input_hash;
+	};
+
+	/*
+	 * Create fn, or open it for resuming if it exists. Throws if the
+	 * existing file does not match the arguments.
+	 *
+	 * input_hash identifies everything else the bits depend on (e.g. the
+	 * states and the geometry), so tiles of a different job of the same
+	 * shape are never reused.
+	 */
+	VisibilityFile(const std::string& fn,
+	               size_t rows,
+	               size_t cols,
+	               size_t tile_size,
+	               double verify_magnitude,
+	               uint64_t input_hash);
+	~VisibilityFile();
+
+	size_t nTileRows() const { return n_tile_rows_; }
+	size_t nTileCols() const { return n_tile_cols_; }
+	size_t nTiles() const { return n_tile_rows_ * n_tile_cols_; }
+	size_t tileSize() const { return header_->tile_size; }
+
+	bool isTileDone(size_t tile) const;
+	double tileSeconds(size_t tile) const;
+	/*
+	 * Mark the tile as finished, the bits of this tile must be written
+	 * before calling this function.
+	 */
+	void markTileDone(size_t tile, double seconds);
+
+	uint8_t* rowBits(size_t row);
+
+	void sync(bool async = true);
+
+	/*
+	 * Read rows [begin, end) of a visibility file into a dense matrix.
+	 *
+	 * Throws if the file is truncated or any entry in these rows belongs
+	 * to an unfinished tile. With allow_unfinished, such entries are -1
+	 * instead.
+	 */
+	static Eigen::Matrix<int8_t, -1, -1>
+	readRows(const std::string& fn, size_t begin, size_t end,
+	         bool allow_unfinished = false);
+private:
+	int fd_ = -1;
+	uint8_t* base_ = nullptr;
+	size_t size_ = 0;
+	Header* header_ = nullptr;
+	uint8_t* done_ = nullptr;
+	double* seconds_ = nullptr;
+	uint8_t* bits_ = nullptr;
+	size_t row_stride_ = 0;
+	size_t n_tile_rows_ = 0;
+	size_t n_tile_cols_ = 0;
+
+	void setupPointers();
+};
+
+}
+
+#endif
@@ -33,6 +33,30 @@ PYBIND11_MODULE(pycutec2, m) {
 	m.def("line_segments_intersect_with_mesh",
 	      &pycutec2::line_segments_intersect_with_mesh,
 	      "batch version of line_segment_intersect_with_mesh");
+	py::class_<pycutec2::SegmentIndex>(m, "SegmentIndex")
+		.def(py::init<Eigen::Ref<const pycutec2::RowMatrixXd>,
+		              Eigen::Ref<const pycutec2::RowMatrixXi>>(),
+		     py::arg("V"),
+		     py::arg("E"))
+		.def("__len__", &pycutec2::SegmentIndex::numberOfEdges)
+		.def("first_hit", &pycutec2::SegmentIndex::firstHit,
+		     "Closest intersection along the segment from -> to, as (hit, tau, elem, elem_tau)",
+		     py::arg("from"),
+		     py::arg("to"),
+		     py::call_guard<py::gil_scoped_release>())
+		.def("first_hits", &pycutec2::SegmentIndex::firstHits,
+		     "batch version of first_hit",
+		     py::arg("inV"),
+		     py::arg("inE"),
+		     py::arg("enable_mt") = true,
+		     py::call_guard<py::gil_scoped_release>())
+		.def("all_hits", &pycutec2::SegmentIndex::allHits,
+		     "All intersections of each segment in CSR form (offsets, elems, taus, elem_taus), sorted by tau",
+		     py::arg("inV"),
+		     py::arg("inE"),
+		     py::arg("enable_mt") = true,
+		     py::call_guard<py::gil_scoped_release>())
+		;
 	m.def("build_mesh_2d",
 	      pycutec2::build_mesh_2d);
 	m.def("save_obj_1",
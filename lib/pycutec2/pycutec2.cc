@@ -5,9 +5,45 @@
  */
 #include "pycutec2.h"
 #include <Eigen/Dense>
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <string>
 
 namespace pycutec2 {
 
+namespace {
+
+//
+// Closed-form solution of
+//     sfrom + tau_e * (sto - sfrom) = from + tau_s * (to - from)
+// Returns true if both taus are in [0, 1]
+//
+inline bool
+intersect_segments(const Eigen::Vector2d& from,
+                   const Eigen::Vector2d& to,
+                   const Eigen::Vector2d& sfrom,
+                   const Eigen::Vector2d& sto,
+                   double& tau_s,
+                   double& tau_e)
+{
+	Eigen::Vector2d a = sto - sfrom;
+	Eigen::Vector2d b = from - to;
+	Eigen::Vector2d r = from - sfrom;
+	double det = a(0) * b(1) - a(1) * b(0);
+	if (det == 0)
+		return false;
+	tau_e = (r(0) * b(1) - r(1) * b(0)) / det;
+	tau_s = (a(0) * r(1) - a(1) * r(0)) / det;
+	if (tau_e < 0 || tau_e > 1.0)
+		return false;
+	if (tau_s < 0 || tau_s > 1.0)
+		return false;
+	return true;
+}
+
+}
+
 std::tuple<bool, double, int, double>
 line_segment_intersect_with_mesh(Eigen::Vector2d from,
                                  Eigen::Vector2d to,
@@ -23,24 +59,14 @@ line_segment_intersect_with_mesh(Eigen::Vector2d from,
 		int ti = E(i, 1);
 		Eigen::Vector2d sfrom = V.row(fi).segment<2>(0);
 		Eigen::Vector2d sto = V.row(ti).segment<2>(0);
-		Eigen::Matrix2d A;
-		A.col(0) = sto - sfrom;
-		A.col(1) = from - to;
-		Eigen::Vector2d b;
-		b = from - sfrom;
-		// Solve A * tau = b
-		if (A.determinant() == 0)
-			continue;
-		Eigen::Vector2d tau = A.fullPivLu().solve(b);
-		if (tau(0) < 0 || tau(0) > 1.0)
-			continue;
-		if (tau(1) < 0 || tau(1) > 1.0)
+		double tau_s, tau_e;
+		if (!intersect_segments(from, to, sfrom, sto, tau_s, tau_e))
 			continue;
 		hit = true;
-		if (tau(0) < tau0) {
-			tau0 = tau(0);
+		if (tau_e < tau0) {
+			tau0 = tau_e;
 			hit_id = i;
-			tau1 = tau(1);
+			tau1 = tau_s;
 		}
 	}
 	return std::make_tuple(hit, tau0, hit_id, tau1);
@@ -57,6 +83,7 @@ line_segments_intersect_with_mesh(Eigen::Ref<const RowMatrixXd> inV,
        	Eigen::VectorXd rettau1(N);
 	Eigen::VectorXi retelem(N);
 	Eigen::VectorXd rettau2(N);
+#pragma omp parallel for schedule(dynamic, 64)
 	for (int i = 0; i < inE.rows(); i++) {
 		auto tup = line_segment_intersect_with_mesh(inV.row(inE(i, 0)),
 				                            inV.row(inE(i, 1)),
@@ -70,4 +97,225 @@ line_segments_intersect_with_mesh(Eigen::Ref<const RowMatrixXd> inV,
 	return std::make_tuple(retbool, rettau1, retelem, rettau2);
 }
 
+namespace {
+
+struct FirstHitVisitor {
+	double tau = std::numeric_limits<double>::infinity();
+	int elem = -1;
+	double elem_tau = 2.0;
+
+	double bound() const { return tau; }
+
+	void visit(int e, double tau_s, double tau_e)
+	{
+		if (tau_s < tau || (tau_s == tau && e < elem)) {
+			tau = tau_s;
+			elem = e;
+			elem_tau = tau_e;
+		}
+	}
+};
+
+template<typename Hit>
+struct AllHitsVisitor {
+	std::vector<Hit>& hits;
+
+	double bound() const { return 1.0; }
+
+	void visit(int e, double tau_s, double tau_e)
+	{
+		hits.push_back(Hit{tau_s, e, tau_e});
+	}
+};
+
+}
+
+SegmentIndex::SegmentIndex(Eigen::Ref<const RowMatrixXd> V,
+                           Eigen::Ref<const RowMatrixXi> E)
+{
+	if (V.cols() < 2 || E.cols() < 2)
+		throw std::runtime_error("SegmentIndex: V needs at least 2 columns and E needs 2 columns");
+	if (E.size() > 0 && (E.leftCols<2>().minCoeff() < 0 || E.leftCols<2>().maxCoeff() >= V.rows()))
+		throw std::runtime_error("SegmentIndex: E refers to vertices out of the " +
+		                         std::to_string(V.rows()) + " vertices");
+	V_ = V.leftCols<2>();
+	E_ = E.leftCols<2>();
+	order_.resize(E_.rows());
+	for (int i = 0; i < E_.rows(); i++)
+		order_[i] = i;
+	if (E_.rows() > 0)
+		build(0, E_.rows());
+}
+
+int
+SegmentIndex::build(int begin, int end)
+{
+	constexpr int kLeafSize = 4;
+	int index = int(nodes_.size());
+	nodes_.emplace_back();
+	Node node;
+	node.lo.setConstant(std::numeric_limits<double>::infinity());
+	node.hi.setConstant(-std::numeric_limits<double>::infinity());
+	Eigen::Vector2d clo = node.lo;
+	Eigen::Vector2d chi = node.hi;
+	for (int i = begin; i < end; i++) {
+		Eigen::Vector2d a = V_.row(E_(order_[i], 0)).transpose();
+		Eigen::Vector2d b = V_.row(E_(order_[i], 1)).transpose();
+		node.lo = node.lo.cwiseMin(a).cwiseMin(b);
+		node.hi = node.hi.cwiseMax(a).cwiseMax(b);
+		clo = clo.cwiseMin(0.5 * (a + b));
+		chi = chi.cwiseMax(0.5 * (a + b));
+	}
+	node.axis = 0;
+	if (end - begin <= kLeafSize) {
+		node.first = begin;
+		node.count = end - begin;
+		nodes_[index] = node;
+		return index;
+	}
+	int axis;
+	(chi - clo).maxCoeff(&axis);
+	auto center = [this, axis](int e) -> double {
+		return V_(E_(e, 0), axis) + V_(E_(e, 1), axis);
+	};
+	int mid = begin + (end - begin) / 2;
+	std::nth_element(order_.begin() + begin, order_.begin() + mid, order_.begin() + end,
+	                 [&center](int a, int b) { return center(a) < center(b); });
+	node.axis = axis;
+	node.count = 0;
+	build(begin, mid);
+	node.first = build(mid, end);
+	nodes_[index] = node;
+	return index;
+}
+
+template<typename Visitor>
+void
+SegmentIndex::traverse(const Eigen::Vector2d& from,
+                       const Eigen::Vector2d& to,
+                       Visitor& visitor) const
+{
+	if (nodes_.empty())
+		return;
+	Eigen::Vector2d d = to - from;
+	std::vector<int> stack(1, 0);
+	while (!stack.empty()) {
+		int index = stack.back();
+		stack.pop_back();
+		const Node& node = nodes_[index];
+		// Slab test of the segment, clipped by the bound of the visitor
+		double tnear = 0.0;
+		double tfar = visitor.bound();
+		for (int a = 0; a < 2; a++) {
+			if (d(a) == 0) {
+				if (from(a) < node.lo(a) || from(a) > node.hi(a))
+					tnear = std::numeric_limits<double>::infinity();
+				continue;
+			}
+			double t0 = (node.lo(a) - from(a)) / d(a);
+			double t1 = (node.hi(a) - from(a)) / d(a);
+			tnear = std::max(tnear, std::min(t0, t1));
+			tfar = std::min(tfar, std::max(t0, t1));
+		}
+		if (tnear > tfar)
+			continue;
+		if (node.count > 0) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				int e = order_[i];
+				double tau_s, tau_e;
+				if (intersect_segments(from, to,
+				                       V_.row(E_(e, 0)).transpose(),
+				                       V_.row(E_(e, 1)).transpose(),
+				                       tau_s, tau_e))
+					visitor.visit(e, tau_s, tau_e);
+			}
+			continue;
+		}
+		// Visit the nearer child first
+		if (d(node.axis) < 0) {
+			stack.emplace_back(index + 1);
+			stack.emplace_back(node.first);
+		} else {
+			stack.emplace_back(node.first);
+			stack.emplace_back(index + 1);
+		}
+	}
+}
+
+std::tuple<bool, double, int, double>
+SegmentIndex::firstHit(const Eigen::Vector2d& from,
+                       const Eigen::Vector2d& to) const
+{
+	FirstHitVisitor visitor;
+	traverse(from, to, visitor);
+	if (visitor.elem < 0)
+		return std::make_tuple(false, 2.0, -1, 2.0);
+	return std::make_tuple(true, visitor.tau, visitor.elem, visitor.elem_tau);
+}
+
+void
+SegmentIndex::collect(const Eigen::Vector2d& from,
+                      const Eigen::Vector2d& to,
+                      std::vector<Hit>& hits) const
+{
+	hits.clear();
+	AllHitsVisitor<Hit> visitor{hits};
+	traverse(from, to, visitor);
+	std::sort(hits.begin(), hits.end(), [](const Hit& a, const Hit& b) {
+		return a.tau < b.tau || (a.tau == b.tau && a.elem < b.elem);
+	});
+}
+
+std::tuple<Eigen::VectorXi, Eigen::VectorXd, Eigen::VectorXi, Eigen::VectorXd>
+SegmentIndex::firstHits(Eigen::Ref<const RowMatrixXd> inV,
+                        Eigen::Ref<const RowMatrixXi> inE,
+                        bool enable_mt) const
+{
+	int N = inE.rows();
+	Eigen::VectorXi retbool(N);
+	Eigen::VectorXd rettau1(N);
+	Eigen::VectorXi retelem(N);
+	Eigen::VectorXd rettau2(N);
+#pragma omp parallel for if (enable_mt) schedule(dynamic, 256)
+	for (int i = 0; i < N; i++) {
+		auto tup = firstHit(inV.row(inE(i, 0)).segment<2>(0).transpose(),
+		                    inV.row(inE(i, 1)).segment<2>(0).transpose());
+		retbool(i) = std::get<0>(tup);
+		rettau1(i) = std::get<1>(tup);
+		retelem(i) = std::get<2>(tup);
+		rettau2(i) = std::get<3>(tup);
+	}
+	return std::make_tuple(retbool, rettau1, retelem, rettau2);
+}
+
+std::tuple<Eigen::VectorXi, Eigen::VectorXi, Eigen::VectorXd, Eigen::VectorXd>
+SegmentIndex::allHits(Eigen::Ref<const RowMatrixXd> inV,
+                      Eigen::Ref<const RowMatrixXi> inE,
+                      bool enable_mt) const
+{
+	int N = inE.rows();
+	std::vector<std::vector<Hit>> results(N);
+#pragma omp parallel for if (enable_mt) schedule(dynamic, 256)
+	for (int i = 0; i < N; i++)
+		collect(inV.row(inE(i, 0)).segment<2>(0).transpose(),
+		        inV.row(inE(i, 1)).segment<2>(0).transpose(),
+		        results[i]);
+
+	Eigen::VectorXi offsets(N + 1);
+	offsets(0) = 0;
+	for (int i = 0; i < N; i++)
+		offsets(i + 1) = offsets(i) + int(results[i].size());
+	Eigen::VectorXi elems(offsets(N));
+	Eigen::VectorXd taus(offsets(N));
+	Eigen::VectorXd elem_taus(offsets(N));
+	for (int i = 0; i < N; i++) {
+		for (size_t j = 0; j < results[i].size(); j++) {
+			elems(offsets(i) + j) = results[i][j].elem;
+			taus(offsets(i) + j) = results[i][j].tau;
+			elem_taus(offsets(i) + j) = results[i][j].elem_tau;
+		}
+	}
+	return std::make_tuple(offsets, elems, taus, elem_taus);
+}
+
 }
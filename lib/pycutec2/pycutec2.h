@@ -8,6 +8,7 @@
 
 #include <Eigen/Core>
 #include <tuple>
+#include <vector>
 
 namespace pycutec2 {
 using RowMatrixXd = Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>;
@@ -33,6 +34,80 @@ line_segments_intersect_with_mesh(Eigen::Ref<const RowMatrixXd> inV,
                                   Eigen::Ref<const RowMatrixXd> obV,
                                   Eigen::Ref<const RowMatrixXi> obE);
 
+//
+// Segment-mesh intersection engine.
+//
+// The edges (V, E) of the mesh are indexed by a BVH of 2D bounding boxes,
+// which is built once in the constructor. Only the first two columns of V
+// are used, so the 3D output of build_mesh_2d is also accepted.
+//
+// Queries are const and batched queries are parallelized with OpenMP.
+//
+// Unlike line_segment_intersect_with_mesh, which keeps the hit with the
+// smallest tau along the mesh edge, the first hit here is the closest one
+// to the beginning of the query segment. Ties go to the lower edge index.
+//
+class SegmentIndex {
+public:
+	SegmentIndex(Eigen::Ref<const RowMatrixXd> V,
+	             Eigen::Ref<const RowMatrixXi> E);
+
+	int numberOfEdges() const { return int(E_.rows()); }
+
+	//
+	// Return Value
+	//   0: True = intersecting, False = Not
+	//   1: intersecting tau (in [0,1]) of the (from, to) line segment
+	//   2: intersecting element of the mesh, -1 if not intersecting
+	//   3: intersecting tau of the element
+	//
+	std::tuple<bool, double, int, double>
+	firstHit(const Eigen::Vector2d& from,
+	         const Eigen::Vector2d& to) const;
+
+	// Batch version of firstHit for segments (inV, inE)
+	std::tuple<Eigen::VectorXi, Eigen::VectorXd, Eigen::VectorXi, Eigen::VectorXd>
+	firstHits(Eigen::Ref<const RowMatrixXd> inV,
+	          Eigen::Ref<const RowMatrixXi> inE,
+	          bool enable_mt = true) const;
+
+	//
+	// All hits of segments (inV, inE) in CSR form. The hits of segment i
+	// are [offsets(i), offsets(i+1)) of elements, taus and element_taus,
+	// sorted by taus.
+	//
+	std::tuple<Eigen::VectorXi, Eigen::VectorXi, Eigen::VectorXd, Eigen::VectorXd>
+	allHits(Eigen::Ref<const RowMatrixXd> inV,
+	        Eigen::Ref<const RowMatrixXi> inE,
+	        bool enable_mt = true) const;
+private:
+	struct Node {
+		Eigen::Vector2d lo, hi;
+		int first;  // leaf: first item of order_; internal: right child
+		int count;  // leaf: number of edges; internal: 0
+		int axis;   // internal: split axis
+	};
+	struct Hit {
+		double tau;
+		int elem;
+		double elem_tau;
+	};
+
+	Eigen::Matrix<double, -1, 2, Eigen::RowMajor> V_;
+	Eigen::Matrix<int, -1, 2, Eigen::RowMajor> E_;
+	std::vector<int> order_;
+	std::vector<Node> nodes_;
+
+	int build(int begin, int end);
+	template<typename Visitor>
+	void traverse(const Eigen::Vector2d& from,
+	              const Eigen::Vector2d& to,
+	              Visitor& visitor) const;
+	void collect(const Eigen::Vector2d& from,
+	             const Eigen::Vector2d& to,
+	             std::vector<Hit>& hits) const;
+};
+
 std::tuple<
 	Eigen::MatrixXd, // Grid V (in 3D with Z == 0.0)
 	Eigen::MatrixXi  // Grid E
@@ -6,12 +6,18 @@
 #include <osr/osr_state.h>
 #include <osr/osr_util.h>
 #include <osr/unit_world.h>
+#include <osr/cdmodel.h>
 #include <osr/osr_render.h>
+#include <osr/osr_cpu_render.h>
 #include <osr/osr_init.h>
 #include <osr/gtgenerator.h>
+#include <osr/se3_knn.h>
+#include <osr/visibility_file.h>
+#include <vecio/roadmap.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/eigen.h>
 #include <iostream>
+#include <limits>
 #include <stdint.h>
 namespace py = pybind11;
 
@@ -86,6 +92,25 @@ PYBIND11_PLUGIN(pyosr) {
 	      "Calculate the distance between two unit states");
 	m.def("multi_distance", &osr::multi_distance,
 	      "Calculate distances of one-vs-many.");
+	m.def("batch_distance", &osr::batch_distance,
+	      py::arg("lhs"),
+	      py::arg("rhs"),
+	      "Calculate distances between corresponding rows",
+	      py::call_guard<py::gil_scoped_release>());
+	m.def("batch_interpolate",
+	      py::overload_cast<const osr::ArrayOfStates&, const osr::ArrayOfStates&, const Eigen::VectorXd&>(&osr::batch_interpolate),
+	      py::arg("from"),
+	      py::arg("to"),
+	      py::arg("taus"),
+	      "Interpolate between corresponding rows, with per-row tau",
+	      py::call_guard<py::gil_scoped_release>());
+	m.def("batch_interpolate",
+	      py::overload_cast<const osr::ArrayOfStates&, const osr::ArrayOfStates&, osr::StateScalar>(&osr::batch_interpolate),
+	      py::arg("from"),
+	      py::arg("to"),
+	      py::arg("tau"),
+	      "Interpolate between corresponding rows, with a shared tau",
+	      py::call_guard<py::gil_scoped_release>());
 	m.def("differential", &osr::differential,
 	      "Calculate the action from one unit state to another", py::call_guard<py::gil_scoped_release>());
 	m.def("multi_differential", &osr::multi_differential,
@@ -123,6 +148,13 @@ PYBIND11_PLUGIN(pyosr) {
 	m.attr("MESH_BOOL_XOR") = py::int_(osr::MESH_BOOL_XOR);
 	m.attr("MESH_BOOL_RESOLVE") = py::int_(osr::MESH_BOOL_RESOLVE);
 	m.def("tritri_cop", &osr::tritriCop);
+	m.def("read_visibility_file_rows", &osr::VisibilityFile::readRows,
+	      "Read rows [begin, end) of the file written by calculate_visibility_matrix_tiled",
+	      py::arg("fn"),
+	      py::arg("begin"),
+	      py::arg("end"),
+	      py::arg("allow_unfinished") = false,
+	      py::call_guard<py::gil_scoped_release>());
 	using osr::UnitWorld;
 	py::class_<UnitWorld>(m, "UnitWorld")
 		.def(py::init<>())
@@ -137,6 +169,21 @@ PYBIND11_PLUGIN(pyosr) {
 		.def_property("state", &UnitWorld::getRobotState, &UnitWorld::setRobotState)
 		.def("is_valid_state", &UnitWorld::isValid, py::call_guard<py::gil_scoped_release>())
 		.def("is_disentangled", &UnitWorld::isDisentangled, py::call_guard<py::gil_scoped_release>())
+		.def("is_valid_states", &UnitWorld::isValidBatch,
+		     py::arg("qs"),
+		     py::arg("qs_are_unit_states") = true,
+		     py::arg("enable_mt") = true,
+		     py::call_guard<py::gil_scoped_release>())
+		.def("distance_to_collision", &UnitWorld::distanceToCollision,
+		     py::arg("state"),
+		     py::arg("threshold") = std::numeric_limits<double>::infinity(),
+		     py::call_guard<py::gil_scoped_release>())
+		.def("clearances", &UnitWorld::clearances,
+		     py::arg("qs"),
+		     py::arg("qs_are_unit_states") = true,
+		     py::arg("threshold") = std::numeric_limits<double>::infinity(),
+		     py::arg("enable_mt") = true,
+		     py::call_guard<py::gil_scoped_release>())
 		.def("transit_state", &UnitWorld::transitState, py::call_guard<py::gil_scoped_release>())
 		.def("transit_state_to", &UnitWorld::transitStateTo,
 		     py::arg("from"),
@@ -153,18 +200,40 @@ PYBIND11_PLUGIN(pyosr) {
 		     py::arg("to"),
 		     py::arg("initial_verify_delta"),
 		     py::call_guard<py::gil_scoped_release>())
+		.def("get_motion_check_counters", &UnitWorld::getMotionCheckCounters)
+		.def("reset_motion_check_counters", &UnitWorld::resetMotionCheckCounters)
+		.def("enable_motion_cache", &UnitWorld::enableMotionCache,
+		     py::arg("lru_capacity"),
+		     py::arg("fn") = std::string(),
+		     py::arg("disk_slots") = 0,
+		     py::arg("quantum") = 1e-9)
+		.def("disable_motion_cache", &UnitWorld::disableMotionCache)
+		.def("get_motion_cache_stats", &UnitWorld::getMotionCacheStats)
 		.def("transit_state_by", &UnitWorld::transitStateBy, py::call_guard<py::gil_scoped_release>())
 		.def("translate_to_unit_state", &UnitWorld::translateToUnitState, py::call_guard<py::gil_scoped_release>())
 		.def("translate_from_unit_state", &UnitWorld::translateFromUnitState, py::call_guard<py::gil_scoped_release>())
+		.def("translate_to_unit_states", &UnitWorld::translateToUnitStates, py::call_guard<py::gil_scoped_release>())
+		.def("translate_from_unit_states", &UnitWorld::translateFromUnitStates, py::call_guard<py::gil_scoped_release>())
 		.def("translate_unit_to_ompl", &UnitWorld::translateUnitStateToOMPLState,
 		     py::arg("Q"),
 		     py::arg("to_angle_axis") = false,
 		     py::call_guard<py::gil_scoped_release>())
-		.def("translate_ompl_to_unit", &UnitWorld::translateOMPLStateToUnitState)
-		.def("translate_vanilla_to_ompl", &UnitWorld::translateVanillaStateToOMPLState)
-		.def("translate_ompl_to_vanilla", &UnitWorld::translateOMPLStateToVanillaState)
-		.def("translate_vanilla_to_unit", &UnitWorld::translateVanillaStateToUnitState)
-		.def("translate_vanilla_pts_to_unit", &UnitWorld::translateVanillaPointsToUnitPoints)
+		.def("translate_ompl_to_unit", &UnitWorld::translateOMPLStateToUnitState,
+		     py::arg("qs"),
+		     py::call_guard<py::gil_scoped_release>())
+		.def("translate_vanilla_to_ompl", &UnitWorld::translateVanillaStateToOMPLState,
+		     py::arg("qs"),
+		     py::call_guard<py::gil_scoped_release>())
+		.def("translate_ompl_to_vanilla", &UnitWorld::translateOMPLStateToVanillaState,
+		     py::arg("qs"),
+		     py::call_guard<py::gil_scoped_release>())
+		.def("translate_vanilla_to_unit", &UnitWorld::translateVanillaStateToUnitState,
+		     py::arg("qs"),
+		     py::call_guard<py::gil_scoped_release>())
+		.def("translate_vanilla_pts_to_unit", &UnitWorld::translateVanillaPointsToUnitPoints,
+		     py::arg("geo"),
+		     py::arg("pts"),
+		     py::call_guard<py::gil_scoped_release>())
 		.def("calculate_visibility_matrix", &UnitWorld::calculateVisibilityMatrix, py::call_guard<py::gil_scoped_release>())
 		.def("calculate_visibility_matrix2", &UnitWorld::calculateVisibilityMatrix2,
 				py::arg("qs0"),
@@ -174,6 +243,16 @@ PYBIND11_PLUGIN(pyosr) {
 				py::arg("verify_magnitude"),
 				py::arg("enable_mt") = true,
 				py::call_guard<py::gil_scoped_release>())
+		.def("calculate_visibility_matrix_tiled", &UnitWorld::calculateVisibilityMatrixTiled,
+				py::arg("qs0"),
+				py::arg("qs0_are_unit_states"),
+				py::arg("qs1"),
+				py::arg("qs1_are_unit_states"),
+				py::arg("verify_magnitude"),
+				py::arg("fn"),
+				py::arg("tile_size") = 256,
+				py::arg("enable_mt") = true,
+				py::call_guard<py::gil_scoped_release>())
 		.def("calculate_visibility_pair", &UnitWorld::calculateVisibilityPair,
 				py::arg("qs0"),
 				py::arg("qs0_are_unit_states"),
@@ -191,6 +270,10 @@ PYBIND11_PLUGIN(pyosr) {
 		.def("get_robot_geometry", &UnitWorld::getRobotGeometry, py::call_guard<py::gil_scoped_release>())
 		.def("get_scene_geometry", &UnitWorld::getSceneGeometry, py::call_guard<py::gil_scoped_release>())
 		.def("intersecting_segments", &UnitWorld::intersectingSegments, py::call_guard<py::gil_scoped_release>())
+		.def("multi_intersecting_segments", &UnitWorld::multiIntersectingSegments,
+		     py::arg("unitqs"),
+		     py::arg("enable_mt") = true,
+		     py::call_guard<py::gil_scoped_release>())
 		.def("robot_face_normals_from_indices", py::overload_cast<const Eigen::Matrix<int, -1, 1>&>(&UnitWorld::getRobotFaceNormalsFromIndices), py::call_guard<py::gil_scoped_release>())
 		.def("scene_face_normals_from_indices", py::overload_cast<const Eigen::Matrix<int, -1, 1>&>(&UnitWorld::getSceneFaceNormalsFromIndices), py::call_guard<py::gil_scoped_release>())
 		.def("robot_face_normals_from_index_pairs", py::overload_cast<const Eigen::Matrix<int, -1, 2>&>(&UnitWorld::getRobotFaceNormalsFromIndices), py::call_guard<py::gil_scoped_release>())
@@ -240,10 +323,21 @@ PYBIND11_PLUGIN(pyosr) {
 		     py::call_guard<py::gil_scoped_release>())
 		.def("get_ompl_center", &UnitWorld::getOMPLCenter,
 		     py::arg("geo") = UnitWorld::GEO_ROB)
-		.def("kinetic_energy_distance", &UnitWorld::kineticEnergyDistance)
-		.def("multi_kinetic_energy_distance", &UnitWorld::multiKineticEnergyDistance)
+		.def("kinetic_energy_distance", &UnitWorld::kineticEnergyDistance,
+		     py::call_guard<py::gil_scoped_release>())
+		.def("multi_kinetic_energy_distance", &UnitWorld::multiKineticEnergyDistance,
+		     py::arg("origin"),
+		     py::arg("targets"),
+		     py::call_guard<py::gil_scoped_release>())
 		.def_readonly_static("GEO_ENV", &UnitWorld::GEO_ENV)
 		.def_readonly_static("GEO_ROB", &UnitWorld::GEO_ROB)
+		.def_readonly_static("MOTION_CHECK_DISCRETE", &UnitWorld::MOTION_CHECK_DISCRETE)
+		.def_readonly_static("MOTION_CHECK_CONSERVATIVE_ADVANCEMENT", &UnitWorld::MOTION_CHECK_CONSERVATIVE_ADVANCEMENT)
+		.def_readonly_static("CD_BACKEND_FCL", &CDModel::BACKEND_FCL)
+		.def_readonly_static("CD_BACKEND_FLAT_BVH", &CDModel::BACKEND_FLAT_BVH)
+		.def_property("motion_check_mode", &UnitWorld::getMotionCheckMode, &UnitWorld::setMotionCheckMode)
+		.def_property("collision_backend", &UnitWorld::getCollisionBackend, &UnitWorld::setCollisionBackend)
+		.def_property("cd_image_prefix", &UnitWorld::getCDImagePrefix, &UnitWorld::setCDImagePrefix)
 		.def_property("recommended_cres", &UnitWorld::getRecommendedCres, &UnitWorld::setRecommendedCres)
 		.def_property_readonly("scene_scale", &UnitWorld::getSceneScale)
 		.def_property_readonly("scene_matrix", &UnitWorld::getSceneMatrix)
@@ -300,15 +394,74 @@ PYBIND11_PLUGIN(pyosr) {
 		// .def_property("uv_feedback", &Renderer::getUVFeedback, &Renderer::setUVFeedback)
 		;
 #endif // GPU_ENABLED
+	using osr::CpuRenderer;
+	py::class_<CpuRenderer, UnitWorld>(m, "CpuRenderer")
+		.def(py::init<>())
+		.def("setupFrom", &CpuRenderer::setupFrom)
+		.def("angleCamera", &CpuRenderer::angleCamera,
+		     py::arg("latitude"),
+		     py::arg("longitude"))
+		.def("render_depth_to_buffer", &CpuRenderer::render_depth_to_buffer,
+		     py::call_guard<py::gil_scoped_release>())
+		.def("render_mvdepth_to_buffer", &CpuRenderer::render_mvdepth_to_buffer,
+		     py::call_guard<py::gil_scoped_release>())
+		.def("render_mvrgbd", &CpuRenderer::render_mvrgbd,
+		     py::arg("flags") = 0,
+		     py::call_guard<py::gil_scoped_release>())
+		.def("add_barycentric", &CpuRenderer::addBarycentric,
+		     py::arg("F"),
+		     py::arg("V"),
+		     py::arg("target"),
+		     py::arg("weight") = 1.0,
+		     py::call_guard<py::gil_scoped_release>())
+		.def("clear_barycentric", &CpuRenderer::clearBarycentric,
+		     py::call_guard<py::gil_scoped_release>())
+		.def("render_barycentric", &CpuRenderer::renderBarycentric,
+		     py::arg("target"),
+		     py::arg("res"),
+		     py::arg("svg_fn") = std::string(),
+		     py::call_guard<py::gil_scoped_release>())
+		.def_readonly_static("NO_SCENE_RENDERING", &CpuRenderer::NO_SCENE_RENDERING)
+		.def_readonly_static("NO_ROBOT_RENDERING", &CpuRenderer::NO_ROBOT_RENDERING)
+		.def_readonly_static("HAS_NTR_RENDERING", &CpuRenderer::HAS_NTR_RENDERING)
+		.def_readonly_static("UV_MAPPINNG_RENDERING", &CpuRenderer::UV_MAPPINNG_RENDERING)
+		.def_readonly_static("NORMAL_RENDERING", &CpuRenderer::NORMAL_RENDERING)
+		.def_readonly_static("UV_FEEDBACK", &CpuRenderer::UV_FEEDBACK)
+		.def_readonly_static("BARY_RENDERING_ROBOT", &CpuRenderer::BARY_RENDERING_ROBOT)
+		.def_readonly_static("BARY_RENDERING_SCENE", &CpuRenderer::BARY_RENDERING_SCENE)
+		.def_readwrite("pbufferWidth", &CpuRenderer::pbufferWidth)
+		.def_readwrite("pbufferHeight", &CpuRenderer::pbufferHeight)
+		.def_readwrite("default_depth", &CpuRenderer::default_depth)
+		.def_readwrite("mvrgb", &CpuRenderer::mvrgb)
+		.def_readwrite("mvdepth", &CpuRenderer::mvdepth)
+		.def_readwrite("mvuv", &CpuRenderer::mvuv)
+		.def_readwrite("mvpid", &CpuRenderer::mvpid)
+		.def_readwrite("mvnormal", &CpuRenderer::mvnormal)
+		.def_readwrite("views", &CpuRenderer::views)
+		.def_readwrite("avi", &CpuRenderer::avi)
+		.def_readwrite("flat_surface", &CpuRenderer::flat_surface)
+		.def_readwrite("light_position", &CpuRenderer::light_position)
+		.def_property("final_scaling", &CpuRenderer::getFinalScaling, &CpuRenderer::setFinalScaling)
+		;
 	using osr::GTGenerator;
+	m.def("convert_roadmap", &vecio::RoadMapFile::convertText,
+	      py::arg("text_fn"),
+	      py::arg("fn"),
+	      "Convert a text roadmap to the binary format",
+	      py::call_guard<py::gil_scoped_release>());
 	py::class_<GTGenerator>(m, "GTGenerator")
 		.def(py::init<UnitWorld&>())
 		.def("load_roadmap_file", &GTGenerator::loadRoadMapFile)
 		.def("save_verified_roadmap_file", &GTGenerator::saveVerifiedRoadMapFile)
+		.def("save_verified_roadmap_binary_file", &GTGenerator::saveVerifiedRoadMapBinaryFile)
 		.def("init_knn", &GTGenerator::initKNN)
 		.def("init_knn_in_batch", &GTGenerator::initKNNInBatch)
 		.def("init_gt", &GTGenerator::initGT)
 		.def("install_gtdata", &GTGenerator::installGTData)
+		.def("update_gt", &GTGenerator::updateGT,
+		     py::arg("vertices"),
+		     py::arg("edges"),
+		     py::call_guard<py::gil_scoped_release>())
 		.def("extract_gtdata", &GTGenerator::extractGTData)
 		.def("generate_gt_path", &GTGenerator::generateGTPath)
 		.def("cast_path_to_cont_actions_in_UW", &GTGenerator::castPathToContActionsInUW,
@@ -325,6 +478,28 @@ PYBIND11_PLUGIN(pyosr) {
 		.def_readwrite("gamma", &GTGenerator::gamma)
 		.def_readwrite("rl_stepping_size", &GTGenerator::rl_stepping_size)
 		;
+	using osr::SE3KNN;
+	py::class_<SE3KNN>(m, "SE3KNN")
+		.def(py::init<const osr::ArrayOfStates&, int>(),
+		     py::arg("states"),
+		     py::arg("leaf_size") = 16,
+		     py::call_guard<py::gil_scoped_release>())
+		.def("__len__", &SE3KNN::size)
+		.def("nearest_k",
+		     py::overload_cast<const osr::ArrayOfStates&, int, bool>(&SE3KNN::nearestK, py::const_),
+		     py::arg("queries"),
+		     py::arg("k"),
+		     py::arg("enable_mt") = true,
+		     "Returns (indices, distances), both N x k, padded with -1 and inf",
+		     py::call_guard<py::gil_scoped_release>())
+		.def("radius",
+		     py::overload_cast<const osr::ArrayOfStates&, double, bool>(&SE3KNN::radius, py::const_),
+		     py::arg("queries"),
+		     py::arg("r"),
+		     py::arg("enable_mt") = true,
+		     "Returns (offsets, indices, distances) in CSR form",
+		     py::call_guard<py::gil_scoped_release>())
+		;
 	m.def("interpolate", &osr::interpolate,
 	      "Interpolate between two SE3 states");
 	m.def("path_metrics", &osr::path_metrics,
@@ -0,0 +1,134 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "forest_edge.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <omp.h>
+
+namespace {
+
+const uint32_t kOpenSpaceFlag = 1;
+
+// Number of PDS columns handled by one task of the column merge
+const int64_t kColumnBlock = 1 << 16;
+
+inline uint64_t
+edgeKey(int64_t from, int64_t to)
+{
+	return (uint64_t(from) << 32) | uint64_t(to);
+}
+
+}
+
+std::tuple<ForestEdges, ForestRoots>
+buildForestEdges(const std::vector<Eigen::SparseMatrix<int>>& ssc,
+                 const Eigen::Matrix<uint32_t, -1, 1>& pds_flags)
+{
+	const int64_t N = ssc.size();
+	int64_t K = pds_flags.size();
+	for (const auto& C : ssc)
+		K = std::max<int64_t>(K, C.cols());
+	if (N >= (int64_t(1) << 31))
+		throw std::runtime_error("buildForestEdges: too many trees " + std::to_string(N));
+
+	// Step 1: row view of each tree, i.e. the sorted PDS indices it reaches
+	std::vector<std::vector<int64_t>> tree_pds(N);
+#pragma omp parallel for schedule(dynamic, 16)
+	for (int64_t i = 0; i < N; i++) {
+		const auto& C = ssc[i];
+		auto& row = tree_pds[i];
+		for (int64_t j = 0; j < C.outerSize(); j++) {
+			for (Eigen::SparseMatrix<int>::InnerIterator it(C, j); it; ++it) {
+				if (it.value() != 0) {
+					row.emplace_back(j);
+					break;
+				}
+			}
+		}
+	}
+
+	// Step 2: merge the rows into CSC blocks of PDS columns, and build the
+	//         star edges of each column. Blocks are independent, and
+	//         each thread keeps the smallest PDS index of its edges.
+	int nthreads = omp_get_max_threads();
+	std::vector<std::unordered_map<uint64_t, int64_t>> local_edges(nthreads);
+	std::vector<std::vector<uint8_t>> local_open(nthreads);
+	const int64_t nblocks = (K + kColumnBlock - 1) / kColumnBlock;
+#pragma omp parallel
+	{
+		int tid = omp_get_thread_num();
+		auto& edges = local_edges[tid];
+		auto& open = local_open[tid];
+		open.assign(N, 0);
+		std::vector<int64_t> col_offsets;
+		std::vector<int> col_trees;
+#pragma omp for schedule(dynamic)
+		for (int64_t b = 0; b < nblocks; b++) {
+			int64_t low = b * kColumnBlock;
+			int64_t high = std::min(K, low + kColumnBlock);
+			col_offsets.assign(high - low + 1, 0);
+			std::vector<std::pair<int64_t, int64_t>> ranges(N);
+			for (int64_t i = 0; i < N; i++) {
+				const auto& row = tree_pds[i];
+				auto first = std::lower_bound(row.begin(), row.end(), low) - row.begin();
+				auto last = std::lower_bound(row.begin() + first, row.end(), high) - row.begin();
+				ranges[i] = std::make_pair(first, last);
+				for (auto k = first; k < last; k++)
+					col_offsets[row[k] - low + 1]++;
+			}
+			for (int64_t j = 0; j < high - low; j++)
+				col_offsets[j + 1] += col_offsets[j];
+			col_trees.resize(col_offsets.back());
+			std::vector<int64_t> tails(col_offsets.begin(), col_offsets.end() - 1);
+			// Trees are visited in order, hence each column is sorted
+			for (int64_t i = 0; i < N; i++) {
+				const auto& row = tree_pds[i];
+				for (auto k = ranges[i].first; k < ranges[i].second; k++)
+					col_trees[tails[row[k] - low]++] = int(i);
+			}
+			for (int64_t j = low; j < high; j++) {
+				int64_t begin = col_offsets[j - low];
+				int64_t end = col_offsets[j - low + 1];
+				for (int64_t k = begin; k + 1 < end; k++)
+					edges.emplace(edgeKey(col_trees[k], col_trees[k + 1]), j + 1);
+				if (j < pds_flags.size() && (pds_flags(j) & kOpenSpaceFlag))
+					for (int64_t k = begin; k < end; k++)
+						open[col_trees[k]] = 1;
+			}
+		}
+	}
+
+	// Step 3: merge the thread local results
+	std::unordered_map<uint64_t, int64_t> all_edges;
+	std::vector<uint8_t> open(N, 0);
+	for (int t = 0; t < nthreads; t++) {
+		for (const auto& kv : local_edges[t]) {
+			auto iter = all_edges.emplace(kv.first, kv.second).first;
+			iter->second = std::min(iter->second, kv.second);
+		}
+		local_edges[t].clear();
+		for (int64_t i = 0; i < int64_t(local_open[t].size()); i++)
+			open[i] |= local_open[t][i];
+	}
+	std::vector<std::pair<uint64_t, int64_t>> sorted(all_edges.begin(), all_edges.end());
+	std::sort(sorted.begin(), sorted.end());
+
+	ForestEdges E;
+	E.resize(sorted.size(), Eigen::NoChange);
+	for (size_t i = 0; i < sorted.size(); i++) {
+		E(i, 0) = int64_t(sorted[i].first >> 32);
+		E(i, 1) = int64_t(sorted[i].first & 0xFFFFFFFFu);
+		E(i, 2) = sorted[i].second;
+	}
+	ForestRoots open_trees;
+	open_trees.resize(std::count(open.begin(), open.end(), 1));
+	for (int64_t i = 0, k = 0; i < N; i++)
+		if (open[i])
+			open_trees(k++) = i;
+	return std::make_tuple(E, open_trees);
+}
@@ -0,0 +1,40 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef PYSE3OMPL_FOREST_EDGE_H
+#define PYSE3OMPL_FOREST_EDGE_H
+
+#include <stdint.h>
+#include <tuple>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/SparseCore>
+
+using ForestEdges = Eigen::Matrix<int64_t, -1, 3>;
+using ForestRoots = Eigen::Matrix<int64_t, -1, 1>;
+
+//
+// Build the inter-tree edges of an RDT forest from the sample set
+// connectivity of its trees (OmplDriver::getSampleSetConnectivity)
+//
+// Param
+//   ssc: one 1xK sparse matrix per tree, K is the size of the predefined
+//        sample set (PDS)
+//   pds_flags: flags of PDS (OmplDriver::setSampleSetFlags), can be empty
+//
+// Returns
+//   E: Mx3 matrix, each row is (from tree, to tree, PDS index + 1).
+//      Trees sharing one PDS sample are connected as a chain in the
+//      ascending order of tree IDs, and the smallest shared PDS index is
+//      recorded if two trees share multiple samples. Rows are sorted.
+//   OpenTree: trees connected to any PDS sample flagged as open space.
+//
+// Note: this is the native version of pds_edge.py, and the output matches
+//       its 'E' and 'OpenTree' datasets.
+std::tuple<ForestEdges, ForestRoots>
+buildForestEdges(const std::vector<Eigen::SparseMatrix<int>>& ssc,
+                 const Eigen::Matrix<uint32_t, -1, 1>& pds_flags);
+
+#endif
@@ -0,0 +1,341 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#include "forest_sssp.h"
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+const int ForestSSSP::kOpenSpace;
+const uint32_t ForestSSSP::kPDSFlagTerminate;
+const int64_t ForestSSSP::kExitAtRoot;
+const int64_t ForestSSSP::kExitToOpenSpace;
+
+namespace {
+
+//
+// A* over a CSR graph. weight(u, v) and heuristic(u) are callables.
+// Returns the vertices from source to target, empty if not reachable.
+//
+template<typename Index, typename Weight, typename Heuristic>
+std::vector<Index>
+astar(const std::vector<Index>& offsets,
+      const std::vector<Index>& adjs,
+      Index source,
+      Index target,
+      Weight weight,
+      Heuristic heuristic)
+{
+	const double kInf = std::numeric_limits<double>::infinity();
+	Index NV = Index(offsets.size()) - 1;
+	std::vector<double> g(NV, kInf);
+	std::vector<Index> parent(NV, -1);
+	using Entry = std::pair<double, Index>;
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> Q;
+	g[source] = 0.0;
+	Q.emplace(heuristic(source), source);
+	while (!Q.empty()) {
+		double f;
+		Index tip;
+		std::tie(f, tip) = Q.top();
+		Q.pop();
+		if (tip == target)
+			break;
+		if (f > g[tip] + heuristic(tip))
+			continue; // Outdated entry
+		for (Index k = offsets[tip]; k < offsets[tip + 1]; k++) {
+			Index adj = adjs[k];
+			double cand = g[tip] + weight(tip, adj, k);
+			if (cand < g[adj]) {
+				g[adj] = cand;
+				parent[adj] = tip;
+				Q.emplace(cand + heuristic(adj), adj);
+			}
+		}
+	}
+	std::vector<Index> ret;
+	if (g[target] == kInf)
+		return ret;
+	for (Index v = target; v >= 0; v = parent[v])
+		ret.emplace_back(v);
+	std::reverse(ret.begin(), ret.end());
+	return ret;
+}
+
+template<typename Index>
+void
+buildCSR(Index NV,
+         const std::vector<std::pair<Index, Index>>& edges,
+         std::vector<Index>& offsets,
+         std::vector<Index>& adjs)
+{
+	offsets.assign(NV + 1, 0);
+	for (const auto& e : edges) {
+		offsets[e.first + 1]++;
+		offsets[e.second + 1]++;
+	}
+	for (Index i = 0; i < NV; i++)
+		offsets[i + 1] += offsets[i];
+	adjs.resize(offsets[NV]);
+	std::vector<Index> tails(offsets.begin(), offsets.end() - 1);
+	for (const auto& e : edges) {
+		adjs[tails[e.first]++] = e.second;
+		adjs[tails[e.second]++] = e.first;
+	}
+}
+
+void
+appendPath(std::vector<Eigen::VectorXd>& path,
+           const Eigen::MatrixXd& segment,
+           bool reverse)
+{
+	for (int i = 0; i < segment.rows(); i++) {
+		Eigen::VectorXd q = segment.row(reverse ? segment.rows() - 1 - i : i);
+		if (!path.empty() && path.back() == q)
+			continue;
+		path.emplace_back(std::move(q));
+	}
+}
+
+}
+
+ForestSSSP::ForestSSSP(Eigen::MatrixXd roots,
+                       Eigen::MatrixXd pds,
+                       Eigen::Matrix<uint32_t, -1, 1> pds_flags)
+	:roots_(std::move(roots)), pds_(std::move(pds)), pds_flags_(std::move(pds_flags))
+{
+}
+
+double
+ForestSSSP::distance(const Eigen::Ref<const Eigen::VectorXd>& q0,
+                     const Eigen::Ref<const Eigen::VectorXd>& q1)
+{
+	// Same as ompl::base::SE3StateSpace with unit weights
+	double tr = (q0.head<3>() - q1.head<3>()).norm();
+	double dq = std::abs(q0.segment<4>(3).dot(q1.segment<4>(3)));
+	return tr + std::acos(std::min(dq, 1.0));
+}
+
+Eigen::VectorXd
+ForestSSSP::forestConf(int64_t node) const
+{
+	if (node < numRoots())
+		return roots_.row(node);
+	return pds_.row(node - numRoots());
+}
+
+void
+ForestSSSP::setForestEdges(const ForestEdges& E,
+                           const ForestRoots& open_trees)
+{
+	int64_t N = numRoots();
+	std::vector<std::pair<int64_t, int64_t>> edges;
+	edges.reserve(E.rows() * 2 + open_trees.size());
+	for (int i = 0; i < E.rows(); i++) {
+		int64_t pds = N + E(i, 2) - 1; // E stores 1-indexed PDS
+		if (E(i, 0) < 0 || E(i, 0) >= N ||
+		    E(i, 1) < 0 || E(i, 1) >= N ||
+		    pds < N || pds >= openSpaceNode())
+			throw std::runtime_error("ForestSSSP::setForestEdges: invalid edge at row "
+			                         + std::to_string(i));
+		edges.emplace_back(E(i, 0), pds);
+		edges.emplace_back(E(i, 1), pds);
+	}
+	for (int i = 0; i < open_trees.size(); i++) {
+		if (open_trees(i) < 0 || open_trees(i) >= N)
+			throw std::runtime_error("ForestSSSP::setForestEdges: invalid open space tree "
+			                         + std::to_string(open_trees(i)));
+		edges.emplace_back(open_trees(i), openSpaceNode());
+	}
+	buildCSR<int64_t>(openSpaceNode() + 1, edges, offsets_, adjs_);
+	forest_path_.clear();
+}
+
+bool
+ForestSSSP::solveForest(int init_tree, int goal_tree)
+{
+	if (offsets_.empty())
+		throw std::runtime_error("ForestSSSP::solveForest: call setForestEdges first");
+	if (init_tree < 0 || init_tree >= numRoots())
+		throw std::runtime_error("ForestSSSP::solveForest: invalid init tree "
+		                         + std::to_string(init_tree));
+	if (goal_tree != kOpenSpace && (goal_tree < 0 || goal_tree >= numRoots()))
+		throw std::runtime_error("ForestSSSP::solveForest: invalid goal tree "
+		                         + std::to_string(goal_tree));
+	int64_t target = goal_tree == kOpenSpace ? openSpaceNode() : int64_t(goal_tree);
+	auto weight = [this](int64_t u, int64_t v, int64_t) -> double {
+		if (u == openSpaceNode() || v == openSpaceNode())
+			return 0.0;
+		return distance(forestConf(u), forestConf(v));
+	};
+	auto heuristic = [this, goal_tree](int64_t u) -> double {
+		if (goal_tree == kOpenSpace || u == openSpaceNode())
+			return 0.0;
+		return distance(forestConf(u), roots_.row(goal_tree).transpose());
+	};
+	forest_path_ = astar<int64_t>(offsets_, adjs_, init_tree, target, weight, heuristic);
+	return !forest_path_.empty();
+}
+
+Eigen::Matrix<int64_t, -1, 2>
+ForestSSSP::getForestPath() const
+{
+	std::vector<std::pair<int64_t, int64_t>> rows;
+	for (size_t i = 0; i < forest_path_.size(); i++) {
+		int64_t node = forest_path_[i];
+		if (node >= numRoots())
+			continue;
+		int64_t exit = kExitAtRoot;
+		if (i + 1 < forest_path_.size()) {
+			int64_t next = forest_path_[i + 1];
+			exit = next == openSpaceNode() ? kExitToOpenSpace : next - numRoots();
+		}
+		rows.emplace_back(node, exit);
+	}
+	Eigen::Matrix<int64_t, -1, 2> ret;
+	ret.resize(rows.size(), Eigen::NoChange);
+	for (size_t i = 0; i < rows.size(); i++)
+		ret.row(i) << rows[i].first, rows[i].second;
+	return ret;
+}
+
+Eigen::VectorXi
+ForestSSSP::getForestPathTrees() const
+{
+	auto fp = getForestPath();
+	Eigen::VectorXi ret = fp.col(0).cast<int>();
+	return ret;
+}
+
+void
+ForestSSSP::addTree(int root,
+                    const Eigen::SparseMatrix<int>& ssc,
+                    const Eigen::Matrix<int64_t, -1, 1>& CNVI,
+                    const Eigen::MatrixXd& CNV,
+                    const Eigen::Matrix<int64_t, -1, 2>& CE)
+{
+	if (root < 0 || root >= numRoots())
+		throw std::runtime_error("ForestSSSP::addTree: invalid root " + std::to_string(root));
+	Tree tree;
+	std::unordered_map<int64_t, int> nouveau;
+	for (int i = 0; i < CNVI.size(); i++)
+		nouveau[CNVI(i)] = i;
+
+	// Local ID 0 is the root (-1 in CE)
+	std::vector<int64_t> ids(1, -1);
+	tree.local_ids[-1] = 0;
+	std::vector<std::pair<int, int>> edges;
+	edges.reserve(CE.rows());
+	for (int i = 0; i < CE.rows(); i++) {
+		int local[2];
+		for (int k = 0; k < 2; k++) {
+			auto iter = tree.local_ids.emplace(CE(i, k), int(ids.size())).first;
+			if (iter->second == int(ids.size()))
+				ids.emplace_back(CE(i, k));
+			local[k] = iter->second;
+		}
+		edges.emplace_back(local[0], local[1]);
+	}
+	buildCSR<int>(int(ids.size()), edges, tree.offsets, tree.adjs);
+
+	tree.confs.resize(ids.size(), roots_.cols());
+	tree.confs.row(0) = roots_.row(root);
+	for (size_t i = 1; i < ids.size(); i++) {
+		int64_t id = ids[i];
+		if (id >= 0 && id < ssc.cols() && id < pds_.rows() && ssc.coeff(0, id) != 0) {
+			tree.confs.row(i) = pds_.row(id);
+			continue;
+		}
+		auto iter = nouveau.find(id);
+		if (iter == nouveau.end())
+			throw std::runtime_error("ForestSSSP::addTree: cannot find vertex "
+			                         + std::to_string(id) + " in tree "
+			                         + std::to_string(root));
+		tree.confs.row(i) = CNV.row(iter->second);
+	}
+	tree.weights.resize(tree.adjs.size());
+	for (int u = 0; u < int(ids.size()); u++)
+		for (int k = tree.offsets[u]; k < tree.offsets[u + 1]; k++)
+			tree.weights[k] = distance(tree.confs.row(u).transpose(),
+			                           tree.confs.row(tree.adjs[k]).transpose());
+
+	for (int j = 0; j < ssc.outerSize(); j++) {
+		for (Eigen::SparseMatrix<int>::InnerIterator it(ssc, j); it; ++it) {
+			if (it.value() == 0)
+				continue;
+			if (j < pds_flags_.size() && (pds_flags_(j) & kPDSFlagTerminate))
+				tree.terminals.emplace_back(j);
+			break;
+		}
+	}
+	trees_[root] = std::move(tree);
+}
+
+Eigen::MatrixXd
+ForestSSSP::treePath(int root, int64_t leaf) const
+{
+	auto titer = trees_.find(root);
+	if (titer == trees_.end())
+		throw std::runtime_error("ForestSSSP: tree " + std::to_string(root)
+		                         + " is not added");
+	const Tree& tree = titer->second;
+	if (leaf == kExitToOpenSpace) {
+		if (tree.terminals.empty())
+			throw std::runtime_error("ForestSSSP: tree " + std::to_string(root)
+			                         + " has no open space sample");
+		leaf = tree.terminals.front();
+	}
+	auto liter = tree.local_ids.find(leaf);
+	if (liter == tree.local_ids.end())
+		throw std::runtime_error("ForestSSSP: vertex " + std::to_string(leaf)
+		                         + " is not in tree " + std::to_string(root));
+	int target = liter->second;
+	auto weight = [&tree](int, int, int k) -> double {
+		return tree.weights[k];
+	};
+	auto heuristic = [&tree, target](int u) -> double {
+		return distance(tree.confs.row(u).transpose(),
+		                tree.confs.row(target).transpose());
+	};
+	auto local_path = astar<int>(tree.offsets, tree.adjs, 0, target, weight, heuristic);
+	if (local_path.empty())
+		throw std::runtime_error("ForestSSSP: vertex " + std::to_string(leaf)
+		                         + " is not connected to the root of tree "
+		                         + std::to_string(root));
+	Eigen::MatrixXd ret;
+	ret.resize(local_path.size(), tree.confs.cols());
+	for (size_t i = 0; i < local_path.size(); i++)
+		ret.row(i) = tree.confs.row(local_path[i]);
+	return ret;
+}
+
+Eigen::MatrixXd
+ForestSSSP::stitchPath() const
+{
+	auto fp = getForestPath();
+	std::vector<Eigen::VectorXd> path;
+	for (int i = 0; i < fp.rows(); i++) {
+		int root = int(fp(i, 0));
+		int64_t exit = fp(i, 1);
+		// Enter from the PDS sample shared with the previous tree
+		if (i > 0)
+			appendPath(path, treePath(root, fp(i - 1, 1)), true);
+		else
+			appendPath(path, roots_.row(root), false);
+		if (exit != kExitAtRoot)
+			appendPath(path, treePath(root, exit), false);
+	}
+	Eigen::MatrixXd ret;
+	ret.resize(path.size(), roots_.cols());
+	for (size_t i = 0; i < path.size(); i++)
+		ret.row(i) = path[i];
+	return ret;
+}
@@ -0,0 +1,112 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef PYSE3OMPL_FOREST_SSSP_H
+#define PYSE3OMPL_FOREST_SSSP_H
+
+#include "forest_edge.h"
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include <Eigen/Core>
+#include <Eigen/SparseCore>
+
+//
+// Shortest path in an RDT forest, the native version of forest_dijkstra.py
+//
+// The forest level graph connects each root to the PDS samples shared with
+// other trees (see buildForestEdges), and the open space trees to a virtual
+// open space node. Edges are weighted by the SE(3) metric between the end
+// points, and the A* search uses the metric to the goal root as heuristic.
+//
+// Usage:
+//   1. solveForest(init, goal) to find the sequence of trees;
+//   2. addTree for each tree returned by getForestPathTrees;
+//   3. stitchPath to get the path in configuration space.
+//
+// All states are in OMPL format, i.e. translation + w-last quaternion.
+class ForestSSSP {
+public:
+	// Goal of solveForest, which means the open space
+	static const int kOpenSpace = -1;
+	static const uint32_t kPDSFlagTerminate = 1;
+	static const int64_t kExitAtRoot = -1;
+	static const int64_t kExitToOpenSpace = -2;
+
+	ForestSSSP(Eigen::MatrixXd roots,
+	           Eigen::MatrixXd pds,
+	           Eigen::Matrix<uint32_t, -1, 1> pds_flags);
+
+	// E and open_trees are the outputs of buildForestEdges
+	void setForestEdges(const ForestEdges& E,
+	                    const ForestRoots& open_trees);
+
+	// Returns false if the goal is not reachable.
+	// goal_tree can be kOpenSpace
+	bool solveForest(int init_tree, int goal_tree);
+
+	// Forest level path, each row is (tree, exit), where exit is the PDS
+	// index shared with the next tree, kExitAtRoot for the goal tree, or
+	// kExitToOpenSpace if the path leaves the tree for the open space.
+	Eigen::Matrix<int64_t, -1, 2>
+	getForestPath() const;
+
+	// Distinct trees on the forest level path
+	Eigen::VectorXi
+	getForestPathTrees() const;
+
+	// Install the compact tree of one root (OmplDriver::getCompactGraph),
+	// and its sample set connectivity.
+	void addTree(int root,
+	             const Eigen::SparseMatrix<int>& ssc,
+	             const Eigen::Matrix<int64_t, -1, 1>& CNVI,
+	             const Eigen::MatrixXd& CNV,
+	             const Eigen::Matrix<int64_t, -1, 2>& CE);
+
+	// Release the compact tree of one root
+	void removeTree(int root)
+	{
+		trees_.erase(root);
+	}
+
+	// Stitch the in-tree paths along the forest level path. Shared PDS
+	// samples only appear once in the returned path.
+	Eigen::MatrixXd
+	stitchPath() const;
+
+	static double distance(const Eigen::Ref<const Eigen::VectorXd>& q0,
+	                       const Eigen::Ref<const Eigen::VectorXd>& q1);
+private:
+	struct Tree {
+		// Local vertex 0 is the root
+		Eigen::MatrixXd confs;
+		std::vector<int> offsets;
+		std::vector<int> adjs;
+		std::vector<double> weights;
+		std::map<int64_t, int> local_ids; // Vertex ID in CE -> local ID
+		std::vector<int64_t> terminals;   // Open space PDS samples
+	};
+
+	Eigen::MatrixXd roots_;
+	Eigen::MatrixXd pds_;
+	Eigen::Matrix<uint32_t, -1, 1> pds_flags_;
+
+	// Forest level CSR. [0, N) are roots, [N, N+K) are PDS samples and
+	// N+K is the virtual open space node.
+	std::vector<int64_t> offsets_;
+	std::vector<int64_t> adjs_;
+
+	std::vector<int64_t> forest_path_;
+	std::map<int, Tree> trees_;
+
+	int64_t numRoots() const { return roots_.rows(); }
+	int64_t openSpaceNode() const { return roots_.rows() + pds_.rows(); }
+	Eigen::VectorXd forestConf(int64_t node) const;
+
+	// Path in tree from its root to the vertex ID leaf (in CE)
+	Eigen::MatrixXd treePath(int root, int64_t leaf) const;
+};
+
+#endif
@@ -5,15 +5,68 @@
  */
 #include "ompldriver.h"
 #include <ompl/geometric/PathSimplifier.h>
+#include <ompl/datastructures/NearestNeighborsGNAT.h>
 
+#include <atomic>
 #include <chrono>
 #include <ctime>
 #include <unordered_set>
+#include <omp.h>
 
 using hclock = std::chrono::high_resolution_clock;
 using GraphV = OmplDriver::GraphV;
 using GraphE = OmplDriver::GraphE;
 
+namespace {
+
+/*
+ * Lock-free union-find over [0, N), the root of a set is always its smallest
+ * element.
+ */
+class ConcurrentDisjointSet {
+public:
+	ConcurrentDisjointSet(int N)
+		:parent_(N)
+	{
+		for (int i = 0; i < N; i++)
+			parent_[i].store(i);
+	}
+
+	int find(int x)
+	{
+		while (true) {
+			int p = parent_[x].load();
+			if (p == x)
+				return x;
+			int gp = parent_[p].load();
+			// Path halving, failure is harmless
+			if (p != gp)
+				parent_[x].compare_exchange_weak(p, gp);
+			x = gp;
+		}
+	}
+
+	// Returns true if a and b were in different sets
+	bool unite(int a, int b)
+	{
+		while (true) {
+			a = find(a);
+			b = find(b);
+			if (a == b)
+				return false;
+			if (a < b)
+				std::swap(a, b);
+			int expected = a;
+			if (parent_[a].compare_exchange_strong(expected, b))
+				return true;
+		}
+	}
+private:
+	std::vector<std::atomic<int>> parent_;
+};
+
+}
+
 std::tuple<GraphV, GraphE>
 OmplDriver::solve(double days,
                   const std::string& output_fn,
@@ -205,6 +258,8 @@ OmplDriver::mergeExistingGraph(int KNN,
 			ttl += V.rows();
 		all_motions.reserve(ttl);
 	}
+	// Motion checkers of version 7
+	std::vector<std::unique_ptr<ompl::app::SE3RigidBodyPlanning>> worker_setups;
 	// PerformanceNumbers
 	auto plan_start = hclock::now();
 	latest_pn_.knn_delete_time = 0;
@@ -550,11 +605,130 @@ OmplDriver::mergeExistingGraph(int KNN,
 				latest_pn_.knn_delete_time += rebuild_dur.count() * 1e-6;
 			}
 		}
+	} else if (version == 7) {
+		/*
+		 * Parallel variant of Version 2.
+		 *
+		 * KNN DS of trees are built concurrently, and are
+		 * thread-safe GNATs rather than the default one of RDT. Each
+		 * worker thread checks motions with its own
+		 * SE3RigidBodyPlanning object.
+		 *
+		 * Trees are merged into components with a union-find, and a
+		 * motion does not query the trees that are already in its
+		 * component. Hence only edges that join two components are
+		 * returned.
+		 */
+		auto NTree = ex_graph_v_.size();/*{{{*/
+		std::vector<int> tree_offset(NTree + 1, 0);
+		for (size_t i = 0; i < NTree; i++)
+			tree_offset[i + 1] = tree_offset[i] + ex_graph_v_[i].rows();
+		all_motions.resize(tree_offset[NTree]);
+		std::vector<KNNPtr> tree_knn(NTree);
+		auto distance = std::bind(&ompl::geometric::ReRRT::distanceFunction,
+		                          real_planner.get(),
+		                          std::placeholders::_1,
+		                          std::placeholders::_2);
+#pragma omp parallel for schedule(dynamic)
+		for (size_t i = 0; i < NTree; i++) {
+			const auto& V = ex_graph_v_[i];
+			auto nn = std::make_shared<ompl::NearestNeighborsGNAT<Motion*>>();
+			nn->setDistanceFunction(distance);
+			std::vector<Motion*> motions(V.rows());
+			for (int j = 0; j < V.rows(); j++) {
+				auto m = new Motion(si);
+				ss->copyFromEigen3(m->state, V.row(j));
+				m->motion_index = j;
+				m->forest_index = i;
+				motions[j] = m;
+				all_motions[tree_offset[i] + j] = m;
+			}
+			nn->add(motions);
+			tree_knn[i] = std::move(nn);
+		}
+		if (verbose)
+			std::cerr << "KNN DS of " << NTree << " trees built" << std::endl;
+
+		int nthreads = omp_get_max_threads();
+		{
+			auto bak = planner_id_;
+			planner_id_ = PLANNER_ReRRT;
+			for (int t = 0; t < nthreads; t++) {
+				worker_setups.emplace_back(new ompl::app::SE3RigidBodyPlanning);
+				configSE3RigidBodyPlanning(*worker_setups.back(), false);
+			}
+			planner_id_ = bak;
+		}
+
+		// Empty subset means select all
+		if (subset.size() == 0) {
+			subset.resize(NTree);
+			for (size_t i = 0; i < NTree; i++)
+				subset(i) = i;
+		}
+		std::vector<int> sources;
+		for (int i = 0; i < subset.size(); i++)
+			for (int mi = tree_offset[subset(i)]; mi < tree_offset[subset(i) + 1]; mi++)
+				sources.emplace_back(mi);
+
+		ConcurrentDisjointSet components(NTree);
+		std::atomic<int> ncomponents(NTree);
+		std::atomic<size_t> nsources_done(0);
+		std::vector<std::vector<Eigen::Vector4i>> local_edges(nthreads);
+#pragma omp parallel for schedule(dynamic, 16)
+		for (size_t i = 0; i < sources.size(); i++) {
+			if (ncomponents.load() <= 1)
+				continue;
+			int tid = omp_get_thread_num();
+			auto wsi = worker_setups[tid]->getSpaceInformation();
+			auto m = all_motions[sources[i]];
+			int from = m->forest_index;
+			std::vector<Motion*> nmotions;
+			for (int k = 0; k < int(NTree); k++) {
+				if (components.find(k) == components.find(from))
+					continue;
+				nmotions.clear();
+				tree_knn[k]->nearestK(m, KNN, nmotions);
+				for (auto n : nmotions) {
+					if (!wsi->checkMotion(m->state, n->state))
+						continue;
+					if (components.unite(from, k)) {
+						Eigen::Vector4i e;
+						e << m->forest_index, m->motion_index,
+						     n->forest_index, n->motion_index;
+						local_edges[tid].emplace_back(e);
+						ncomponents--;
+					}
+					break;
+				}
+			}
+			auto done = ++nsources_done;
+			if (verbose && done % 1000 == 0) {
+#pragma omp critical
+				std::cerr << done << " / " << sources.size()
+				          << "\tcomponents: " << ncomponents.load()
+				          << std::endl;
+			}
+		}
+		for (const auto& le : local_edges)
+			edges.insert(edges.end(), le.begin(), le.end());
+		tree_knn.clear();
+		for (auto m : all_motions) {
+			si->freeState(m->state);
+			delete m;
+		}
+		all_motions.clear();/*}}}*/
 	}
 	std::chrono::duration<uint64_t, std::nano> plan_dur = hclock::now() - plan_start;
 	latest_pn_.planning_time = plan_dur.count() * 1e-6;
 	updatePerformanceNumbers(setup);
-	// FIXME: all_motions is leaked
+	for (const auto& ws : worker_setups) {
+		auto validator = ws->getSpaceInformation()->getMotionValidator();
+		latest_pn_.motion_check += validator->getCheckedMotionCount();
+		latest_pn_.motion_check_time += validator->getMotionCheckTime() * 1e-6;
+		latest_pn_.motion_discrete_state_check += validator->getCheckedDiscreteStateCount();
+	}
+	// FIXME: all_motions is leaked, except for version 7
 	Eigen::MatrixXi ret;
 	ret.resize(edges.size(), 4);
 	for (size_t i = 0; i < edges.size(); i++)
@@ -563,28 +737,43 @@ OmplDriver::mergeExistingGraph(int KNN,
 }
 
 
+void
+OmplDriver::prepareValidators()
+{
+	// Caller must hold validator_mutex_
+	size_t nthreads = omp_get_max_threads();
+	if (validator_setups_.size() >= nthreads)
+		return;
+	auto bak = planner_id_;
+	planner_id_ = PLANNER_ReRRT;
+	while (validator_setups_.size() < nthreads) {
+		validator_setups_.emplace_back(new ompl::app::SE3RigidBodyPlanning);
+		configSE3RigidBodyPlanning(*validator_setups_.back(), false);
+	}
+	planner_id_ = bak;
+}
+
+
 Eigen::VectorXi
 OmplDriver::validateStates(const Eigen::MatrixXd& qs0)
 {
-	ompl::app::SE3RigidBodyPlanning setup;
-	{
-		auto bak = planner_id_;
-		planner_id_ = PLANNER_ReRRT;
-		configSE3RigidBodyPlanning(setup, false);
-		planner_id_ = bak;
-	}
-	auto generic_planner = setup.getPlanner();
-	auto si = generic_planner->getSpaceInformation();
-	auto ss = si->getStateSpace();
+	std::lock_guard<std::mutex> lock(validator_mutex_);
+	prepareValidators();
 	Eigen::VectorXi ret;
 	ret.setZero(qs0.rows());
-	auto m0 = new Motion(si);
-	for (int i = 0; i < qs0.rows(); i++) {
-		ss->copyFromEigen3(m0->state, qs0.row(i));
-		if (si->isValid(m0->state))
-			ret(i) = 1;
+#pragma omp parallel
+	{
+		auto si = validator_setups_[omp_get_thread_num()]->getSpaceInformation();
+		auto ss = si->getStateSpace();
+		auto s0 = si->allocState();
+#pragma omp for schedule(dynamic, 16)
+		for (int i = 0; i < qs0.rows(); i++) {
+			ss->copyFromEigen3(s0, qs0.row(i));
+			if (si->isValid(s0))
+				ret(i) = 1;
+		}
+		si->freeState(s0);
 	}
-	delete m0;
 	return ret;
 }
 
@@ -593,29 +782,28 @@ Eigen::VectorXi
 OmplDriver::validateMotionPairs(const Eigen::MatrixXd& qs0,
                                 const Eigen::MatrixXd& qs1)
 {
-	ompl::app::SE3RigidBodyPlanning setup;
-	{
-		auto bak = planner_id_;
-		planner_id_ = PLANNER_ReRRT;
-		configSE3RigidBodyPlanning(setup, false);
-		planner_id_ = bak;
-	}
-	auto generic_planner = setup.getPlanner();
-	auto si = generic_planner->getSpaceInformation();
-	auto ss = si->getStateSpace();
-
+	std::lock_guard<std::mutex> lock(validator_mutex_);
+	prepareValidators();
 	Eigen::VectorXi ret;
 	ret.setZero(qs0.rows());
-	auto m0 = new Motion(si);
-	auto m1 = new Motion(si);
-	for (int i = 0; i < std::min(qs0.rows(), qs1.rows()); i++) {
-		ss->copyFromEigen3(m0->state, qs0.row(i));
-		ss->copyFromEigen3(m1->state, qs1.row(i));
-		if (si->checkMotion(m0->state, m1->state))
-			ret(i) = 1;
+	int N = std::min(qs0.rows(), qs1.rows());
+#pragma omp parallel
+	{
+		auto si = validator_setups_[omp_get_thread_num()]->getSpaceInformation();
+		auto ss = si->getStateSpace();
+		auto s0 = si->allocState();
+		auto s1 = si->allocState();
+		// Motion checks are much more expensive and uneven
+#pragma omp for schedule(dynamic, 1)
+		for (int i = 0; i < N; i++) {
+			ss->copyFromEigen3(s0, qs0.row(i));
+			ss->copyFromEigen3(s1, qs1.row(i));
+			if (si->checkMotion(s0, s1))
+				ret(i) = 1;
+		}
+		si->freeState(s0);
+		si->freeState(s1);
 	}
-	delete m0;
-	delete m1;
 	return ret;
 }
 
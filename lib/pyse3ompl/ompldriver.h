@@ -8,6 +8,7 @@
 
 #include <limits>
 #include <memory>
+#include <mutex>
 #include <stdint.h>
 #include <tuple>
 #include <Eigen/Core>
@@ -85,6 +86,7 @@ public:
 			                         + std::to_string(part_id));
 		}
 		model_files_[part_id] = fn;
+		resetValidators();
 	}
 
 	// set the state from R^3 translation and axis angle rotations.
@@ -110,10 +112,15 @@ public:
 	{
 		mins_ = mins;
 		maxs_ = maxs;
+		resetValidators();
 	}
 
 	// Collision detection resolution
-	void setCDRes(double cdres) { cdres_ = cdres; }
+	void setCDRes(double cdres)
+	{
+		cdres_ = cdres;
+		resetValidators();
+	}
 
 	// Set the option vector.
 	// Option vector is a list of strings designed to pass arguments to
@@ -173,12 +180,21 @@ public:
 	//   all IDs are 0-indexed
 	//
 	// Note: ex_graph_e_ will not be used, assuming each graph is connected.
+	//
+	// Version 7 runs in parallel, and only returns the edges that join
+	// two components of the merged forest.
 	Eigen::MatrixXi
 	mergeExistingGraph(int KNN,
 	                   bool verbose = false,
 	                   int version = 0,
 			   Eigen::VectorXi subset = Eigen::VectorXi());
 
+	//
+	// validateStates and validateMotionPairs run in parallel.
+	//
+	// Each thread owns one SE3RigidBodyPlanning object for validation,
+	// which is created at the first call and kept until the geometry,
+	// bounding box or CD resolution changes.
 	Eigen::VectorXi
 	validateStates(const Eigen::MatrixXd& qs0);
 
@@ -281,6 +297,20 @@ private:
 
 	void configSE3RigidBodyPlanning(ompl::app::SE3RigidBodyPlanning& setup, bool continuous = false);
 
+	/*
+	 * validateStates and validateMotionPairs release the GIL, so the pool
+	 * (and the motion counters of its validators) is guarded by
+	 * validator_mutex_.
+	 */
+	std::vector<std::unique_ptr<ompl::app::SE3RigidBodyPlanning>> validator_setups_;
+	std::mutex validator_mutex_;
+	void prepareValidators();
+	void resetValidators()
+	{
+		std::lock_guard<std::mutex> lock(validator_mutex_);
+		validator_setups_.clear();
+	}
+
 	Eigen::Matrix<int64_t, -1, 1> compact_nouveau_vertex_id_;
 	Eigen::MatrixXd compact_nouveau_vertices_;
 	Eigen::Matrix<int64_t, -1, 2> compact_edges_;
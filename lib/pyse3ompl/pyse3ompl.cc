@@ -4,6 +4,8 @@
  * SPDX-License-Identifier: GPL-2.0-or-later
  */
 #include "ompldriver.h"
+#include "forest_edge.h"
+#include "forest_sssp.h"
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/eigen.h>
@@ -41,6 +43,38 @@ PYBIND11_MODULE(pyse3ompl, m) {
 	m.attr("INIT_STATE") = py::int_(int(INIT_STATE));
 	m.attr("GOAL_STATE") = py::int_(int(GOAL_STATE));
 	m.attr("EXACT_SOLUTION") = py::int_(int(ompl::base::PlannerStatus::EXACT_SOLUTION));
+	m.def("build_forest_edges", &buildForestEdges,
+	      py::arg("ssc"),
+	      py::arg("pds_flags") = Eigen::Matrix<uint32_t, -1, 1>(),
+	      py::call_guard<py::gil_scoped_release>());
+	py::class_<ForestSSSP>(m, "ForestSSSP")
+		.def(py::init<Eigen::MatrixXd, Eigen::MatrixXd, Eigen::Matrix<uint32_t, -1, 1>>(),
+		     py::arg("roots"),
+		     py::arg("pds"),
+		     py::arg("pds_flags") = Eigen::Matrix<uint32_t, -1, 1>())
+		.def_readonly_static("OPEN_SPACE", &ForestSSSP::kOpenSpace)
+		.def_readonly_static("EXIT_AT_ROOT", &ForestSSSP::kExitAtRoot)
+		.def_readonly_static("EXIT_TO_OPEN_SPACE", &ForestSSSP::kExitToOpenSpace)
+		.def("set_forest_edges", &ForestSSSP::setForestEdges,
+		     py::arg("E"),
+		     py::arg("open_trees") = ForestRoots())
+		.def("solve_forest", &ForestSSSP::solveForest,
+		     py::arg("init_tree") = 0,
+		     py::arg("goal_tree") = 1,
+		     py::call_guard<py::gil_scoped_release>())
+		.def("get_forest_path", &ForestSSSP::getForestPath)
+		.def("get_forest_path_trees", &ForestSSSP::getForestPathTrees)
+		.def("add_tree", &ForestSSSP::addTree,
+		     py::arg("root"),
+		     py::arg("ssc"),
+		     py::arg("CNVI"),
+		     py::arg("CNV"),
+		     py::arg("CE"),
+		     py::call_guard<py::gil_scoped_release>())
+		.def("remove_tree", &ForestSSSP::removeTree)
+		.def("stitch_path", &ForestSSSP::stitchPath,
+		     py::call_guard<py::gil_scoped_release>())
+		;
 	py::class_<OmplDriver::PerformanceNumbers>(m, "PerformanceNumbers")
 		.def(py::init<>())
 		.def_readonly("planning_time", &OmplDriver::PerformanceNumbers::planning_time)
@@ -75,10 +109,12 @@ PYBIND11_MODULE(pyse3ompl, m) {
 		     py::arg("subset") = Eigen::VectorXi()
 		    )
 		.def("validate_states", &OmplDriver::validateStates,
-		     py::arg("qs0"))
+		     py::arg("qs0"),
+		     py::call_guard<py::gil_scoped_release>())
 		.def("validate_motion_pairs", &OmplDriver::validateMotionPairs,
 		     py::arg("qs0"),
-		     py::arg("qs1"))
+		     py::arg("qs1"),
+		     py::call_guard<py::gil_scoped_release>())
 		.def("set_sample_set", &OmplDriver::setSampleSet)
 		.def("set_sample_set_edges", &OmplDriver::setSampleSetEdges,
 		     py::arg("QB"),
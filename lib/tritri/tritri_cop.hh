@@ -1,6 +1,10 @@
 #include "tritri_cop.h"
 #include <cassert>
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include <vector>
+#include <omp.h>
 #include <igl/per_face_normals.h>
 #include <Eigen/Geometry>
 #include "tritri.h"
@@ -65,7 +69,10 @@ void TriTriCop(
 		d2s(j) = -Ns1.row(j).dot(V1.row(F1(j,0)));
 	}
 
+	std::vector<std::vector<Eigen::Triplet<T>>> thread_tups(omp_get_max_threads());
+#pragma omp parallel for schedule(dynamic, 64)
 	for (size_t i = 0; i < F0.rows(); i++) {
+		auto& tups = thread_tups[omp_get_thread_num()];
 		Vector3S N1 = Ns0.row(i);
 
 		// Moller97 use V for first triangle vertices
@@ -97,15 +104,159 @@ void TriTriCop(
 			Scalar dv0dv2 = dvs(0) * dvs(2);
 			if (dv0dv1>0.0f && dv0dv2>0.0f)
 				continue;
-			Vector3S D = N1.cross(N2);
 			if (!_coplanar_kernel(dvs(0), dvs(1), dvs(2), dv0dv1, dv0dv2))
 				continue;
 			tups.emplace_back(i, j, 1);
 		}
 	}
+	for (const auto& t : thread_tups)
+		tups.insert(tups.end(), t.begin(), t.end());
 	COP.setFromTriplets(tups.begin(), tups.end());
 }
 
+/*
+ * AABB tree over a set of boxes, for the broad phase of TriTriCopIsect.
+ *
+ * Nodes are stored in depth-first order, the left child of an internal node
+ * immediately follows its parent.
+ */
+template<typename Scalar>
+class _box_tree {
+public:
+	using Box = Eigen::AlignedBox<Scalar, 3>;
+
+	_box_tree(const std::vector<Box>& boxes)
+		:boxes_(boxes), order_(boxes.size())
+	{
+		for (size_t i = 0; i < order_.size(); i++)
+			order_[i] = int(i);
+		if (!boxes_.empty())
+			build(0, int(boxes_.size()));
+	}
+
+	// Call func(i) for every box i that intersects q
+	// stack is the traversal buffer, reused across queries by the caller
+	template<typename Func>
+	void query(const Box& q, std::vector<int>& stack, Func func) const
+	{
+		if (nodes_.empty())
+			return;
+		stack.assign(1, 0);
+		while (!stack.empty()) {
+			int index = stack.back();
+			stack.pop_back();
+			const Node& node = nodes_[index];
+			if (!node.box.intersects(q))
+				continue;
+			if (node.count > 0) {
+				for (int k = node.first; k < node.first + node.count; k++)
+					if (boxes_[order_[k]].intersects(q))
+						func(order_[k]);
+				continue;
+			}
+			stack.emplace_back(node.first);
+			stack.emplace_back(index + 1);
+		}
+	}
+private:
+	static constexpr int kLeafSize = 8;
+
+	struct Node {
+		Box box;
+		int first;  // leaf: first item in order_; internal: right child
+		int count;  // leaf: number of boxes; internal: 0
+	};
+
+	const std::vector<Box>& boxes_;
+	std::vector<int> order_;
+	std::vector<Node> nodes_;
+
+	int build(int begin, int end)
+	{
+		int index = int(nodes_.size());
+		nodes_.emplace_back();
+		Node node;
+		node.box.setEmpty();
+		Box centers;
+		centers.setEmpty();
+		for (int k = begin; k < end; k++) {
+			node.box.extend(boxes_[order_[k]]);
+			centers.extend(boxes_[order_[k]].center());
+		}
+		if (end - begin <= kLeafSize) {
+			node.first = begin;
+			node.count = end - begin;
+			nodes_[index] = node;
+			return index;
+		}
+		int axis;
+		centers.sizes().maxCoeff(&axis);
+		int mid = begin + (end - begin) / 2;
+		std::nth_element(order_.begin() + begin, order_.begin() + mid, order_.begin() + end,
+		                 [this, axis](int a, int b) {
+		                         return boxes_[a].center()(axis) < boxes_[b].center()(axis);
+		                 });
+		node.count = 0;
+		build(begin, mid);
+		node.first = build(mid, end);
+		nodes_[index] = node;
+		return index;
+	}
+};
+
+/*
+ * Boxes of faces for the broad phase.
+ *
+ * TriTriIntersect treats a vertex as on the plane of the other triangle if
+ * its distance is less than EPSILON / |N|, where N is the unnormalized
+ * normal. Hence coplanar triangles may be apart by this distance (times
+ * sqrt(3) along an axis), and each box is inflated by twice of it.
+ *
+ * Degenerate faces (N = 0, or non-finite boxes) may be reported coplanar
+ * with faces anywhere, so they get an empty box, which never overlaps and
+ * keeps the tree finite, and are listed in degenerate to be tested against
+ * all faces.
+ */
+template<typename DerivedV, typename DerivedF>
+std::vector<Eigen::AlignedBox<typename DerivedV::Scalar, 3>>
+_face_boxes(const Eigen::MatrixBase<DerivedV>& V,
+            const Eigen::MatrixBase<DerivedF>& F,
+            std::vector<int>& degenerate)
+{
+	using Scalar = typename DerivedV::Scalar;
+	using Vector3S = Eigen::Matrix<Scalar, 3, 1>;
+	std::vector<Eigen::AlignedBox<Scalar, 3>> boxes(F.rows());
+	degenerate.clear();
+	for (int i = 0; i < int(F.rows()); i++) {
+		Vector3S v0 = V.row(F(i, 0));
+		Vector3S v1 = V.row(F(i, 1));
+		Vector3S v2 = V.row(F(i, 2));
+		Scalar n = (v1 - v0).cross(v2 - v0).norm();
+		boxes[i].setEmpty();
+		if (!(n > 0)) {
+			degenerate.emplace_back(i);
+			continue;
+		}
+		Scalar margin = Scalar(2 * EPSILON) / n;
+		boxes[i].extend(v0);
+		boxes[i].extend(v1);
+		boxes[i].extend(v2);
+		boxes[i].min().array() -= margin;
+		boxes[i].max().array() += margin;
+		if (!boxes[i].min().allFinite() || !boxes[i].max().allFinite()) {
+			boxes[i].setEmpty();
+			degenerate.emplace_back(i);
+		}
+	}
+	return boxes;
+}
+
+/*
+ * Only pairs of faces with overlapping boxes can intersect. Candidates are
+ * found with an AABB tree over the faces of mesh 1, and the exact test of
+ * Moller97 is run on them in parallel. Degenerate faces (see _face_boxes)
+ * are tested against every face of the other mesh.
+ */
 template<
 	typename DerivedV0,
 	typename DerivedF0,
@@ -128,25 +279,50 @@ void TriTriCopIsect(
 
 	using Scalar = typename DerivedV0::Scalar;
 	using Vector3S = Eigen::Matrix<Scalar, 3, 1>;
-	Vector3S isectpt0, isectpt1;
-	int cop;
-	for (size_t i = 0; i < F0.rows(); i++) {
-		Vector3S v0 = V0.row(F0(i, 0));
-		Vector3S v1 = V0.row(F0(i, 1));
-		Vector3S v2 = V0.row(F0(i, 2));
-		for (size_t j = 0; j < F1.rows(); j++) {
-			Vector3S u0 = V1.row(F1(j, 0));
-			Vector3S u1 = V1.row(F1(j, 1));
-			Vector3S u2 = V1.row(F1(j, 2));
-			bool isect = TriTriIntersect(v0, v1, v2,
-			                             u0, u1, u2,
-			                             &cop,
-			                             isectpt0, isectpt1);
-			if (isect and cop) {
-				tups.emplace_back(i, j, 1);
+	std::vector<int> degenerate0, degenerate1;
+	auto boxes0 = _face_boxes(V0, F0, degenerate0);
+	auto boxes1 = _face_boxes(V1, F1, degenerate1);
+	_box_tree<Scalar> tree1(boxes1);
+	std::vector<bool> is_degenerate0(F0.rows(), false);
+	for (int i : degenerate0)
+		is_degenerate0[i] = true;
+
+	std::vector<std::vector<Eigen::Triplet<T>>> thread_tups(omp_get_max_threads());
+#pragma omp parallel
+	{
+		auto& tups = thread_tups[omp_get_thread_num()];
+		std::vector<int> stack;
+#pragma omp for schedule(dynamic, 64)
+		for (int i = 0; i < int(F0.rows()); i++) {
+			Vector3S isectpt0, isectpt1;
+			int cop;
+			Vector3S v0 = V0.row(F0(i, 0));
+			Vector3S v1 = V0.row(F0(i, 1));
+			Vector3S v2 = V0.row(F0(i, 2));
+			auto test = [&](int j) {
+				Vector3S u0 = V1.row(F1(j, 0));
+				Vector3S u1 = V1.row(F1(j, 1));
+				Vector3S u2 = V1.row(F1(j, 2));
+				bool isect = TriTriIntersect(v0, v1, v2,
+				                             u0, u1, u2,
+				                             &cop,
+				                             isectpt0, isectpt1);
+				if (isect and cop) {
+					tups.emplace_back(i, j, 1);
+				}
+			};
+			if (is_degenerate0[i]) {
+				for (int j = 0; j < int(F1.rows()); j++)
+					test(j);
+				continue;
 			}
+			tree1.query(boxes0[i], stack, test);
+			for (int j : degenerate1)
+				test(j);
 		}
 	}
+	for (const auto& t : thread_tups)
+		tups.insert(tups.end(), t.begin(), t.end());
 	COP.setFromTriplets(tups.begin(), tups.end());
 }
 
@@ -0,0 +1,436 @@
+/**
+ * SPDX-FileCopyrightText: Copyright © 2020 The University of Texas at Austin
+ * SPDX-FileContributor: Xinya Zhang <xinyazhang@utexas.edu>
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+#ifndef VECIO_ROADMAP_H
+#define VECIO_ROADMAP_H
+
+/*
+ * Binary roadmap container
+ *
+ * Layout, all sections are 64-byte aligned:
+ *      Header
+ *      double   vertices[n_vertices][dim]
+ *      int64_t  edge_offsets[n_vertices + 1]  CSR over the source vertex
+ *      int32_t  edge_targets[n_edges]
+ *      int32_t  pending[n_pending][2]
+ *
+ * The CSR stores each edge once, under its first vertex, so the edge list of
+ * a text roadmap survives a round trip up to the order of edges.
+ *
+ * Files are written and read through mmap. RoadMapFile keeps the file mapped
+ * and exposes the sections in place. Opening a roadmap validates the layout,
+ * the CSR offsets and every stored vertex index once, so the accessors never
+ * read out of the mapping and callers may index with the stored values.
+ *
+ * The text format has one element per line:
+ *      v <dim numbers>
+ *      e <from> <to>
+ *      p <from> <to>       (pending edge, not verified yet)
+ */
+
+#include <Eigen/Core>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <cstdlib>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace vecio {
+
+class RoadMapFile {
+public:
+	using Edge = std::pair<int, int>;
+	using VMatrix = Eigen::Matrix<double, -1, -1, Eigen::RowMajor>;
+	using VMap = Eigen::Map<const VMatrix>;
+
+	static const uint32_t kVersion = 1;
+
+	struct Header {
+		char magic[8];
+		uint32_t version;
+		uint32_t dim;
+		uint32_t flags;     // Unused, 0
+		uint32_t reserved;
+		uint64_t n_vertices;
+		uint64_t n_edges;
+		uint64_t n_pending;
+		uint64_t vertices_off;
+		uint64_t offsets_off;
+		uint64_t targets_off;
+		uint64_t pending_off;
+		uint64_t total_size;
+	};
+
+	explicit RoadMapFile(const std::string& fn)
+	{
+		int fd = ::open(fn.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("Cannot open " + fn + ": " + strerror(errno));
+		struct stat st;
+		if (::fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(Header)) {
+			::close(fd);
+			throw std::runtime_error(fn + " is not a binary roadmap");
+		}
+		mapped_size_ = st.st_size;
+		mapped_ = ::mmap(nullptr, mapped_size_, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (mapped_ == MAP_FAILED)
+			throw std::runtime_error("Cannot mmap " + fn + ": " + strerror(errno));
+		h_ = static_cast<const Header*>(mapped_);
+		if (memcmp(h_->magic, magic(), sizeof(h_->magic)) != 0 ||
+		    h_->version != kVersion ||
+		    h_->total_size != mapped_size_) {
+			::munmap(mapped_, mapped_size_);
+			throw std::runtime_error(fn + " is not a binary roadmap of version "
+			                         + std::to_string(kVersion)
+			                         + " or is truncated");
+		}
+		const char* err = validate();
+		if (err) {
+			::munmap(mapped_, mapped_size_);
+			throw std::runtime_error(fn + " is a corrupted binary roadmap: " + err);
+		}
+	}
+
+	~RoadMapFile()
+	{
+		::munmap(mapped_, mapped_size_);
+	}
+
+	RoadMapFile(const RoadMapFile&) = delete;
+	RoadMapFile& operator=(const RoadMapFile&) = delete;
+
+	int dim() const { return h_->dim; }
+	size_t numVertices() const { return h_->n_vertices; }
+	size_t numEdges() const { return h_->n_edges; }
+	size_t numPending() const { return h_->n_pending; }
+
+	VMap vertices() const
+	{
+		return VMap(section<double>(h_->vertices_off), h_->n_vertices, h_->dim);
+	}
+
+	const double* vertex(size_t i) const
+	{
+		return section<double>(h_->vertices_off) + i * h_->dim;
+	}
+
+	// Edges from vertex i are targets()[offsets()[i], offsets()[i+1])
+	const int64_t* offsets() const { return section<int64_t>(h_->offsets_off); }
+	const int32_t* targets() const { return section<int32_t>(h_->targets_off); }
+
+	Edge pending(size_t i) const
+	{
+		const int32_t* p = section<int32_t>(h_->pending_off) + 2 * i;
+		return Edge(p[0], p[1]);
+	}
+
+	template<typename Func>
+	void forEachEdge(Func func) const
+	{
+		const int64_t* off = offsets();
+		const int32_t* tgt = targets();
+		for (size_t from = 0; from < h_->n_vertices; from++)
+			for (int64_t k = off[from]; k < off[from + 1]; k++)
+				func(int(from), int(tgt[k]));
+	}
+
+	static bool isRoadMapFile(const std::string& fn)
+	{
+		char buf[sizeof(Header::magic)];
+		int fd = ::open(fn.c_str(), O_RDONLY);
+		if (fd < 0)
+			return false;
+		bool ret = ::read(fd, buf, sizeof(buf)) == ssize_t(sizeof(buf)) &&
+		           memcmp(buf, magic(), sizeof(buf)) == 0;
+		::close(fd);
+		return ret;
+	}
+
+	/*
+	 * Write a roadmap, V is n_vertices x dim and row major.
+	 *
+	 * The file is created as fn.tmp.<pid>, filled through mmap, and then
+	 * renamed to fn.
+	 */
+	static void write(const std::string& fn,
+	                  const double* V,
+	                  size_t n_vertices,
+	                  int dim,
+	                  const std::vector<Edge>& edges,
+	                  const std::vector<Edge>& pending)
+	{
+		auto check = [n_vertices](const std::vector<Edge>& list, const char* what) {
+			for (const auto& e : list) {
+				if (e.first < 0 || size_t(e.first) >= n_vertices ||
+				    e.second < 0 || size_t(e.second) >= n_vertices)
+					throw std::runtime_error(std::string("RoadMapFile::write: invalid ") + what + " ("
+					                         + std::to_string(e.first) + ", "
+					                         + std::to_string(e.second) + ") with "
+					                         + std::to_string(n_vertices) + " vertices");
+			}
+		};
+		check(edges, "edge");
+		check(pending, "pending edge");
+		Header h;
+		memset(&h, 0, sizeof(h));
+		memcpy(h.magic, magic(), sizeof(h.magic));
+		h.version = kVersion;
+		h.dim = dim;
+		h.n_vertices = n_vertices;
+		h.n_edges = edges.size();
+		h.n_pending = pending.size();
+		h.vertices_off = align(sizeof(Header));
+		h.offsets_off = align(h.vertices_off + n_vertices * dim * sizeof(double));
+		h.targets_off = align(h.offsets_off + (n_vertices + 1) * sizeof(int64_t));
+		h.pending_off = align(h.targets_off + edges.size() * sizeof(int32_t));
+		h.total_size = h.pending_off + pending.size() * 2 * sizeof(int32_t);
+
+		std::string tmp_fn = fn + ".tmp." + std::to_string(getpid());
+		int fd = ::open(tmp_fn.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			throw std::runtime_error("Cannot create " + tmp_fn + ": " + strerror(errno));
+		if (::ftruncate(fd, h.total_size) < 0) {
+			int err = errno;
+			::close(fd);
+			::unlink(tmp_fn.c_str());
+			throw std::runtime_error("Cannot resize " + tmp_fn + ": " + strerror(err));
+		}
+		void* mapped = ::mmap(nullptr, h.total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (mapped == MAP_FAILED) {
+			int err = errno;
+			::unlink(tmp_fn.c_str());
+			throw std::runtime_error("Cannot mmap " + tmp_fn + ": " + strerror(err));
+		}
+		char* base = static_cast<char*>(mapped);
+		memcpy(base, &h, sizeof(h));
+		if (n_vertices > 0)
+			memcpy(base + h.vertices_off, V, n_vertices * dim * sizeof(double));
+		// Counting sort of edges by the source vertex
+		int64_t* off = reinterpret_cast<int64_t*>(base + h.offsets_off);
+		int32_t* tgt = reinterpret_cast<int32_t*>(base + h.targets_off);
+		for (const auto& e : edges)
+			off[e.first + 1]++;
+		for (size_t i = 0; i < n_vertices; i++)
+			off[i + 1] += off[i];
+		std::vector<int64_t> tails(off, off + n_vertices);
+		for (const auto& e : edges)
+			tgt[tails[e.first]++] = e.second;
+		int32_t* pend = reinterpret_cast<int32_t*>(base + h.pending_off);
+		for (size_t i = 0; i < pending.size(); i++) {
+			pend[2 * i + 0] = pending[i].first;
+			pend[2 * i + 1] = pending[i].second;
+		}
+		::munmap(mapped, h.total_size);
+		if (::rename(tmp_fn.c_str(), fn.c_str()) < 0) {
+			int err = errno;
+			::unlink(tmp_fn.c_str());
+			throw std::runtime_error("Cannot rename " + tmp_fn + " to " + fn + ": " + strerror(err));
+		}
+	}
+
+	/*
+	 * Convert a text roadmap to the binary format. dim is detected from
+	 * the first vertex.
+	 *
+	 * Like the text loaders, 'e' lines are taken as verified edges and 'p'
+	 * lines as pending ones.
+	 */
+	static void convertText(const std::string& text_fn,
+	                        const std::string& fn)
+	{
+		int fd = ::open(text_fn.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("Cannot open " + text_fn + ": " + strerror(errno));
+		struct stat st;
+		if (::fstat(fd, &st) < 0) {
+			::close(fd);
+			throw std::runtime_error("Cannot stat " + text_fn + ": " + strerror(errno));
+		}
+		size_t size = st.st_size;
+		void* mapped = nullptr;
+		if (size > 0)
+			mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (mapped == MAP_FAILED)
+			throw std::runtime_error("Cannot mmap " + text_fn + ": " + strerror(errno));
+		const char* p = static_cast<const char*>(mapped);
+		const char* end = p + size;
+
+		std::vector<double> V;
+		std::vector<Edge> edges, pending;
+		int dim = -1;
+		std::string last_line;
+		while (p < end) {
+			const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+			const char* line = p;
+			if (!eol) {
+				// The last line has no '\n' to stop strto*, copy it
+				last_line.assign(p, end);
+				line = last_line.c_str();
+				eol = line + last_line.size();
+				p = end;
+			} else {
+				p = eol + 1;
+			}
+			while (line < eol && (*line == ' ' || *line == '\t' || *line == '\r'))
+				line++;
+			if (line >= eol)
+				continue;
+			char type = *line++;
+			if (type == 'v') {
+				int n = 0;
+				double d;
+				while (parseCoordinate(line, eol, d)) {
+					V.emplace_back(d);
+					n++;
+				}
+				if (dim < 0)
+					dim = n;
+				if (n != dim) {
+					::munmap(mapped, size);
+					throw std::runtime_error(text_fn + ": inconsistent vertex dimension");
+				}
+			} else if (type == 'e' || type == 'p') {
+				Edge e;
+				if (!parseIndex(line, eol, e.first) ||
+				    !parseIndex(line, eol, e.second)) {
+					::munmap(mapped, size);
+					throw std::runtime_error(text_fn + ": malformed '" + type + "' line");
+				}
+				(type == 'e' ? edges : pending).emplace_back(e);
+			}
+		}
+		if (mapped)
+			::munmap(mapped, size);
+		if (dim <= 0)
+			dim = 0;
+		size_t NV = dim > 0 ? V.size() / dim : 0;
+		write(fn, V.data(), NV, dim, edges, pending);
+	}
+private:
+	/*
+	 * Parse an integer of the current line and advance s. Unlike a bare
+	 * strtol, this never crosses eol to take a number from the next line.
+	 */
+	static bool parseIndex(const char*& s, const char* eol, int& out)
+	{
+		while (s < eol && (*s == ' ' || *s == '\t'))
+			s++;
+		if (s >= eol || !(*s == '-' || *s == '+' || (*s >= '0' && *s <= '9')))
+			return false;
+		char* next;
+		errno = 0;
+		long v = strtol(s, &next, 10);
+		if (next == s || next > eol || errno == ERANGE ||
+		    v < std::numeric_limits<int>::min() || v > std::numeric_limits<int>::max())
+			return false;
+		s = next;
+		out = int(v);
+		return true;
+	}
+
+	/*
+	 * Same as parseIndex, for vertex coordinates. All blanks before the
+	 * number are skipped here, so strtod starts at a non-blank character
+	 * before eol and cannot skip the '\n' into the next line, or out of
+	 * the mapping at the end of the file.
+	 */
+	static bool parseCoordinate(const char*& s, const char* eol, double& out)
+	{
+		while (s < eol && (*s == ' ' || *s == '\t' || *s == '\r' ||
+		                   *s == '\v' || *s == '\f'))
+			s++;
+		if (s >= eol)
+			return false;
+		char* next;
+		double v = strtod(s, &next);
+		if (next == s || next > eol)
+			return false;
+		s = next;
+		out = v;
+		return true;
+	}
+
+	/*
+	 * Returns nullptr if the header and sections are consistent, or the
+	 * reason otherwise.
+	 */
+	const char* validate() const
+	{
+		const uint64_t size = mapped_size_;
+		// count elements of elem bytes at off, without overflow
+		auto fits = [size](uint64_t off, uint64_t count, uint64_t elem) {
+			return off % 64 == 0 && off <= size && count <= (size - off) / elem;
+		};
+		if (h_->n_vertices > uint64_t(std::numeric_limits<int32_t>::max()))
+			return "too many vertices";
+		if (h_->n_vertices > 0 && h_->dim == 0)
+			return "zero dimension";
+		if (h_->vertices_off < sizeof(Header) ||
+		    h_->offsets_off < h_->vertices_off ||
+		    h_->targets_off < h_->offsets_off ||
+		    h_->pending_off < h_->targets_off)
+			return "sections out of order";
+		if (h_->dim > 0 && h_->n_vertices > std::numeric_limits<uint64_t>::max() / h_->dim)
+			return "vertex section too large";
+		if (!fits(h_->vertices_off, h_->n_vertices * h_->dim, sizeof(double)) ||
+		    !fits(h_->offsets_off, h_->n_vertices + 1, sizeof(int64_t)) ||
+		    !fits(h_->targets_off, h_->n_edges, sizeof(int32_t)) ||
+		    h_->n_pending > std::numeric_limits<uint64_t>::max() / 2 ||
+		    !fits(h_->pending_off, h_->n_pending * 2, sizeof(int32_t)))
+			return "section out of the file";
+		if (h_->vertices_off + h_->n_vertices * h_->dim * sizeof(double) > h_->offsets_off ||
+		    h_->offsets_off + (h_->n_vertices + 1) * sizeof(int64_t) > h_->targets_off ||
+		    h_->targets_off + h_->n_edges * sizeof(int32_t) > h_->pending_off)
+			return "overlapping sections";
+		const int64_t* off = offsets();
+		if (off[0] != 0 || uint64_t(off[h_->n_vertices]) != h_->n_edges)
+			return "edge offsets do not cover the edges";
+		for (uint64_t i = 0; i < h_->n_vertices; i++)
+			if (off[i + 1] < off[i])
+				return "decreasing edge offsets";
+		const int64_t nv = int64_t(h_->n_vertices);
+		const int32_t* tgt = targets();
+		for (uint64_t i = 0; i < h_->n_edges; i++)
+			if (tgt[i] < 0 || tgt[i] >= nv)
+				return "edge target out of range";
+		const int32_t* pend = section<int32_t>(h_->pending_off);
+		for (uint64_t i = 0; i < h_->n_pending * 2; i++)
+			if (pend[i] < 0 || pend[i] >= nv)
+				return "pending edge out of range";
+		return nullptr;
+	}
+
+	void* mapped_ = nullptr;
+	size_t mapped_size_ = 0;
+	const Header* h_ = nullptr;
+
+	template<typename T>
+	const T* section(uint64_t off) const
+	{
+		return reinterpret_cast<const T*>(static_cast<const char*>(mapped_) + off);
+	}
+
+	static const char* magic() { return "OSRRMP01"; }
+
+	static uint64_t align(uint64_t off)
+	{
+		return (off + 63) & ~uint64_t(63);
+	}
+};
+
+}
+
+#endif
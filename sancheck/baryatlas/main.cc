@@ -0,0 +1,106 @@
+/*
+ * Splats the same weighted barycentric samples with the GL
+ * Renderer::renderBarycentric and with osr::CpuRenderer (BaryAtlas).
+ *
+ * The CPU atlas is rendered once halfway through as well, so the final
+ * atlas exercises the incremental splatting.
+ *
+ * Usage: sancheck_baryatlas <env OBJ> <rob OBJ with UV>
+ */
+#include <osr/osr_render.h>
+#include <osr/osr_cpu_render.h>
+#include <osr/osr_init.h>
+#include <random>
+#include <stdio.h>
+#include "sancheck_common.h"
+
+using osr::UnitWorld;
+
+const double kMaxMismatchRatio = 0.01;
+
+template<typename R>
+void load(R& r, const char* env, const char* rob)
+{
+	r.loadModelFromFile(env);
+	r.loadRobotFromFile(rob);
+	r.scaleToUnit();
+	r.angleModel(0.0f, 0.0f);
+}
+
+/*
+ * Random small triangles in random faces of F
+ */
+void random_samples(std::mt19937& gen, const UnitWorld::FMatrix& F, int n,
+                    UnitWorld::FMatrix& SF, UnitWorld::VMatrix& SV)
+{
+	std::uniform_int_distribution<int> face(0, int(F.rows()) - 1);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+	SF.resize(n, 3);
+	SV.resize(n * 3, 3);
+	for (int i = 0; i < n; i++) {
+		SF.row(i) = F.row(face(gen));
+		for (int k = 0; k < 3; k++) {
+			double a = unit(gen), b = unit(gen);
+			if (a + b > 1.0) {
+				a = 1.0 - a;
+				b = 1.0 - b;
+			}
+			SV.row(3 * i + k) << 1.0 - a - b, a, b;
+		}
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <env OBJ> <rob OBJ with UV>\n", argv[0]);
+		return 1;
+	}
+	osr::init();
+	auto dpy = osr::create_display();
+	if (dpy == EGL_NO_DISPLAY) {
+		return -1;
+	}
+	osr::create_gl_context(dpy);
+	osr::Renderer gl;
+	gl.setup();
+	load(gl, argv[1], argv[2]);
+	osr::CpuRenderer cpu;
+	load(cpu, argv[1], argv[2]);
+
+	const uint32_t target = osr::Renderer::BARY_RENDERING_ROBOT;
+	const Eigen::Vector2i res(512, 512);
+	osr::StateVector q;
+	q << 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0;
+	UnitWorld::FMatrix F = std::get<1>(cpu.getRobotGeometry(q, true));
+
+	std::mt19937 gen(1);
+	const int nbatches = 8;
+	for (int b = 0; b < nbatches; b++) {
+		UnitWorld::FMatrix SF;
+		UnitWorld::VMatrix SV;
+		random_samples(gen, F, 1000, SF, SV);
+		float weight = 1.0f + b;
+		gl.addBarycentric(SF, SV, target, weight);
+		cpu.addBarycentric(SF, SV, target, weight);
+		if (b == nbatches / 2)
+			(void)cpu.renderBarycentric(target, res);
+	}
+	auto gl_atlas = gl.renderBarycentric(target, res);
+	auto cpu_atlas = cpu.renderBarycentric(target, res);
+
+	if (gl_atlas.rows() != cpu_atlas.rows() || gl_atlas.cols() != cpu_atlas.cols()) {
+		printf("MISMATCH: shape %ldx%ld vs %ldx%ld\n",
+		       long(gl_atlas.rows()), long(gl_atlas.cols()),
+		       long(cpu_atlas.rows()), long(cpu_atlas.cols()));
+		return 1;
+	}
+	long bad = sancheck::count_different_pixels(gl_atlas, cpu_atlas, 1, 1e-3);
+	double ratio = double(bad) / double(gl_atlas.size());
+	printf("atlas sum: GL %f, CPU %f\n", gl_atlas.sum(), cpu_atlas.sum());
+	printf("%ld/%ld texels differ (%.3f%%)\n", bad, long(gl_atlas.size()), ratio * 100.0);
+
+	gl.teardown();
+	osr::shutdown();
+	return sancheck::report(ratio > kMaxMismatchRatio ? bad : 0, "texels");
+}
@@ -0,0 +1,89 @@
+#ifndef SANCHECK_COMMON_H
+#define SANCHECK_COMMON_H
+
+/*
+ * Helpers of the sanchecks that compare an optimized code path against a
+ * reference implementation. Available to every SANCHECK target as
+ * #include "sancheck_common.h".
+ */
+
+#include <Eigen/Core>
+#include <chrono>
+#include <cmath>
+#include <random>
+#include <stdio.h>
+
+namespace sancheck {
+
+class Timer {
+public:
+	Timer() : t0_(std::chrono::steady_clock::now()) {}
+
+	// Seconds since the construction or the previous lap()
+	double lap()
+	{
+		auto now = std::chrono::steady_clock::now();
+		double ret = std::chrono::duration<double>(now - t0_).count();
+		t0_ = now;
+		return ret;
+	}
+private:
+	std::chrono::steady_clock::time_point t0_;
+};
+
+/*
+ * n random SE(3) states, one per row: the translation is uniform in
+ * [-extent, extent]^3, followed by a uniformly distributed unit quaternion.
+ */
+template<typename Matrix>
+Matrix random_se3(std::mt19937& gen, int n, double extent)
+{
+	std::uniform_real_distribution<double> pos(-extent, extent);
+	std::normal_distribution<double> normal;
+	Matrix qs(n, 7);
+	for (int i = 0; i < n; i++) {
+		Eigen::Vector4d q(normal(gen), normal(gen), normal(gen), normal(gen));
+		q.normalize();
+		qs.row(i) << pos(gen), pos(gen), pos(gen), q(0), q(1), q(2), q(3);
+	}
+	return qs;
+}
+
+/*
+ * Number of pixels with any of their channels differing by more than tol.
+ * Both matrices store the channels of a pixel contiguously.
+ */
+template<typename Matrix>
+long count_different_pixels(const Matrix& a, const Matrix& b, int channels, double tol)
+{
+	long npixels = a.size() / channels;
+	long ret = 0;
+	for (long p = 0; p < npixels; p++) {
+		for (int c = 0; c < channels; c++) {
+			if (std::abs(double(a.data()[p * channels + c]) -
+			             double(b.data()[p * channels + c])) > tol) {
+				ret++;
+				break;
+			}
+		}
+	}
+	return ret;
+}
+
+/*
+ * Prints the verdict and returns the exit status of the sancheck.
+ * what names the unit of bad, e.g. "queries".
+ */
+inline int report(long bad, const char* what)
+{
+	if (bad > 0) {
+		printf("MISMATCH: %ld %s\n", bad, what);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
+
+}
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ * Renders the same models and views with osr::Renderer (GL) and
+ * osr::CpuRenderer, and compares depth, UV feedback and the face ids of
+ * UV mapping rendering.
+ *
+ * Pixel centers on triangle edges may be covered by rasterization but
+ * missed by ray casting, so up to kMaxMismatchRatio of the pixels may
+ * differ.
+ *
+ * Usage: sancheck_cpurender <env OBJ> <rob OBJ>
+ */
+#include <osr/osr_render.h>
+#include <osr/osr_cpu_render.h>
+#include <osr/osr_init.h>
+#include <stdio.h>
+#include "sancheck_common.h"
+
+const double kMaxMismatchRatio = 0.01;
+
+template<typename R>
+void setup_views(R& r, const char* env, const char* rob)
+{
+	r.loadModelFromFile(env);
+	r.loadRobotFromFile(rob);
+	r.scaleToUnit();
+	r.angleModel(0.0f, 0.0f);
+	r.views.resize(4, 2);
+	r.views << 0.0, 0.0,
+	           30.0, 45.0,
+	           -30.0, 120.0,
+	           60.0, 270.0;
+	osr::StateVector q;
+	q << 0.1, -0.1, 0.05, 1.0, 0.0, 0.0, 0.0;
+	r.setRobotState(q);
+}
+
+/*
+ * Returns true if the mismatch ratio is acceptable
+ */
+template<typename Matrix>
+bool compare(const char* name, const Matrix& gl, const Matrix& cpu, int channels, double tol)
+{
+	if (gl.rows() != cpu.rows() || gl.cols() != cpu.cols()) {
+		printf("%s: MISMATCH: shape %ldx%ld vs %ldx%ld\n", name,
+		       long(gl.rows()), long(gl.cols()), long(cpu.rows()), long(cpu.cols()));
+		return false;
+	}
+	long npixels = gl.size() / channels;
+	long bad = sancheck::count_different_pixels(gl, cpu, channels, tol);
+	double ratio = double(bad) / double(npixels);
+	printf("%s: %ld/%ld pixels differ (%.3f%%)\n", name, bad, npixels, ratio * 100.0);
+	return ratio <= kMaxMismatchRatio;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <env OBJ> <rob OBJ>\n", argv[0]);
+		return 1;
+	}
+	osr::init();
+	auto dpy = osr::create_display();
+	if (dpy == EGL_NO_DISPLAY) {
+		return -1;
+	}
+	osr::create_gl_context(dpy);
+	osr::Renderer gl;
+	gl.setup();
+	setup_views(gl, argv[1], argv[2]);
+	osr::CpuRenderer cpu;
+	setup_views(cpu, argv[1], argv[2]);
+
+	int failed = 0;
+	gl.render_mvrgbd(osr::Renderer::UV_FEEDBACK);
+	cpu.render_mvrgbd(osr::CpuRenderer::UV_FEEDBACK);
+	failed += !compare("depth", gl.mvdepth, cpu.mvdepth, 1, 1e-3);
+	failed += !compare("uv", gl.mvuv, cpu.mvuv, 2, 1e-3);
+
+	gl.render_mvrgbd(osr::Renderer::UV_MAPPINNG_RENDERING);
+	cpu.render_mvrgbd(osr::CpuRenderer::UV_MAPPINNG_RENDERING);
+	failed += !compare("pid", gl.mvpid, cpu.mvpid, 1, 0.5);
+
+	auto gl_depth = gl.render_mvdepth_to_buffer();
+	auto cpu_depth = cpu.render_mvdepth_to_buffer();
+	failed += !compare("mvdepth", gl_depth, cpu_depth, 1, 1e-3);
+
+	gl.teardown();
+	osr::shutdown();
+	return sancheck::report(failed, "buffers over the threshold");
+}
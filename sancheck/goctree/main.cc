@@ -0,0 +1,106 @@
+/*
+ * Checks GOctreePathBuilder::buildOcTree with multiple clearance calculators
+ *
+ * With batch = 1 the parallel builder must split the same cubes in the same
+ * order as the serial one, hence the paths are identical. With the default
+ * batch the path may differ but must still connect init and goal.
+ */
+#include <Eigen/Core>
+#include <goct/goctree.h>
+#include <goct/gbuilder.h>
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sancheck_common.h"
+
+template<int ND, typename FLOAT>
+struct TranslationOnlySpace {
+	typedef Eigen::Matrix<FLOAT, ND, 1> Coord;
+	static Coord transist(const Coord& center, const Coord& delta)
+	{
+		return center + delta;
+	}
+};
+
+/*
+ * A wall at |x| < 0.5 with a gap at 3 < y < 3.3. The certain cube is the
+ * L-infinity distance to the boundary of the obstacles.
+ */
+class WallClearance {
+public:
+	Eigen::Vector2d getCertainCube(const Eigen::Vector2d& s, bool& isfree) const
+	{
+		const double lo[2][2] = { {-0.5, -10.0}, {-0.5, 3.3} };
+		const double hi[2][2] = { { 0.5,   3.0}, { 0.5, 10.0} };
+		double d = 1e9;
+		isfree = true;
+		for (int b = 0; b < 2; b++) {
+			double outside = 0.0;
+			double inside = 1e9;
+			for (int i = 0; i < 2; i++) {
+				outside = std::max(outside, std::max(lo[b][i] - s(i), s(i) - hi[b][i]));
+				inside = std::min(inside, std::min(s(i) - lo[b][i], hi[b][i] - s(i)));
+			}
+			if (outside > 0) {
+				d = std::min(d, outside);
+			} else {
+				isfree = false;
+				d = inside;
+				break;
+			}
+		}
+		return Eigen::Vector2d(d, d);
+	}
+};
+
+using Builder = GOctreePathBuilder<2, double, WallClearance, TranslationOnlySpace<2, double>>;
+
+std::vector<Eigen::VectorXd> solve(std::vector<WallClearance>& ccs, int batch, double& seconds)
+{
+	std::vector<WallClearance*> ccptrs;
+	for (auto& cc : ccs)
+		ccptrs.emplace_back(&cc);
+	Builder builder;
+	Builder::Coord mins, maxs, res, init, goal;
+	mins << -10.0, -10.0;
+	maxs << 10.0, 10.0;
+	res = (maxs - mins) / 4096.0;
+	init << -5.0, -5.0;
+	goal << 5.0, 5.0;
+	builder.setupSpace(mins, maxs, res);
+	builder.setupInit(init);
+	builder.setupGoal(goal);
+	sancheck::Timer timer;
+	builder.buildOcTree(ccptrs, batch);
+	seconds = timer.lap();
+	return builder.buildPath();
+}
+
+int main(int argc, char* argv[])
+{
+	int nworkers = argc > 1 ? atoi(argv[1]) : 8;
+	std::vector<WallClearance> serial_cc(1), parallel_cc(nworkers);
+	double t_serial, t_batch1, t_batchn;
+
+	auto serial = solve(serial_cc, 1, t_serial);
+	auto batch1 = solve(parallel_cc, 1, t_batch1);
+	auto batchn = solve(parallel_cc, 0, t_batchn);
+	printf("serial: %zu states %.3fs\n", serial.size(), t_serial);
+	printf("%d workers, batch 1: %zu states %.3fs\n", nworkers, batch1.size(), t_batch1);
+	printf("%d workers, batch %d: %zu states %.3fs\n", nworkers, nworkers, batchn.size(), t_batchn);
+
+	int bad = 0;
+	bool same = !serial.empty() && serial.size() == batch1.size();
+	for (size_t i = 0; same && i < serial.size(); i++)
+		same = serial[i] == batch1[i];
+	if (!same) {
+		printf("batch 1 differs from the serial builder\n");
+		bad++;
+	}
+	if (batchn.empty()) {
+		printf("batch %d found no path\n", nworkers);
+		bad++;
+	}
+	return sancheck::report(bad, "builds");
+}
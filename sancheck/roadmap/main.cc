@@ -0,0 +1,152 @@
+/*
+ * Regression cases of vecio::RoadMapFile
+ *
+ * 1. A text roadmap whose last line is a 'v' line ending at a page boundary,
+ *    with an unmapped page after the mapping. strtod used to skip the final
+ *    '\n' and fault on the next page.
+ * 2. Corrupted binary roadmaps must be rejected by the constructor.
+ *
+ * Usage: sancheck_roadmap [scratch directory]
+ */
+#include <vecio/roadmap.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+using vecio::RoadMapFile;
+
+static int failures = 0;
+
+static void expect(bool cond, const std::string& what)
+{
+	if (!cond) {
+		printf("FAILED: %s\n", what.c_str());
+		failures++;
+	}
+}
+
+static void write_file(const std::string& fn, const std::string& content)
+{
+	FILE* f = fopen(fn.c_str(), "wb");
+	fwrite(content.data(), 1, content.size(), f);
+	fclose(f);
+}
+
+static std::string read_file(const std::string& fn)
+{
+	std::string ret;
+	FILE* f = fopen(fn.c_str(), "rb");
+	char buf[4096];
+	size_t n;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		ret.append(buf, n);
+	fclose(f);
+	return ret;
+}
+
+static void vertex_lines_at_page_end(const std::string& dir)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	std::string text;
+	const std::string line = "v 1.5 2.5\n";
+	while (text.size() + line.size() <= size_t(page))
+		text += line;
+	// Pad the last line so the file is exactly one page
+	text.insert(text.size() - 1, std::string(page - text.size(), ' '));
+	std::string text_fn = dir + "/roadmap_v.txt";
+	std::string bin_fn = dir + "/roadmap_v.bin";
+	write_file(text_fn, text);
+
+	/*
+	 * Leave a one page hole between two PROT_NONE pages. mmap places the
+	 * one page mapping of convertText in the hole, so reading past it
+	 * faults.
+	 */
+	char* guard = static_cast<char*>(::mmap(nullptr, 3 * page, PROT_NONE,
+	                                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+	::munmap(guard + page, page);
+	RoadMapFile::convertText(text_fn, bin_fn);
+	::munmap(guard, page);
+	::munmap(guard + 2 * page, page);
+
+	RoadMapFile rm(bin_fn);
+	size_t nlines = text.size() / line.size();
+	expect(rm.dim() == 2, "dimension of 'v' lines");
+	expect(rm.numVertices() == nlines, "number of 'v' lines");
+	expect(rm.vertex(nlines - 1)[1] == 2.5, "last 'v' line");
+}
+
+static void corrupted_binaries(const std::string& dir)
+{
+	std::string fn = dir + "/roadmap.bin";
+	std::vector<double> V = { 0.0, 0.0, 1.0, 1.0, 2.0, 2.0 };
+	std::vector<RoadMapFile::Edge> edges = { {0, 1}, {1, 2} };
+	std::vector<RoadMapFile::Edge> pending = { {0, 2} };
+	RoadMapFile::write(fn, V.data(), 3, 2, edges, pending);
+	const std::string good = read_file(fn);
+	{
+		RoadMapFile rm(fn);
+		expect(rm.numEdges() == 2 && rm.numPending() == 1, "round trip");
+	}
+
+	using Header = RoadMapFile::Header;
+	Header h;
+	memcpy(&h, good.data(), sizeof(h));
+	auto rejected = [&](const char* what, std::function<void(std::string&)> corrupt) {
+		std::string bytes = good;
+		corrupt(bytes);
+		write_file(fn, bytes);
+		bool thrown = false;
+		try {
+			RoadMapFile rm(fn);
+		} catch (std::runtime_error& e) {
+			thrown = true;
+		}
+		expect(thrown, std::string("reject ") + what);
+	};
+	auto patch_header = [](std::string& bytes, const Header& nh) {
+		memcpy(&bytes[0], &nh, sizeof(nh));
+	};
+	rejected("truncated file", [](std::string& b) { b.resize(b.size() - 8); });
+	rejected("section past the end", [&](std::string& b) {
+		Header nh = h;
+		nh.n_pending = 1000;
+		patch_header(b, nh);
+	});
+	rejected("sections out of order", [&](std::string& b) {
+		Header nh = h;
+		std::swap(nh.offsets_off, nh.targets_off);
+		patch_header(b, nh);
+	});
+	rejected("huge vertex count", [&](std::string& b) {
+		Header nh = h;
+		nh.n_vertices = uint64_t(1) << 62;
+		patch_header(b, nh);
+	});
+	rejected("edge target out of range", [&](std::string& b) {
+		int32_t bad = 3;
+		memcpy(&b[h.targets_off], &bad, sizeof(bad));
+	});
+	rejected("decreasing offsets", [&](std::string& b) {
+		int64_t bad = 3;
+		memcpy(&b[h.offsets_off + sizeof(int64_t)], &bad, sizeof(bad));
+	});
+	rejected("pending edge out of range", [&](std::string& b) {
+		int32_t bad = -1;
+		memcpy(&b[h.pending_off + sizeof(int32_t)], &bad, sizeof(bad));
+	});
+}
+
+int main(int argc, char* argv[])
+{
+	std::string dir = argc > 1 ? argv[1] : ".";
+	vertex_lines_at_page_end(dir);
+	corrupted_binaries(dir);
+	if (failures > 0)
+		return 1;
+	printf("All roadmap cases passed\n");
+	return 0;
+}
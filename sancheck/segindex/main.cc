@@ -0,0 +1,86 @@
+/*
+ * First hits and hit counts of pycutec2::SegmentIndex, checked against
+ * line_segment_intersect_with_mesh on one edge at a time, and against the
+ * legacy batched line_segments_intersect_with_mesh.
+ *
+ * Usage: sancheck_segindex [number of edges] [number of queries]
+ */
+#include <pycutec2/pycutec2.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sancheck_common.h"
+
+using pycutec2::RowMatrixXd;
+using pycutec2::RowMatrixXi;
+
+int main(int argc, char* argv[])
+{
+	int NE = argc > 1 ? atoi(argv[1]) : 2000;
+	int NQ = argc > 2 ? atoi(argv[2]) : 20000;
+	std::mt19937 gen(1);
+	std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+	// Short random edges
+	RowMatrixXd V(NE * 2, 2);
+	RowMatrixXi E(NE, 2);
+	for (int i = 0; i < NE; i++) {
+		V(2 * i, 0) = unit(gen);
+		V(2 * i, 1) = unit(gen);
+		V(2 * i + 1, 0) = V(2 * i, 0) + 0.05 * (unit(gen) - 0.5);
+		V(2 * i + 1, 1) = V(2 * i, 1) + 0.05 * (unit(gen) - 0.5);
+		E(i, 0) = 2 * i;
+		E(i, 1) = 2 * i + 1;
+	}
+	// Long random queries, every 5th one is axis aligned
+	RowMatrixXd QV(NQ * 2, 2);
+	RowMatrixXi QE(NQ, 2);
+	for (int i = 0; i < NQ; i++) {
+		QV(2 * i, 0) = unit(gen);
+		QV(2 * i, 1) = unit(gen);
+		QV(2 * i + 1, 0) = unit(gen);
+		QV(2 * i + 1, 1) = i % 5 == 0 ? QV(2 * i, 1) : unit(gen);
+		QE(i, 0) = 2 * i;
+		QE(i, 1) = 2 * i + 1;
+	}
+
+	sancheck::Timer timer;
+	pycutec2::SegmentIndex index(V, E);
+	auto first = index.firstHits(QV, QE);
+	auto all = index.allHits(QV, QE);
+	double t_index = timer.lap();
+	auto legacy = pycutec2::line_segments_intersect_with_mesh(QV, QE, V, E);
+	double t_legacy = timer.lap();
+
+	const Eigen::VectorXi& first_hit = std::get<0>(first);
+	const Eigen::VectorXi& first_elem = std::get<2>(first);
+	const Eigen::VectorXi& offsets = std::get<0>(all);
+	int bad = 0;
+	for (int i = 0; i < NQ; i++) {
+		Eigen::Vector2d from = QV.row(2 * i).transpose();
+		Eigen::Vector2d to = QV.row(2 * i + 1).transpose();
+		double best_tau = 2.0;
+		int best_elem = -1;
+		int nhits = 0;
+		for (int e = 0; e < NE; e++) {
+			auto r = pycutec2::line_segment_intersect_with_mesh(from, to, V, E.middleRows(e, 1));
+			if (!std::get<0>(r))
+				continue;
+			nhits++;
+			// With a single edge, element 3 is the tau of the query
+			if (std::get<3>(r) < best_tau) {
+				best_tau = std::get<3>(r);
+				best_elem = e;
+			}
+		}
+		if (first_hit(i) != (best_elem >= 0) || first_elem(i) != best_elem)
+			bad++;
+		else if (offsets(i + 1) - offsets(i) != nhits)
+			bad++;
+		else if (std::get<0>(legacy)(i) != (best_elem >= 0))
+			bad++;
+	}
+	printf("%d edges, %d queries, %d hits\n", NE, NQ, int(offsets(NQ)));
+	printf("SegmentIndex %.3fs, line_segments_intersect_with_mesh %.3fs\n", t_index, t_legacy);
+	return sancheck::report(bad, "queries");
+}
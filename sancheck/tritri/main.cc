@@ -0,0 +1,100 @@
+/*
+ * Coplanar intersecting face pairs found by TriTriCopIsect must be exactly
+ * the pairs TriTriIntersect reports as coplanar over all face pairs.
+ *
+ * Usage: sancheck_tritri [number of faces per mesh]
+ */
+#include <tritri/tritri_cop.h>
+#include <Eigen/Core>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <set>
+#include <utility>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sancheck_common.h"
+
+using Pairs = std::set<std::pair<int, int>>;
+
+/*
+ * Half of the faces lie on a few shared planes so that coplanar
+ * intersections are common. The other half are small random triangles,
+ * and one in every 100 faces is degenerate (collinear vertices).
+ */
+void random_mesh(std::mt19937& gen, int nf, Eigen::MatrixXd& V, Eigen::MatrixXi& F)
+{
+	std::uniform_real_distribution<double> pos(0.0, 10.0);
+	std::uniform_real_distribution<double> off(-0.5, 0.5);
+	std::uniform_int_distribution<int> plane(0, 3);
+	V.resize(nf * 3, 3);
+	F.resize(nf, 3);
+	for (int i = 0; i < nf; i++) {
+		Eigen::Vector3d c(pos(gen), pos(gen), pos(gen));
+		bool flat = i % 2 == 0;
+		if (flat)
+			c(2) = 2.5 * plane(gen);
+		Eigen::Vector3d d(off(gen), off(gen), flat ? 0.0 : off(gen));
+		for (int k = 0; k < 3; k++) {
+			if (i % 100 != 1)
+				d = Eigen::Vector3d(off(gen), off(gen), flat ? 0.0 : off(gen));
+			V.row(i * 3 + k) = (c + k * d).transpose();
+			F(i, k) = i * 3 + k;
+		}
+	}
+}
+
+Pairs brute_force(const Eigen::MatrixXd& V0, const Eigen::MatrixXi& F0,
+                  const Eigen::MatrixXd& V1, const Eigen::MatrixXi& F1)
+{
+	Pairs ret;
+	Eigen::Vector3d isectpt0, isectpt1;
+	int cop;
+	for (int i = 0; i < F0.rows(); i++) {
+		Eigen::Vector3d v0 = V0.row(F0(i, 0));
+		Eigen::Vector3d v1 = V0.row(F0(i, 1));
+		Eigen::Vector3d v2 = V0.row(F0(i, 2));
+		for (int j = 0; j < F1.rows(); j++) {
+			Eigen::Vector3d u0 = V1.row(F1(j, 0));
+			Eigen::Vector3d u1 = V1.row(F1(j, 1));
+			Eigen::Vector3d u2 = V1.row(F1(j, 2));
+			bool isect = tritri::TriTriIntersect(v0, v1, v2,
+			                                     u0, u1, u2,
+			                                     &cop,
+			                                     isectpt0, isectpt1);
+			if (isect && cop)
+				ret.emplace(i, j);
+		}
+	}
+	return ret;
+}
+
+int main(int argc, char* argv[])
+{
+	int nf = argc > 1 ? atoi(argv[1]) : 3000;
+	std::mt19937 gen(1);
+	Eigen::MatrixXd V0, V1;
+	Eigen::MatrixXi F0, F1;
+	random_mesh(gen, nf, V0, F0);
+	random_mesh(gen, nf, V1, F1);
+
+	sancheck::Timer timer;
+	Pairs expected = brute_force(V0, F0, V1, F1);
+	double t_brute = timer.lap();
+	Eigen::SparseMatrix<int> COP;
+	tritri::TriTriCopIsect(V0, F0, V1, F1, COP);
+	double t_tree = timer.lap();
+
+	Pairs actual;
+	for (int k = 0; k < COP.outerSize(); k++)
+		for (Eigen::SparseMatrix<int>::InnerIterator it(COP, k); it; ++it)
+			actual.emplace(int(it.row()), int(it.col()));
+
+	printf("%d x %d faces, %zu coplanar pairs\n", nf, nf, expected.size());
+	printf("brute force %.3fs, TriTriCopIsect %.3fs\n", t_brute, t_tree);
+	Pairs diff;
+	std::set_symmetric_difference(actual.begin(), actual.end(),
+	                              expected.begin(), expected.end(),
+	                              std::inserter(diff, diff.end()));
+	return sancheck::report(long(diff.size()), "pairs");
+}
@@ -0,0 +1,83 @@
+/*
+ * Collision verdicts of UnitWorld on random unit states.
+ *
+ * Within each backend, isValidBatch (multi- and single-threaded) must
+ * agree with isValid; across backends, CDModel::BACKEND_FLAT_BVH must
+ * agree with CDModel::BACKEND_FCL.
+ *
+ * Usage: sancheck_unitworld <env OBJ> <rob OBJ> [number of states]
+ */
+#include <osr/unit_world.h>
+#include <osr/cdmodel.h>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sancheck_common.h"
+
+using osr::UnitWorld;
+using osr::CDModel;
+
+/*
+ * Returns the number of states where isValidBatch differs from isValid,
+ * and the isValid verdicts in valid
+ */
+int check_batch(UnitWorld& uw, const osr::ArrayOfStates& qs, const char* backend,
+                std::vector<bool>& valid)
+{
+	const int N = qs.rows();
+	sancheck::Timer timer;
+	valid.resize(N);
+	int nvalid = 0;
+	for (int i = 0; i < N; i++) {
+		valid[i] = uw.isValid(qs.row(i).transpose());
+		nvalid += valid[i] ? 1 : 0;
+	}
+	double t_loop = timer.lap();
+	auto bits = uw.isValidBatch(qs);
+	double t_batch = timer.lap();
+	auto bits_st = uw.isValidBatch(qs, true, false);
+
+	int bad = 0;
+	for (int i = 0; i < N; i++) {
+		bool mt = (bits(i / 8) >> (i % 8)) & 1;
+		bool st = (bits_st(i / 8) >> (i % 8)) & 1;
+		if (mt != valid[i] || st != valid[i])
+			bad++;
+	}
+	printf("%s: %d/%d valid, isValid %.3fs, isValidBatch %.3fs, %d batch mismatches\n",
+	       backend, nvalid, N, t_loop, t_batch, bad);
+	return bad;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s <env OBJ> <rob OBJ> [number of states]\n", argv[0]);
+		return 1;
+	}
+	int N = argc > 3 ? atoi(argv[3]) : 10000;
+	UnitWorld uw;
+	uw.loadModelFromFile(argv[1]);
+	uw.loadRobotFromFile(argv[2]);
+	uw.scaleToUnit();
+	uw.angleModel(0.0f, 0.0f);
+
+	std::mt19937 gen(1);
+	auto qs = sancheck::random_se3<osr::ArrayOfStates>(gen, N, 0.5);
+	std::vector<bool> fcl_valid, flat_valid;
+	int bad = check_batch(uw, qs, "fcl", fcl_valid);
+	uw.setCollisionBackend(CDModel::BACKEND_FLAT_BVH);
+	bad += check_batch(uw, qs, "flat_bvh", flat_valid);
+
+	int disagree = 0;
+	for (int i = 0; i < N; i++) {
+		if (fcl_valid[i] == flat_valid[i])
+			continue;
+		if (disagree++ < 10)
+			printf("state %d: fcl says %s, flat_bvh disagrees\n",
+			       i, fcl_valid[i] ? "free" : "colliding");
+	}
+	printf("flat_bvh vs fcl: %d disagreements\n", disagree);
+	return sancheck::report(bad + disagree, "states");
+}
@@ -0,0 +1,86 @@
+/*
+ * SE3KNN k-nearest and radius queries, checked with an exhaustive scan of
+ * osr::distance.
+ *
+ * Usage: sancheck_vpknn [number of states] [number of queries] [k]
+ */
+#include <osr/se3_knn.h>
+#include <osr/osr_state.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <utility>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include "sancheck_common.h"
+
+int main(int argc, char* argv[])
+{
+	int N = argc > 1 ? atoi(argv[1]) : 20000;
+	int NQ = argc > 2 ? atoi(argv[2]) : 1000;
+	int K = argc > 3 ? atoi(argv[3]) : 8;
+	const double tol = 1e-9;
+	std::mt19937 gen(1);
+	auto states = sancheck::random_se3<osr::ArrayOfStates>(gen, N, 1.0);
+	auto queries = sancheck::random_se3<osr::ArrayOfStates>(gen, NQ, 1.0);
+
+	sancheck::Timer timer;
+	osr::SE3KNN knn(states);
+	Eigen::MatrixXi indices;
+	Eigen::MatrixXd distances;
+	std::tie(indices, distances) = knn.nearestK(queries, K);
+	double t_index = timer.lap();
+
+	std::vector<std::vector<std::pair<double, int>>> brute(NQ);
+#pragma omp parallel for
+	for (int i = 0; i < NQ; i++) {
+		osr::StateVector q = queries.row(i).transpose();
+		brute[i].resize(N);
+		for (int j = 0; j < N; j++)
+			brute[i][j] = std::make_pair(osr::distance(q, states.row(j).transpose()), j);
+		std::sort(brute[i].begin(), brute[i].end());
+	}
+	double t_brute = timer.lap();
+
+	/*
+	 * Ties may be ordered differently, hence the K-th distance and the
+	 * distance of every returned index are compared instead of the indices.
+	 * The radius query uses the median K-th distance as r.
+	 */
+	int bad = 0;
+	std::vector<double> kth(NQ);
+	for (int i = 0; i < NQ; i++) {
+		osr::StateVector q = queries.row(i).transpose();
+		bool ok = true;
+		for (int k = 0; k < K; k++) {
+			int j = indices(i, k);
+			if (j < 0 || j >= N) {
+				ok = false;
+				break;
+			}
+			double d = osr::distance(q, states.row(j).transpose());
+			ok = ok && std::abs(d - distances(i, k)) < tol;
+			ok = ok && std::abs(distances(i, k) - brute[i][k].first) < tol;
+		}
+		if (!ok)
+			bad++;
+		kth[i] = brute[i][K - 1].first;
+	}
+	std::vector<double> sorted_kth(kth);
+	std::nth_element(sorted_kth.begin(), sorted_kth.begin() + NQ / 2, sorted_kth.end());
+	double r = sorted_kth[NQ / 2];
+	auto csr = knn.radius(queries, r);
+	const Eigen::VectorXi& offsets = std::get<0>(csr);
+	for (int i = 0; i < NQ; i++) {
+		auto end = std::upper_bound(brute[i].begin(), brute[i].end(),
+		                            std::make_pair(r, N));
+		int expected = int(end - brute[i].begin());
+		if (offsets(i + 1) - offsets(i) != expected)
+			bad++;
+	}
+
+	printf("%d states, %d queries, k = %d, r = %f\n", N, NQ, K, r);
+	printf("SE3KNN %.3fs, brute force %.3fs\n", t_index, t_brute);
+	return sancheck::report(bad, "queries");
+}
@@ -4,7 +4,7 @@
 # SPDX-License-Identifier: GPL-2.0-or-later
 
 '''
-Solve the SSSP problem in forest, with NetworkX
+Solve the SSSP problem in forest, with pyse3ompl.ForestSSSP or NetworkX
 '''
 
 import sys, os
@@ -307,6 +307,52 @@ class ForestPathFinder(object):
         else:
             np.savetxt(self._args.out, self._sssp_full, fmt='%.17g')
 
+class NativeForestPathFinder(object):
+    def __init__(self, args):
+        import pyse3ompl as plan
+        self._args = args
+        self._roots = _load(args.rootf, ds_name='KEYQ_OMPL')
+        self._ssc_files = _lsv(args.indir, args.prefix_ssc, '.mat')
+        self._ct_files = _lsv(args.indir, args.prefix_ct, '.mat')
+        assert len(self._ssc_files) == len(self._ct_files)
+        assert self._roots.shape[0] == len(self._ct_files)
+        pds = _load(args.pdsf, 'Q')
+        pds_flags = _load(args.pdsf, 'QF')
+        if pds_flags is None:
+            pds_flags = np.zeros((0), dtype=np.uint32)
+        self._plan = plan
+        self._fs = plan.ForestSSSP(self._roots, pds, pds_flags.astype(np.uint32))
+
+    def solve(self):
+        plan = self._plan
+        E = _load(self._args.forest_edge, 'E')[:].astype(np.int64)
+        openset = _load(self._args.forest_edge, 'OpenTree')
+        if openset is None:
+            openset = np.zeros((0), dtype=np.int64)
+            goal_tree = 1
+        else:
+            goal_tree = plan.ForestSSSP.OPEN_SPACE
+        self._fs.set_forest_edges(E, openset[:].astype(np.int64))
+        if not self._fs.solve_forest(0, goal_tree):
+            return False
+        print('Forest-level shortest path {}'.format(self._fs.get_forest_path()))
+        for root in progressbar(self._fs.get_forest_path_trees()):
+            d = loadmat(self._ct_files[root])
+            ssc = sparse.csc_matrix(loadmat(self._ssc_files[root])['C'], dtype=np.int32)
+            self._fs.add_tree(root, ssc,
+                              d['CNVI'].flatten().astype(np.int64),
+                              d['CNV'],
+                              d['CE'].astype(np.int64))
+        self._sssp_full = self._fs.stitch_path()
+        return True
+
+    def output(self):
+        if self._args.out is None:
+            print(self._fs.get_forest_path())
+            print(self._sssp_full)
+        else:
+            np.savetxt(self._args.out, self._sssp_full, fmt='%.17g')
+
 def main():
     parser = argparse.ArgumentParser(formatter_class=argparse.ArgumentDefaultsHelpFormatter)
     parser.add_argument('--indir', help='input directory for ssc-*.mat and file', required=True)
@@ -321,8 +367,12 @@ def main():
     parser.add_argument('--bloom_dir', help='Directory of PDS blooming trees', default=None)
     parser.add_argument('--prefix_bloom', help='File name prefix of blooming files', default='bloom-from_')
     parser.add_argument('--out', help='Output path file. default to stdout', default=None)
+    parser.add_argument('--python', help='Use the NetworkX implementation. Implied by --bloom_dir', action='store_true')
     args = parser.parse_args()
-    fpf = ForestPathFinder(args)
+    if args.python or args.bloom_dir is not None:
+        fpf = ForestPathFinder(args)
+    else:
+        fpf = NativeForestPathFinder(args)
     if fpf.solve():
         fpf.output()
 
@@ -54,6 +54,22 @@ def collect_ITE(files, buf, ITE, low, high, pbar=None, QF=None, roots_to_open=No
             # print("update roots_to_open {}".format(rows))
             roots_to_open.update(rows)
 
+def print_edge_native(args):
+    import pyse3ompl as plan
+    if args.pdsflags is not None:
+        QF = np.load(args.pdsflags)['QF'].astype(np.uint32)
+    else:
+        QF = np.zeros((0), dtype=np.uint32)
+    ssc = [sparse.csc_matrix(matio.load(fn)['C'], dtype=np.int32) for fn in progressbar(args.files)]
+    print("N {}".format(len(ssc)))
+    edge, roots_to_open_list = plan.build_forest_edges(ssc, QF)
+    del ssc
+    f = h5py.File(args.out, mode='a')
+    matio.hdf5_overwrite(f, 'E', edge)
+    if args.pdsflags is not None:
+        matio.hdf5_overwrite(f, 'OpenTree', roots_to_open_list)
+    f.close()
+
 def print_edge(args):
     if args.pdsflags is not None:
         QF = np.load(args.pdsflags)['QF']
@@ -108,11 +124,15 @@ def main():
     parser.add_argument('files', help='ssc-*.mat file', nargs='+')
     parser.add_argument('--out', help='output edge file in .hdf5', required=True)
     parser.add_argument('--pdsflags', help='File that stores PDS Flags, usually in the same npz file that also stores PDS', default=None)
+    parser.add_argument('--python', help='Use the pure python implementation instead of pyse3ompl.build_forest_edges', action='store_true')
     args = parser.parse_args()
     if not args.out.endswith('.hdf5'):
         print("--out requires hdf5 extension")
         return
-    print_edge(args)
+    if args.python:
+        print_edge(args)
+    else:
+        print_edge_native(args)
 
 if __name__ == '__main__':
     main()
@@ -41,8 +41,8 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 	Graph g;
-	g.loadRoadMap(move(ifstream(argv[1])));
+	g.loadRoadMapFile(argv[1]);
 	for (int i = 2; i < argc; i++) 
-		g.mergeRoadMap(move(ifstream(argv[i])));
+		g.mergeRoadMapFile(argv[i]);
 	g.printGraph(cout);
 }
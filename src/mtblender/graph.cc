@@ -6,6 +6,9 @@
 #include "graph.h"
 #include <vector>
 #include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <vecio/roadmap.h>
 #include <ompl/datastructures/NearestNeighborsGNAT.h>
 
 using std::unique_ptr;
@@ -17,6 +20,19 @@ Vertex::Vertex(std::istream& fin, int index_counter)
 	fin >> *this;
 }
 
+Vertex::Vertex(const double* q, int index_counter)
+	:index(index_counter)
+{
+	for (int i = 0; i < tr.rows(); i++)
+		tr(i) = q[i];
+	/* OMPL uses xyzw convention */
+	q += tr.rows();
+	rot.x() = q[0];
+	rot.y() = q[1];
+	rot.z() = q[2];
+	rot.w() = q[3];
+}
+
 std::istream& operator >> (std::istream& fin, Edge& e)
 {
 	return fin >> e.first >> e.second;
@@ -150,6 +166,58 @@ void Graph::mergeRoadMap(std::istream&& fin)
 	d_->addRRTPath(vlist);
 }
 
+namespace {
+
+void checkDimension(const vecio::RoadMapFile& rm, const std::string& fn)
+{
+	if (rm.dim() != kCSpaceDim)
+		throw std::runtime_error(fn + ": roadmap dimension " + std::to_string(rm.dim())
+		                         + " does not match the C-space dimension");
+}
+
+}
+
+void Graph::loadRoadMapFile(const std::string& fn)
+{
+	if (!vecio::RoadMapFile::isRoadMapFile(fn)) {
+		loadRoadMap(std::ifstream(fn));
+		return;
+	}
+	vecio::RoadMapFile rm(fn);
+	checkDimension(rm, fn);
+	d_->V_.clear();
+	d_->E_.clear();
+	d_->index_counter = 0;
+	d_->V_.reserve(rm.numVertices());
+	for (size_t i = 0; i < rm.numVertices(); i++) {
+		d_->V_.emplace_back(new Vertex(rm.vertex(i), d_->index_counter));
+		d_->index_counter++;
+	}
+	d_->E_.reserve(rm.numEdges());
+	rm.forEachEdge([this](int from, int to) {
+		d_->E_.emplace_back(from, to);
+	});
+
+	d_->buildNN();
+}
+
+void Graph::mergeRoadMapFile(const std::string& fn)
+{
+	if (!vecio::RoadMapFile::isRoadMapFile(fn)) {
+		mergeRoadMap(std::ifstream(fn));
+		return;
+	}
+	vecio::RoadMapFile rm(fn);
+	checkDimension(rm, fn);
+	std::vector<Vertex*> vlist;
+	vlist.reserve(rm.numVertices());
+	for (size_t i = 0; i < rm.numVertices(); i++) {
+		vlist.emplace_back(new Vertex(rm.vertex(i), d_->index_counter));
+		d_->index_counter++;
+	}
+	d_->addRRTPath(vlist);
+}
+
 void Graph::printGraph(std::ostream& fout)
 {
 	fout.precision(17);
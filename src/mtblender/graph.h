@@ -12,6 +12,7 @@
 #include <utility>
 #include <memory>
 #include <istream>
+#include <string>
 
 struct Vertex {
 	int index;
@@ -19,6 +20,8 @@ struct Vertex {
 	Eigen::Quaternion<double> rot;
 
 	Vertex(std::istream& fin, int index_counter);
+	/* Same layout as the text format */
+	Vertex(const double* q, int index_counter);
 };
 
 using Edge = std::pair<int, int>;
@@ -36,6 +39,9 @@ public:
 	void loadRoadMap(std::istream&&);
 	void mergePath(std::istream&&);
 	void mergeRoadMap(std::istream&&);
+	/* Accept both text and binary roadmaps (vecio/roadmap.h) */
+	void loadRoadMapFile(const std::string& fn);
+	void mergeRoadMapFile(const std::string& fn);
 	void printGraph(std::ostream&);
 private:
 	std::unique_ptr<GraphData> d_;
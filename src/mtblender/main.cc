@@ -40,7 +40,7 @@ int main(int argc, char* argv[])
 		return 0;
 	}
 	Graph g;
-	g.loadRoadMap(move(ifstream(argv[1])));
+	g.loadRoadMapFile(argv[1]);
 	g.mergePath(move(ifstream(argv[2])));
 	g.printGraph(cout);
 }
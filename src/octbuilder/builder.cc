@@ -19,6 +19,8 @@
 #include "space.h"
 #include "textvisualizer.h"
 #include "vis6d.h"
+#include <memory>
+#include <omp.h>
 
 using std::string;
 
@@ -168,7 +170,18 @@ int worker(NaiveRenderer* renderer)
 			std::cerr << "\tPD^T: " << pd << std::endl;
 		}
 	} else {
-		builder.buildOcTree(cc);
+		// ClearanceCalculator is not thread-safe, one per worker thread
+		using CCType = decltype(cc);
+		std::vector<std::unique_ptr<CCType>> worker_ccs;
+		std::vector<CCType*> ccs(1, &cc);
+		for (int i = 1; i < omp_get_max_threads(); i++) {
+			worker_ccs.emplace_back(new CCType(robot, env));
+			worker_ccs.back()->setC(bbmin, bbmax);
+			worker_ccs.back()->setDAlpha(dalpha);
+			ccs.emplace_back(worker_ccs.back().get());
+		}
+		std::cerr << "Building with " << ccs.size() << " worker threads\n";
+		builder.buildOcTree(ccs);
 	}
 	auto t2 = Clock::now();
 	std::chrono::duration<double, std::milli> dur = t2 - t1;